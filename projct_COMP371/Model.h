@@ -14,23 +14,35 @@
 
 #include "mesh.h"
 #include "shader.h"
+#include "texcache.h"
+#include "meshopt.h"
+#include "lod.h"
+#include "profiler.h"
 
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 #include <map>
+#include <unordered_map>
 #include <vector>
 using namespace std;
 
 unsigned int TextureFromFile(const char *path, const string &directory, bool gamma = false);
 
+unsigned int uploadTexture(const ImageData &image, GLint minFilter, GLint magFilter);
+unsigned int uploadCached(CachedTexture* entry, GLint minFilter, GLint magFilter);
+unsigned int loadCached(const string &path, GLint minFilter, GLint magFilter);
+
 class Model
 {
 public:
     // model data
     vector<Texture> textures_loaded;    // stores all the textures loaded so far, optimization to make sure textures aren't loaded more than once.
     vector<Mesh>    meshes;
+    vector<MeshOptStats> optStats;      // one per mesh, if bOptimizeMeshes
+    glm::vec3 boundsCenter = glm::vec3(0.0f); // bounding sphere in model space, for LOD selection
+    float boundsRadius = 0.0f;
     string directory;
     bool gammaCorrection;
 
@@ -38,22 +50,24 @@ public:
     Model(string const &path, bool gamma = false) : gammaCorrection(gamma)
     {
         loadModel(path);
+        upload();
     }
 
-    // draws the model, and thus all its meshes
-    void Draw(Shader &shader)
+    // Empty model, to be filled by loadModel() and upload().
+    Model() : gammaCorrection(false)
     {
-        for(unsigned int i = 0; i < meshes.size(); i++)
-            meshes[i].Draw(shader);
     }
-    
-private:
+
     // loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
+    // Only touches the CPU (parsing and texture decoding), so it can run on a worker thread.
     void loadModel(string const &path)
     {
+        PROFILE_ZONE("Model::loadModel");
         // read file via ASSIMP
         Assimp::Importer importer;
-        const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
+        // JoinIdenticalVertices so normals and tangents are smoothed over shared vertices; the rest of
+        // the optimization (see meshopt.h) happens per mesh in processMesh.
+        const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_JoinIdenticalVertices | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
         // check for errors
         if(!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
         {
@@ -65,6 +79,81 @@ private:
 
         // process ASSIMP's root node recursively
         processNode(scene->mRootNode, scene);
+        computeBounds();
+    }
+
+    // creates the GL objects for everything loadModel() prepared. Must run on the GL thread.
+    void upload()
+    {
+        PROFILE_ZONE("Model::upload");
+        for(unsigned int i = 0; i < pending.size(); i++)
+        {
+            unsigned int id = uploadCached(pending[i], GL_LINEAR_MIPMAP_LINEAR, GL_LINEAR);
+            textures_loaded[i].id = id;
+            for(unsigned int m = 0; m < meshes.size(); m++)
+                for(unsigned int t = 0; t < meshes[m].textures.size(); t++)
+                    if(meshes[m].textures[t].path == textures_loaded[i].path)
+                        meshes[m].textures[t].id = id;
+        }
+        pending.clear();
+        for(unsigned int m = 0; m < meshes.size(); m++)
+            meshes[m].setupMesh();
+    }
+
+    // draws the model, and thus all its meshes, at the given level of detail
+    void Draw(Shader &shader, unsigned int lod = 0)
+    {
+        for(unsigned int i = 0; i < meshes.size(); i++)
+            meshes[i].Draw(shader, lod);
+    }
+
+    // the most detail levels any mesh has
+    unsigned int lodLevels() const
+    {
+        unsigned int levels = 1;
+        for(unsigned int i = 0; i < meshes.size(); i++)
+            levels = std::max(levels, meshes[i].lodLevels());
+        return levels;
+    }
+
+    // triangles drawn at a level of detail
+    unsigned int lodTriangles(unsigned int lod) const
+    {
+        unsigned int triangles = 0;
+        for(unsigned int i = 0; i < meshes.size(); i++)
+        {
+            const Mesh &mesh = meshes[i];
+            if (mesh.lodCount.empty())
+                triangles += mesh.indices.size() / 3;
+            else
+                triangles += mesh.lodCount[std::min(lod, (unsigned int)mesh.lodCount.size() - 1)] / 3;
+        }
+        return triangles;
+    }
+    
+private:
+    // cache entries waiting for upload(), parallel to textures_loaded
+    vector<CachedTexture*> pending;
+    // index into textures_loaded by material path
+    unordered_map<string, unsigned int> loadedIndex;
+
+    // bounding box centre and the radius around it that holds every vertex
+    void computeBounds()
+    {
+        glm::vec3 lo(1e30f), hi(-1e30f);
+        for(unsigned int m = 0; m < meshes.size(); m++)
+            for(unsigned int v = 0; v < meshes[m].vertices.size(); v++)
+            {
+                lo = glm::min(lo, meshes[m].vertices[v].Position);
+                hi = glm::max(hi, meshes[m].vertices[v].Position);
+            }
+        if (lo.x > hi.x)
+            return;
+        boundsCenter = (lo + hi) * 0.5f;
+        boundsRadius = 0.0f;
+        for(unsigned int m = 0; m < meshes.size(); m++)
+            for(unsigned int v = 0; v < meshes[m].vertices.size(); v++)
+                boundsRadius = std::max(boundsRadius, glm::length(meshes[m].vertices[v].Position - boundsCenter));
     }
 
     // processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
@@ -166,8 +255,19 @@ private:
         std::vector<Texture> heightMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_height");
         textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
         
+        // weld, reorder for the vertex cache and for overdraw
+        if (bOptimizeMeshes)
+            optStats.push_back(optimizeMesh(vertices, indices));
+
+        // coarser levels of detail, appended to the index buffer
+        vector<unsigned int> lodStart, lodCount;
+        buildLods(vertices, indices, lodStart, lodCount);
+
         // return a mesh object created from the extracted mesh data
-        return Mesh(vertices, indices, textures);
+        Mesh result(vertices, indices, textures, false);
+        result.lodStart = lodStart;
+        result.lodCount = lodCount;
+        return result;
     }
 
     // checks all material textures of a given type and loads the textures if they're not loaded yet.
@@ -180,71 +280,180 @@ private:
             aiString str;
             mat->GetTexture(type, i, &str);
             // check if texture was loaded before and if so, continue to next iteration: skip loading a new texture
-            bool skip = false;
-            for(unsigned int j = 0; j < textures_loaded.size(); j++)
+            unordered_map<string, unsigned int>::iterator loaded = loadedIndex.find(str.C_Str());
+            if(loaded != loadedIndex.end())
             {
-                if(std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0)
-                {
-                    textures.push_back(textures_loaded[j]);
-                    skip = true; // a texture with the same filepath has already been loaded, continue to next one. (optimization)
-                    break;
-                }
-            }
-            if(!skip)
-            {   // if texture hasn't been loaded already, load it
-                Texture texture;
-                texture.id = TextureFromFile(str.C_Str(), this->directory);
-                texture.type = typeName;
-                texture.path = str.C_Str();
-                textures.push_back(texture);
-                textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecessary load duplicate textures.
+                textures.push_back(textures_loaded[loaded->second]);
+                continue;
             }
+            // otherwise get it from the texture cache, which only decodes it if no other model has.
+            // The GL texture is made in upload().
+            string filename = this->directory + '/' + string(str.C_Str());
+            bool decode;
+            CachedTexture* entry = textureCache().request(TextureCache::key2D(filename, GL_LINEAR_MIPMAP_LINEAR, GL_LINEAR), filename, decode);
+            if(decode)
+                entry->images.push_back(decodeImage(filename));
+            pending.push_back(entry);
+            Texture texture;
+            texture.id = 0;
+            texture.type = typeName;
+            texture.path = str.C_Str();
+            textures.push_back(texture);
+            loadedIndex[texture.path] = textures_loaded.size();
+            textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecessary load duplicate textures.
         }
         return textures;
     }
 };
 
 
-unsigned int TextureFromFile(const char *path, const string &directory, bool gamma)
+ImageData decodeImage(const string &path)
 {
-    string filename = string(path);
-    filename = directory + '/' + filename;
+    ImageData image;
+    image.path = path;
+    image.baked = openBaked(path);
+    if (image.baked)
+    {
+        image.pixels = (unsigned char*)image.baked->levelData(0);
+        image.width = image.baked->header->level[0].width;
+        image.height = image.baked->header->level[0].height;
+        image.channels = 4;
+        return image;
+    }
+    image.pixels = stbi_load(path.c_str(), &image.width, &image.height, &image.channels, 0);
+    return image;
+}
+
+void freeImage(ImageData &image)
+{
+    if (image.baked)
+        delete image.baked;
+    else
+        stbi_image_free(image.pixels);
+    image.baked = NULL;
+    image.pixels = NULL;
+}
+
+// GL internal format of a compressed .ctex, 0 for RGBA8 or if the driver
+// can't sample it.
+GLenum compressedFormat(uint32_t format)
+{
+    if (format == CTEX_BC1 && GLEW_EXT_texture_compression_s3tc)
+        return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    if (format == CTEX_BC3 && GLEW_EXT_texture_compression_s3tc)
+        return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    if (format == CTEX_BC7 && GLEW_ARB_texture_compression_bptc)
+        return GL_COMPRESSED_RGBA_BPTC_UNORM;
+    return 0;
+}
+
+// One level of a baked texture into target (a 2D texture or a cubemap face).
+// Compressed levels the driver can't take are expanded to RGBA8 first.
+void uploadBakedLevel(GLenum target, const CtexImage &baked, int level, GLint internalFormat)
+{
+    const CtexHeader* header = baked.header;
+    const CtexLevel &info = header->level[level];
+    GLenum compressed = compressedFormat(header->format);
+    if (compressed)
+        glCompressedTexImage2D(target, level, compressed, info.width, info.height, 0, info.size, baked.levelData(level));
+    else if (header->format == CTEX_RGBA8)
+        glTexImage2D(target, level, internalFormat, info.width, info.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, baked.levelData(level));
+    else
+    {
+        std::vector<unsigned char> rgba = bcDecodeImage(baked.levelData(level), info.width, info.height, ctexBcFormat(header->format));
+        glTexImage2D(target, level, internalFormat, info.width, info.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, &rgba[0]);
+    }
+}
 
+unsigned int uploadTexture(const ImageData &image, GLint minFilter, GLint magFilter)
+{
     unsigned int textureID;
     glGenTextures(1, &textureID);
 
-    int width, height, nrComponents;
-    unsigned char *data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-    if (data)
-    {
-        GLenum format;
-        if (nrComponents == 1)
-            format = GL_RED;
-        else if (nrComponents == 3)
-            format = GL_RGB;
-        else if (nrComponents == 4)
-            format = GL_RGBA;
+    GLenum format;
+    if (image.channels == 1)
+        format = GL_RED;
+    else if (image.channels == 3)
+        format = GL_RGB;
+    else if (image.channels == 4)
+        format = GL_RGBA;
 
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
+    glBindTexture(GL_TEXTURE_2D, textureID);
+    if (image.baked)
+    {
+        // the whole chain is in the file, straight from the mapping
+        const CtexHeader* header = image.baked->header;
+        for (unsigned int l = 0; l < header->levels; l++)
+            uploadBakedLevel(GL_TEXTURE_2D, *image.baked, l, GL_RGBA);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, header->levels - 1);
+    }
+    else
+    {
+        glTexImage2D(GL_TEXTURE_2D, 0, format, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, image.pixels);
         glGenerateMipmap(GL_TEXTURE_2D);
+    }
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minFilter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, magFilter);
+
+    return textureID;
+}
 
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+// GPU memory of an uploaded image, for the texture report.
+size_t textureBytes(const ImageData &image, bool mips)
+{
+    size_t bytes = (size_t)image.width * image.height * 4;
+    if (image.baked && compressedFormat(image.baked->header->format))
+        bytes = mips ? image.baked->dataBytes() : image.baked->header->level[0].size;
+    else if (mips)
+        bytes = bytes * 4 / 3;
+    return bytes;
+}
 
-        stbi_image_free(data);
+// Make sure a cached 2D texture is on the GPU and return it. The decoded
+// image is freed after the upload.
+unsigned int uploadCached(CachedTexture* entry, GLint minFilter, GLint magFilter)
+{
+    if (entry->id)
+        return entry->id;
+    unsigned int textureID;
+    size_t bytes = 0;
+    if (!entry->images.empty() && entry->images[0].pixels)
+    {
+        textureID = uploadTexture(entry->images[0], minFilter, magFilter);
+        bytes = textureBytes(entry->images[0], true);
     }
     else
     {
-        std::cout << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(data);
+        std::cout << "Texture failed to load at path: " << entry->label << std::endl;
+        glGenTextures(1, &textureID);
     }
-
+    for (unsigned int i = 0; i < entry->images.size(); i++)
+        freeImage(entry->images[i]);
+    entry->images.clear();
+    textureCache().resident(entry, textureID, bytes);
     return textureID;
 }
 
+// Load a 2D texture through the cache, right away.
+unsigned int loadCached(const string &path, GLint minFilter, GLint magFilter)
+{
+    bool decode;
+    CachedTexture* entry = textureCache().request(TextureCache::key2D(path, minFilter, magFilter), path, decode);
+    if (decode)
+        entry->images.push_back(decodeImage(path));
+    return uploadCached(entry, minFilter, magFilter);
+}
+
+unsigned int TextureFromFile(const char *path, const string &directory, bool /*gamma*/)
+{
+    string filename = string(path);
+    filename = directory + '/' + filename;
+    return loadCached(filename, GL_LINEAR_MIPMAP_LINEAR, GL_LINEAR);
+}
+
 
 
 #endif
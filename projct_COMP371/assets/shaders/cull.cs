@@ -0,0 +1,123 @@
+#version 430 core
+// Frustum culling, LOD selection and indirect command generation for the
+// trees and rocks, one invocation per instance. See gpucull.h; cullReference
+// there is the same on the CPU and has to stay in step with this.
+layout (local_size_x = 64) in;
+
+#define MAX_LODS 4
+#define NO_IMPOSTOR 0xffffffffu
+
+struct Candidate {
+    vec4 placement; // world position, yaw
+    uvec4 model;    // x: model id, y: chunk
+};
+struct ModelInfo {
+    vec4 bounds;  // centre, radius
+    uvec4 lods;   // levels, first part, parts, impostor
+    uvec4 region; // first command
+};
+struct Command {
+    uint count;
+    uint instanceCount;
+    uint firstIndex;
+    int baseVertex;
+    uint baseInstance;
+};
+struct Instance {
+    vec4 placement;
+    float fade;
+    int layer;
+};
+struct ImpostorCommand {
+    uint count;
+    uint instanceCount;
+    uint first;
+    uint baseInstance;
+};
+
+layout (std430, binding = 0) readonly buffer Candidates { Candidate candidates[]; };
+layout (std430, binding = 1) buffer Lods { uint lods[]; };
+layout (std430, binding = 2) readonly buffer Models { ModelInfo models[]; };
+layout (std430, binding = 3) readonly buffer Layers { int layers[]; };
+layout (std430, binding = 4) buffer Commands { Command commands[]; };
+layout (std430, binding = 5) writeonly buffer Instances { Instance instances[]; };
+layout (std430, binding = 6) buffer ImpostorCommands { ImpostorCommand impostorCommands[]; };
+layout (std430, binding = 7) writeonly buffer ImpostorInstances { vec4 impostorInstances[]; };
+
+uniform uint candidateCount;
+uniform uint modelLimit;       // models from here on are skipped
+uniform vec4 planes[6];        // normalized, inside is positive
+uniform vec3 eye;
+uniform float projScale;
+uniform bool lodEnabled;
+uniform float lodScreenSizes[MAX_LODS - 1];
+uniform float lodBand;
+uniform bool impostors;
+uniform float impostorScreenSize;
+uniform float impostorBand;
+uniform uint chunkMask[8];     // chunks the occlusion buffer left visible, see CullParams
+
+// selectLod in lod.h
+int selectLod(float size, int current, int levels)
+{
+    if (!lodEnabled || levels <= 1)
+        return 0;
+    current = min(current, levels - 1);
+    while (current > 0 && size > lodScreenSizes[current - 1] * (1.0 + lodBand))
+        --current;
+    while (current < levels - 1 && size < lodScreenSizes[current] * (1.0 - lodBand))
+        ++current;
+    return current;
+}
+
+void main()
+{
+    uint i = gl_GlobalInvocationID.x;
+    if (i >= candidateCount)
+        return;
+    Candidate candidate = candidates[i];
+    uint m = candidate.model.x;
+    if (m >= modelLimit)
+        return;
+    ModelInfo info = models[m];
+
+    // bounding sphere in the world, turned by yaw like glm::rotate around y
+    float c = cos(candidate.placement.w), s = sin(candidate.placement.w);
+    vec3 b = info.bounds.xyz;
+    vec3 centre = candidate.placement.xyz + vec3(c * b.x + s * b.z, b.y, c * b.z - s * b.x);
+    float radius = info.bounds.w;
+    float size = radius * projScale / max(length(centre - eye), 0.001);
+    int levels = int(info.lods.x);
+    int lod = selectLod(size, int(lods[i]), levels);
+    lods[i] = uint(lod);
+
+    uint chunk = candidate.model.y;
+    if (chunk < 256u && (chunkMask[chunk / 32u] & (1u << (chunk % 32u))) == 0u)
+        return;
+
+    for (int p = 0; p < 6; ++p)
+        if (dot(planes[p].xyz, centre) + planes[p].w < -radius)
+            return;
+
+    float fade = 1.0;
+    if (impostors && info.lods.w != NO_IMPOSTOR) {
+        float lo = impostorScreenSize * (1.0 - impostorBand);
+        float hi = impostorScreenSize * (1.0 + impostorBand);
+        fade = clamp((size - lo) / (hi - lo), 0.0, 1.0);
+        if (fade < 1.0) {
+            uint slot = atomicAdd(impostorCommands[info.lods.w].instanceCount, 1u);
+            impostorInstances[impostorCommands[info.lods.w].baseInstance + slot] = vec4(centre, fade);
+            if (fade <= 0.0)
+                return;
+        }
+    }
+    for (uint k = 0u; k < info.lods.z; ++k) {
+        uint command = info.region.x + k * uint(levels) + uint(lod);
+        uint slot = atomicAdd(commands[command].instanceCount, 1u);
+        Instance instance;
+        instance.placement = candidate.placement;
+        instance.fade = fade;
+        instance.layer = layers[info.lods.y + k];
+        instances[commands[command].baseInstance + slot] = instance;
+    }
+}
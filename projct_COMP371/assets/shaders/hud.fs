@@ -0,0 +1,12 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+uniform sampler2D font;
+uniform vec4 color;
+
+void main()
+{
+    FragColor = vec4(color.rgb, color.a * texture(font, TexCoords).r);
+}
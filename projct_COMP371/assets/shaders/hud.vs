@@ -0,0 +1,14 @@
+#version 330 core
+// Text overlay, see hud.h. Positions are in pixels from the top left.
+layout (location = 0) in vec4 aPosTex;
+
+out vec2 TexCoords;
+
+uniform vec2 screenSize;
+
+void main()
+{
+    TexCoords = aPosTex.zw;
+    vec2 ndc = aPosTex.xy / screenSize * 2.0 - 1.0;
+    gl_Position = vec4(ndc.x, -ndc.y, 0.0, 1.0);
+}
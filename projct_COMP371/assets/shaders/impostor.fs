@@ -0,0 +1,84 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 AtlasCoords;
+in vec3 QuadPos;
+flat in vec3 ViewDir;
+flat in float MeshFade;
+
+uniform sampler2D colorAtlas;
+uniform sampler2D shadowMap;
+uniform sampler2D normalAtlas;
+
+uniform mat4 projection;
+uniform mat4 view;
+uniform mat4 lightSpaceMatrix;
+uniform vec3 lightPos;
+uniform vec3 viewPos;
+uniform float radius;
+
+uniform bool sToggle = true;
+uniform bool dayToggle = true;
+uniform bool matToggle = true;
+
+// 4x4 ordered dither, the mesh uses the complement (see main.fs).
+float dither()
+{
+    int x = int(gl_FragCoord.x) & 3;
+    int y = int(gl_FragCoord.y) & 3;
+    const float bayer[16] = float[16](0.0, 8.0, 2.0, 10.0, 12.0, 4.0, 14.0, 6.0,
+                                      3.0, 11.0, 1.0, 9.0, 15.0, 7.0, 13.0, 5.0);
+    return (bayer[y * 4 + x] + 0.5) / 16.0;
+}
+
+float ShadowCalculation(vec4 fragPosLightSpace, vec3 normal, vec3 lightDir)
+{
+    vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
+    projCoords = projCoords * 0.5 + 0.5;
+    float currentDepth = projCoords.z;
+    float bias = max(0.001 * (1.0 - dot(normal, lightDir)), 0.005);
+    float shadow = 0.0;
+    vec2 texelSize = 1.0 / textureSize(shadowMap, 0);
+    for(int x = -1; x <= 1; ++x)
+        for(int y = -1; y <= 1; ++y)
+        {
+            float pcfDepth = texture(shadowMap, projCoords.xy + vec2(x, y) * texelSize).r;
+            shadow += currentDepth - bias > pcfDepth ? 1.0 : 0.0;
+        }
+    shadow /= 9.0;
+    if(projCoords.z > 1.0)
+        shadow = 0.0;
+    return shadow;
+}
+
+void main()
+{
+    vec4 albedo = texture(colorAtlas, AtlasCoords);
+    if (albedo.a < 0.5 || dither() < MeshFade)
+        discard;
+    vec4 normalDepth = texture(normalAtlas, AtlasCoords);
+    vec3 normal = normalize(normalDepth.xyz * 2.0 - 1.0);
+    // back to where the mesh surface was
+    vec3 fragPos = QuadPos + ViewDir * radius * (1.0 - 2.0 * normalDepth.w);
+    vec4 clip = projection * view * vec4(fragPos, 1.0);
+    gl_FragDepth = clip.z / clip.w * 0.5 + 0.5;
+
+    // the directional part of main.fs
+    vec3 color = matToggle ? albedo.rgb : vec3(0.7);
+    vec3 lightColor = vec3(0.1);
+    vec3 ambient = 0.025 * lightColor;
+    if (dayToggle) {
+        ambient = 0.4 * lightColor;
+        lightColor = vec3(0.8);
+    }
+    vec3 lightDir = normalize(lightPos - fragPos);
+    vec3 diffuse = max(dot(lightDir, normal), 0.0) * lightColor;
+    vec3 viewDir = normalize(viewPos - fragPos);
+    vec3 halfwayDir = normalize(lightDir + viewDir);
+    vec3 specular = pow(max(dot(normal, halfwayDir), 0.0), 64.0) * lightColor;
+    float shadow = ShadowCalculation(lightSpaceMatrix * vec4(fragPos, 1.0), normal, lightDir);
+    vec3 lighting = 0.33 * (ambient + diffuse) * color;
+    if (sToggle)
+        lighting = (ambient + (1.0 - shadow) * (diffuse + specular)) * color;
+    FragColor = vec4(lighting, 1.0);
+}
@@ -0,0 +1,40 @@
+#version 330 core
+// Camera facing impostor quads, one instance per tree. See impostor.h.
+layout (location = 0) in vec2 aCorner;   // -1..1
+layout (location = 1) in vec4 aInstance; // world space centre, mesh fade
+
+out vec2 AtlasCoords;
+out vec3 QuadPos;
+flat out vec3 ViewDir;
+flat out float MeshFade;
+
+uniform mat4 projection;
+uniform mat4 view;
+uniform vec3 viewPos;
+uniform float radius;
+uniform int grid;
+
+void main()
+{
+    vec3 centre = aInstance.xyz;
+    // hemi-octahedral cell of the direction towards the camera
+    vec3 d = viewPos - centre;
+    d.y = max(d.y, 0.0);
+    d /= abs(d.x) + abs(d.y) + abs(d.z) + 1e-6;
+    vec2 e = vec2(d.x + d.z, d.x - d.z);
+    vec2 cell = clamp(floor((e * 0.5 + 0.5) * grid), 0.0, grid - 1.0);
+    // and the direction that cell was baked from
+    vec2 c = (cell + 0.5) / grid * 2.0 - 1.0;
+    vec3 dir = vec3((c.x + c.y) * 0.5, 0.0, (c.x - c.y) * 0.5);
+    dir.y = 1.0 - abs(dir.x) - abs(dir.z);
+    dir = normalize(dir);
+    // same basis as the lookAt of the bake
+    vec3 right = normalize(cross(vec3(0.0, 1.0, 0.0), dir));
+    vec3 up = cross(dir, right);
+
+    QuadPos = centre + (aCorner.x * right + aCorner.y * up) * radius;
+    AtlasCoords = (cell + aCorner * 0.5 + 0.5) / grid;
+    ViewDir = dir;
+    MeshFade = aInstance.w;
+    gl_Position = projection * view * vec4(QuadPos, 1.0);
+}
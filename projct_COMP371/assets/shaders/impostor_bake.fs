@@ -0,0 +1,16 @@
+#version 330 core
+// One view of an impostor atlas, see impostor.h.
+layout (location = 0) out vec4 Color;
+layout (location = 1) out vec4 NormalDepth;
+
+in vec3 Normal;
+in vec2 TexCoords;
+
+uniform sampler2D texture_diffuse1;
+
+void main()
+{
+    Color = vec4(texture(texture_diffuse1, TexCoords).rgb, 1.0);
+    // the projection is orthographic, so window depth is linear in distance
+    NormalDepth = vec4(normalize(Normal) * 0.5 + 0.5, gl_FragCoord.z);
+}
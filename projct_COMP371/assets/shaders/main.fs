@@ -6,6 +6,8 @@ in VS_OUT {
     vec3 Normal;
     vec2 TexCoords;
     vec4 FragPosLightSpace;
+    float Fade;
+    flat int Layer;
 } fs_in;
 
 struct Material {
@@ -30,11 +32,14 @@ struct SpotLight {
     vec3 specular;
 };
 
-vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
+vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 albedo);
 uniform SpotLight spotLight;
 
 uniform sampler2D diffuseTexture;
 uniform sampler2D shadowMap;
+// Batched vegetation: maps of all species, the layer comes per instance.
+uniform bool instanced = false;
+uniform sampler2DArray diffuseArray;
 
 uniform vec3 lightPos;
 uniform vec3 viewPos;
@@ -44,6 +49,20 @@ uniform bool lToggle = true;
 uniform bool dayToggle = true;
 uniform bool matToggle = true;
 
+// Below 1 while a tree crossfades into its impostor: only the pixels of an
+// ordered dither under fade are kept, the impostor draws the rest. Batched
+// instances carry their own.
+uniform float fade = 1.0;
+
+float dither()
+{
+    int x = int(gl_FragCoord.x) & 3;
+    int y = int(gl_FragCoord.y) & 3;
+    const float bayer[16] = float[16](0.0, 8.0, 2.0, 10.0, 12.0, 4.0, 14.0, 6.0,
+                                      3.0, 11.0, 1.0, 9.0, 15.0, 7.0, 13.0, 5.0);
+    return (bayer[y * 4 + x] + 0.5) / 16.0;
+}
+
 float ShadowCalculation(vec4 fragPosLightSpace)
 {
     // perform perspective divide
@@ -82,7 +101,12 @@ float ShadowCalculation(vec4 fragPosLightSpace)
 
 void main()
 {
-    vec3 color = texture(diffuseTexture, fs_in.TexCoords).rgb;
+    float keep = instanced ? fs_in.Fade : fade;
+    if (keep < 1.0 && dither() >= keep)
+        discard;
+    vec3 albedo = instanced ? texture(diffuseArray, vec3(fs_in.TexCoords, fs_in.Layer)).rgb
+                            : texture(diffuseTexture, fs_in.TexCoords).rgb;
+    vec3 color = albedo;
     if (!matToggle)
         color = vec3(0.7);
     vec3 normal = normalize(fs_in.Normal);
@@ -107,7 +131,7 @@ void main()
     vec3 specular = spec * lightColor;
     // calculate shadow
     float shadow = ShadowCalculation(fs_in.FragPosLightSpace);
-    vec3 spot1 = CalcSpotLight(spotLight, normal, fs_in.FragPos, viewDir);
+    vec3 spot1 = CalcSpotLight(spotLight, normal, fs_in.FragPos, viewDir, albedo);
     vec3 lighting;
     lighting = 0.33*(ambient + diffuse) * color;
     if (sToggle)
@@ -118,7 +142,7 @@ void main()
     FragColor = vec4(lighting, 1.0);
 }
 
-vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
+vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 albedo)
 {
     vec3 lightDir = normalize(light.position - fragPos);
     // diffuse shading
@@ -134,8 +158,8 @@ vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
     float epsilon = light.cutOff - light.outerCutOff;
     float intensity = clamp((theta - light.outerCutOff) / epsilon, 0.0, 1.0);
     // combine results
-    vec3 ambient = light.ambient * vec3(texture(material.diffuse, fs_in.TexCoords));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.diffuse, fs_in.TexCoords));
+    vec3 ambient = light.ambient * albedo;
+    vec3 diffuse = light.diffuse * diff * albedo;
     vec3 specular = light.specular * spec * vec3(texture(material.specular, fs_in.TexCoords));
     ambient *= attenuation * intensity;
     diffuse *= attenuation * intensity;
@@ -2,6 +2,11 @@
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
+// Batched vegetation (see batch.h), one per instance: world position and yaw,
+// crossfade, layer of the diffuse array.
+layout (location = 3) in vec4 aPlacement;
+layout (location = 4) in float aFade;
+layout (location = 5) in int aLayer;
 
 out vec2 TexCoords;
 
@@ -10,18 +15,56 @@ out VS_OUT {
     vec3 Normal;
     vec2 TexCoords;
     vec4 FragPosLightSpace;
+    float Fade;
+    flat int Layer;
 } vs_out;
 
 uniform mat4 projection;
 uniform mat4 view;
 uniform mat4 model;
 uniform mat4 lightSpaceMatrix;
+uniform bool instanced = false;
+
+// Compact terrain: no attributes, one 16 bit height per vertex (plus a one
+// cell apron) in a texture buffer. terrainScale maps [0,1] back to world height.
+uniform bool compactTerrain = false;
+uniform samplerBuffer terrainHeights;
+uniform int terrainBase;
+uniform int terrainWidth;
+uniform vec2 terrainScale;
+
+// Translation by the instance position times a turn of yaw around y.
+mat4 instanceModel()
+{
+    float c = cos(aPlacement.w), s = sin(aPlacement.w);
+    return mat4(vec4(c, 0.0, -s, 0.0), vec4(0.0, 1.0, 0.0, 0.0), vec4(s, 0.0, c, 0.0), vec4(aPlacement.xyz, 1.0));
+}
+
+float terrainHeight(int x, int z)
+{
+    float h = texelFetch(terrainHeights, terrainBase + (z + 1) * (terrainWidth + 2) + x + 1).r;
+    return terrainScale.x + terrainScale.y * h;
+}
 
 void main()
 {
-    vs_out.FragPos = vec3(model * vec4(aPos, 1.0));
-    vs_out.Normal = transpose(inverse(mat3(model))) * aNormal;
-    vs_out.TexCoords = aTexCoords;
+    vec3 pos = aPos;
+    vec3 normal = aNormal;
+    vec2 uv = aTexCoords;
+    if (compactTerrain) {
+        int x = gl_VertexID % terrainWidth;
+        int z = gl_VertexID / terrainWidth;
+        pos = vec3(x, terrainHeight(x, z), z);
+        normal = normalize(vec3(terrainHeight(x - 1, z) - terrainHeight(x + 1, z), 2.0,
+                                terrainHeight(x, z - 1) - terrainHeight(x, z + 1)));
+        uv = vec2(z % 2, x % 2);
+    }
+    mat4 world = instanced ? instanceModel() : model;
+    vs_out.FragPos = vec3(world * vec4(pos, 1.0));
+    vs_out.Normal = transpose(inverse(mat3(world))) * normal;
+    vs_out.TexCoords = uv;
     vs_out.FragPosLightSpace = lightSpaceMatrix * vec4(vs_out.FragPos, 1.0);
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
+    vs_out.Fade = instanced ? aFade : 1.0;
+    vs_out.Layer = instanced ? aLayer : 0;
+    gl_Position = projection * view * world * vec4(pos, 1.0);
 }
@@ -1,10 +1,32 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;
+// Batched vegetation, see main.vs.
+layout (location = 3) in vec4 aPlacement;
 
 uniform mat4 lightSpaceMatrix;
 uniform mat4 model;
+uniform bool instanced = false;
+
+// Compact terrain, see main.vs.
+uniform bool compactTerrain = false;
+uniform samplerBuffer terrainHeights;
+uniform int terrainBase;
+uniform int terrainWidth;
+uniform vec2 terrainScale;
 
 void main()
 {
-    gl_Position = lightSpaceMatrix * model * vec4(aPos, 1.0);
+    vec3 pos = aPos;
+    if (compactTerrain) {
+        int x = gl_VertexID % terrainWidth;
+        int z = gl_VertexID / terrainWidth;
+        float h = texelFetch(terrainHeights, terrainBase + (z + 1) * (terrainWidth + 2) + x + 1).r;
+        pos = vec3(x, terrainScale.x + terrainScale.y * h, z);
+    }
+    mat4 world = model;
+    if (instanced) {
+        float c = cos(aPlacement.w), s = sin(aPlacement.w);
+        world = mat4(vec4(c, 0.0, -s, 0.0), vec4(0.0, 1.0, 0.0, 0.0), vec4(s, 0.0, c, 0.0), vec4(aPlacement.xyz, 1.0));
+    }
+    gl_Position = lightSpaceMatrix * world * vec4(pos, 1.0);
 }
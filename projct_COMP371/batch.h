@@ -0,0 +1,360 @@
+// All vegetation in one draw call per pass.
+//
+// Every mesh of every tree and small object model is copied, with all its
+// levels of detail, into one shared vertex and index buffer (position,
+// normal, uv: 32 bytes per vertex), and every diffuse map into one layer of
+// a GL_TEXTURE_2D_ARRAY. Chunks then only queue instances (world position,
+// yaw, crossfade) with add(); flush() groups them by model, mesh and LOD into
+// one indirect command each, puts the instances in an instance buffer in
+// the same order (baseInstance points each command at its run, and every
+// instance carries its texture layer), and draws it all with a single
+// glMultiDrawElementsIndirect.
+//
+// Needs GL 4.3 or ARB_multi_draw_indirect + ARB_base_instance. Without them,
+// or with --no-batch, chunks draw every instance with Model::Draw as before.
+
+#ifndef batch_h
+#define batch_h
+
+#include <GL/glew.h>
+
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "bcenc.h"
+#include "ctex.h"
+#include "lod.h"
+#include "Model.h"
+#include "shader.h"
+#include "threadpool.h"
+
+#define BATCH_ARRAY_UNIT 3 // texture unit of the diffuse array, main.fs's diffuseArray
+
+// Set to false (--no-batch) to draw vegetation model by model.
+bool bBatchVegetation = true;
+
+// What glMultiDrawElementsIndirect reads, one per draw.
+struct DrawElementsIndirectCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+// Per instance attributes, locations 3 to 5 of main.vs and shadowdepth.vs.
+struct BatchInstance {
+    glm::vec4 placement; // world position, yaw
+    float fade;          // see impostorMeshFade
+    GLint layer;         // in the diffuse array
+    float unused[2];     // pads to the std430 stride, see cull.cs
+};
+
+// Bilinear resize of an RGBA8 image.
+inline std::vector<unsigned char> resampleRGBA(const unsigned char* src, int w, int h, int nw, int nh) {
+    std::vector<unsigned char> dst(nw * nh * 4);
+    for (int y = 0; y < nh; ++y) {
+        float sy = std::max((y + 0.5f) * h / nh - 0.5f, 0.0f);
+        int y0 = std::min((int)sy, h - 1), y1 = std::min(y0 + 1, h - 1);
+        float fy = sy - y0;
+        for (int x = 0; x < nw; ++x) {
+            float sx = std::max((x + 0.5f) * w / nw - 0.5f, 0.0f);
+            int x0 = std::min((int)sx, w - 1), x1 = std::min(x0 + 1, w - 1);
+            float fx = sx - x0;
+            for (int c = 0; c < 4; ++c) {
+                float top = src[(y0*w + x0)*4 + c] * (1 - fx) + src[(y0*w + x1)*4 + c] * fx;
+                float bottom = src[(y1*w + x0)*4 + c] * (1 - fx) + src[(y1*w + x1)*4 + c] * fx;
+                dst[(y*nw + x)*4 + c] = (unsigned char)(top * (1 - fy) + bottom * fy + 0.5f);
+            }
+        }
+    }
+    return dst;
+}
+
+class VegetationBatch {
+public:
+    // One mesh of a model in the shared buffers.
+    struct Part {
+        GLuint firstIndex = 0;
+        GLint baseVertex = 0;
+        GLint layer = 0;
+        std::vector<unsigned int> lodStart;
+        std::vector<unsigned int> lodCount;
+    };
+
+    // True once build() succeeded and batching is on.
+    bool enabled() const {
+        return built && bBatchVegetation;
+    }
+
+    static bool supported() {
+        return GLEW_VERSION_4_3 || (GLEW_ARB_multi_draw_indirect && GLEW_ARB_base_instance);
+    }
+
+    // Pack the meshes of models (uploaded already) and their diffuse maps.
+    // Model i is what add() calls model i.
+    bool build(const std::vector<Model*> &models) {
+        if (!supported()) {
+            std::cout << "batch: no multi draw indirect, drawing vegetation per model" << std::endl;
+            return false;
+        }
+        std::vector<float> vertices;
+        std::vector<unsigned int> indices;
+        std::vector<std::string> layerPaths;
+        std::unordered_map<std::string, int> layerOf;
+        parts.assign(models.size(), std::vector<Part>());
+        for (unsigned int m = 0; m < models.size(); ++m)
+            for (unsigned int k = 0; k < models[m]->meshes.size(); ++k) {
+                const Mesh &mesh = models[m]->meshes[k];
+                Part part;
+                part.baseVertex = vertices.size() / 8;
+                part.firstIndex = indices.size();
+                part.lodStart = mesh.lodStart;
+                part.lodCount = mesh.lodCount;
+                if (part.lodCount.empty()) {
+                    part.lodStart.assign(1, 0);
+                    part.lodCount.assign(1, mesh.indices.size());
+                }
+                // the first diffuse map, or the blank layer (-1 for now)
+                part.layer = -1;
+                for (unsigned int t = 0; t < mesh.textures.size() && part.layer < 0; ++t) {
+                    if (mesh.textures[t].type != "texture_diffuse")
+                        continue;
+                    std::string path = models[m]->directory + '/' + mesh.textures[t].path;
+                    if (layerOf.find(path) == layerOf.end()) {
+                        layerOf[path] = layerPaths.size();
+                        layerPaths.push_back(path);
+                    }
+                    part.layer = layerOf[path];
+                }
+                for (unsigned int v = 0; v < mesh.vertices.size(); ++v) {
+                    const Vertex &vertex = mesh.vertices[v];
+                    float packed[8] = { vertex.Position.x, vertex.Position.y, vertex.Position.z,
+                                        vertex.Normal.x, vertex.Normal.y, vertex.Normal.z,
+                                        vertex.TexCoords.x, vertex.TexCoords.y };
+                    vertices.insert(vertices.end(), packed, packed + 8);
+                }
+                indices.insert(indices.end(), mesh.indices.begin(), mesh.indices.end());
+                parts[m].push_back(part);
+            }
+        if (indices.empty())
+            return false;
+        // parts without a map sample the last layer
+        for (unsigned int m = 0; m < parts.size(); ++m)
+            for (unsigned int k = 0; k < parts[m].size(); ++k)
+                if (parts[m][k].layer < 0)
+                    parts[m][k].layer = layerPaths.size();
+        buildTextureArray(layerPaths);
+
+        glGenVertexArrays(1, &VAO);
+        glGenBuffers(1, &VBO);
+        glGenBuffers(1, &EBO);
+        glGenBuffers(1, &instanceVBO);
+        glGenBuffers(1, &indirectBuffer);
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), &vertices[0], GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+        unsigned int stride = 8 * sizeof(float);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (void*)(3 * sizeof(float)));
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride, (void*)(6 * sizeof(float)));
+        glEnableVertexAttribArray(3);
+        glVertexAttribDivisor(3, 1);
+        glEnableVertexAttribArray(4);
+        glVertexAttribDivisor(4, 1);
+        glEnableVertexAttribArray(5);
+        glVertexAttribDivisor(5, 1);
+        pointInstances(instanceVBO);
+
+        queued.assign(models.size(), std::vector<std::vector<BatchInstance> >(MAX_LODS));
+        built = true;
+        std::cout << "batch: " << models.size() << " models, " << vertices.size() / 8 << " vertices, "
+                  << indices.size() / 3 << " triangles (all LODs), " << layerPaths.size() + 1 << " layers" << std::endl;
+        return true;
+    }
+
+    // Queue an instance of model at lod. Drawn by the next flush().
+    void add(unsigned int model, unsigned int lod, glm::vec3 position, float yaw, float fade) {
+        BatchInstance instance;
+        instance.placement = glm::vec4(position, yaw);
+        instance.fade = fade;
+        instance.layer = 0;
+        queued[model][std::min(lod, (unsigned int)MAX_LODS - 1)].push_back(instance);
+    }
+
+    // Draw everything queued with the shader's camera uniforms, then clear.
+    // Returns the number of indirect commands.
+    int flush(Shader &shader) {
+        commands.clear();
+        instances.clear();
+        for (unsigned int m = 0; m < queued.size(); ++m)
+            for (unsigned int l = 0; l < queued[m].size(); ++l) {
+                std::vector<BatchInstance> &run = queued[m][l];
+                if (run.empty())
+                    continue;
+                for (unsigned int k = 0; k < parts[m].size(); ++k) {
+                    const Part &part = parts[m][k];
+                    unsigned int level = std::min(l, (unsigned int)part.lodCount.size() - 1);
+                    DrawElementsIndirectCommand command;
+                    command.count = part.lodCount[level];
+                    command.instanceCount = run.size();
+                    command.firstIndex = part.firstIndex + part.lodStart[level];
+                    command.baseVertex = part.baseVertex;
+                    command.baseInstance = instances.size();
+                    commands.push_back(command);
+                    for (unsigned int i = 0; i < run.size(); ++i) {
+                        instances.push_back(run[i]);
+                        instances.back().layer = part.layer;
+                    }
+                }
+                run.clear();
+            }
+        if (commands.empty())
+            return 0;
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        counted::bufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(BatchInstance), &instances[0], GL_STREAM_DRAW);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+        counted::bufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(DrawElementsIndirectCommand), &commands[0], GL_STREAM_DRAW);
+        draw(shader, indirectBuffer, commands.size());
+        for (unsigned int c = 0; c < commands.size(); ++c)
+            RENDER_COUNT(triangles, (uint64_t)commands[c].count / 3 * commands[c].instanceCount);
+        RENDER_COUNT(instances, instances.size());
+        return commands.size();
+    }
+
+    // Draw count commands of commandBuffer with the instances in
+    // instanceBuffer, both filled in elsewhere (see gpucull.h).
+    void drawIndirect(Shader &shader, unsigned int instanceBuffer, unsigned int commandBuffer, int count) {
+        pointInstances(instanceBuffer);
+        draw(shader, commandBuffer, count);
+        pointInstances(instanceVBO);
+    }
+
+    const std::vector<std::vector<Part> >& layout() const {
+        return parts;
+    }
+
+private:
+    bool built = false;
+    std::vector<std::vector<Part> > parts;
+    // model -> lod -> instances
+    std::vector<std::vector<std::vector<BatchInstance> > > queued;
+    std::vector<DrawElementsIndirectCommand> commands;
+    std::vector<BatchInstance> instances;
+    unsigned int VAO = 0, VBO = 0, EBO = 0, instanceVBO = 0, indirectBuffer = 0;
+    unsigned int textureArray = 0;
+
+    // Source the instance attributes from buffer.
+    void pointInstances(unsigned int buffer) {
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(BatchInstance), (void*)offsetof(BatchInstance, placement));
+        glVertexAttribPointer(4, 1, GL_FLOAT, GL_FALSE, sizeof(BatchInstance), (void*)offsetof(BatchInstance, fade));
+        glVertexAttribIPointer(5, 1, GL_INT, sizeof(BatchInstance), (void*)offsetof(BatchInstance, layer));
+        glBindVertexArray(0);
+    }
+
+    void draw(Shader &shader, unsigned int commandBuffer, int count) {
+        shader.setBool("instanced", true);
+        glActiveTexture(GL_TEXTURE0 + BATCH_ARRAY_UNIT);
+        counted::bindTexture(GL_TEXTURE_2D_ARRAY, textureArray);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+        counted::bindVertexArray(VAO);
+        counted::multiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)0, (GLsizei)count);
+        glBindVertexArray(0);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        glActiveTexture(GL_TEXTURE0);
+        shader.setBool("instanced", false);
+    }
+
+    // One layer per map plus a grey one for meshes without. If every map is
+    // baked compressed with the same format and size, the levels go straight
+    // from the mappings into the array; otherwise the maps are decoded,
+    // resized to the largest and mipmapped by the driver.
+    void buildTextureArray(const std::vector<std::string> &paths) {
+        std::vector<CtexImage*> baked(paths.size(), NULL);
+        bool direct = !paths.empty();
+        for (unsigned int p = 0; p < paths.size(); ++p) {
+            baked[p] = openBaked(paths[p]);
+            direct = direct && baked[p] && compressedFormat(baked[p]->header->format) &&
+                     baked[p]->header->format == baked[0]->header->format &&
+                     baked[p]->header->levels == baked[0]->header->levels &&
+                     baked[p]->header->level[0].width == baked[0]->header->level[0].width &&
+                     baked[p]->header->level[0].height == baked[0]->header->level[0].height;
+        }
+        int layers = paths.size() + 1;
+        glGenTextures(1, &textureArray);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, textureArray);
+        if (direct) {
+            const CtexHeader* header = baked[0]->header;
+            GLenum format = compressedFormat(header->format);
+            for (unsigned int l = 0; l < header->levels; ++l) {
+                int w = header->level[l].width, h = header->level[l].height;
+                glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, l, format, w, h, layers, 0, header->level[l].size * layers, NULL);
+                for (unsigned int p = 0; p < paths.size(); ++p)
+                    glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, l, 0, 0, p, w, h, 1, format,
+                                              baked[p]->header->level[l].size, baked[p]->levelData(l));
+                std::vector<unsigned char> grey(w * h * 4, 160);
+                std::vector<unsigned char> blank = bcEncodeImage(&grey[0], w, h, ctexBcFormat(header->format));
+                glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, l, 0, 0, paths.size(), w, h, 1, format,
+                                          blank.size(), &blank[0]);
+            }
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, header->levels - 1);
+        } else {
+            // decode in parallel, upload here
+            std::vector<std::vector<unsigned char> > pixels(paths.size());
+            std::vector<int> widths(paths.size(), 0), heights(paths.size(), 0);
+            threadPool().parallelFor(paths.size(), [&](int p) {
+                if (baked[p]) {
+                    const CtexHeader* header = baked[p]->header;
+                    widths[p] = header->level[0].width;
+                    heights[p] = header->level[0].height;
+                    if (header->format == CTEX_RGBA8)
+                        pixels[p].assign(baked[p]->levelData(0), baked[p]->levelData(0) + header->level[0].size);
+                    else
+                        pixels[p] = bcDecodeImage(baked[p]->levelData(0), widths[p], heights[p], ctexBcFormat(header->format));
+                    return;
+                }
+                unsigned char* data = stbi_load(paths[p].c_str(), &widths[p], &heights[p], NULL, 4);
+                if (data)
+                    pixels[p].assign(data, data + widths[p] * heights[p] * 4);
+                else
+                    std::cout << "Texture failed to load at path: " << paths[p] << std::endl;
+                stbi_image_free(data);
+            });
+            int w = 4, h = 4;
+            for (unsigned int p = 0; p < paths.size(); ++p) {
+                w = std::max(w, widths[p]);
+                h = std::max(h, heights[p]);
+            }
+            glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, w, h, layers, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+            for (unsigned int p = 0; p < paths.size(); ++p) {
+                if (pixels[p].empty())
+                    pixels[p].assign(w * h * 4, 160);
+                else if (widths[p] != w || heights[p] != h)
+                    pixels[p] = resampleRGBA(&pixels[p][0], widths[p], heights[p], w, h);
+                glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, p, w, h, 1, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[p][0]);
+            }
+            std::vector<unsigned char> grey(w * h * 4, 160);
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, paths.size(), w, h, 1, GL_RGBA, GL_UNSIGNED_BYTE, &grey[0]);
+            glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+        }
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        for (unsigned int p = 0; p < baked.size(); ++p)
+            delete baked[p];
+    }
+};
+
+#endif
@@ -0,0 +1,574 @@
+// Block compression (BC1, BC3, BC7) for baked textures.
+//
+// Every format works on 4x4 blocks. The encoder fits a line through the
+// block's colours (principal axis), snaps the two endpoints to the format,
+// picks the nearest palette entry for each pixel, then refits the endpoints
+// by least squares against those picks and keeps whichever is better.
+// The nearest-palette search is the hot loop and does 4 pixels at a time with
+// SSE or NEON. Block rows are spread over the thread pool.
+//
+//   BC1: RGB 5:6:5 endpoints, 2 bit indices. 8 bytes/block, opaque only here.
+//   BC3: BC1 colour + BC4 alpha (8 bit endpoints, 3 bit indices). 16 bytes/block.
+//   BC7: mode 6 only, RGBA 7+1 bit endpoints, 4 bit indices. 16 bytes/block.
+//        One subset is not what a full BC7 encoder would reach, but it is fast
+//        and already well above BC1 on these textures.
+//
+// The decoders are used for the PSNR check and when the driver can't sample
+// a format, in which case the texture is uploaded as RGBA8 instead.
+
+#ifndef bcenc_h
+#define bcenc_h
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "threadpool.h"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define BCENC_SSE 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define BCENC_NEON 1
+#endif
+
+enum BcFormat {
+    BC_1,
+    BC_3,
+    BC_7
+};
+
+inline int bcBlockBytes(BcFormat format) {
+    return format == BC_1 ? 8 : 16;
+}
+
+inline size_t bcImageBytes(int w, int h, BcFormat format) {
+    return (size_t)((w + 3) / 4) * ((h + 3) / 4) * bcBlockBytes(format);
+}
+
+// One block, one array per channel so 4 pixels fit a register.
+struct BcBlock {
+    float c[4][16];
+};
+
+// Load the block at (bx, by) of an RGBA8 image. Pixels past the edge repeat
+// the last row/column.
+inline void bcLoadBlock(const unsigned char* rgba, int w, int h, int bx, int by, BcBlock &block) {
+    for (int y = 0; y < 4; ++y)
+        for (int x = 0; x < 4; ++x) {
+            int px = std::min(bx*4 + x, w - 1), py = std::min(by*4 + y, h - 1);
+            const unsigned char* p = rgba + (py*w + px)*4;
+            for (int ch = 0; ch < 4; ++ch)
+                block.c[ch][y*4 + x] = p[ch];
+        }
+}
+
+// For each pixel, the index of the closest palette entry under the channel
+// weights. Returns the summed squared error.
+inline float bcNearestScalar(const BcBlock &block, const float (*palette)[4], int count,
+                             const float* weight, unsigned char* indices) {
+    float total = 0.0f;
+    for (int i = 0; i < 16; ++i) {
+        float best = 1e30f;
+        int bestIndex = 0;
+        for (int p = 0; p < count; ++p) {
+            float d = 0.0f;
+            for (int ch = 0; ch < 4; ++ch) {
+                float diff = block.c[ch][i] - palette[p][ch];
+                d += weight[ch] * diff * diff;
+            }
+            if (d < best) {
+                best = d;
+                bestIndex = p;
+            }
+        }
+        indices[i] = (unsigned char)bestIndex;
+        total += best;
+    }
+    return total;
+}
+
+inline float bcNearest(const BcBlock &block, const float (*palette)[4], int count,
+                       const float* weight, unsigned char* indices) {
+#if BCENC_SSE
+    __m128 total = _mm_setzero_ps();
+    for (int i = 0; i < 16; i += 4) {
+        __m128 px[4];
+        for (int ch = 0; ch < 4; ++ch)
+            px[ch] = _mm_loadu_ps(block.c[ch] + i);
+        __m128 best = _mm_set1_ps(1e30f);
+        __m128 bestIndex = _mm_setzero_ps();
+        for (int p = 0; p < count; ++p) {
+            __m128 d = _mm_setzero_ps();
+            for (int ch = 0; ch < 4; ++ch) {
+                __m128 diff = _mm_sub_ps(px[ch], _mm_set1_ps(palette[p][ch]));
+                d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(weight[ch]), _mm_mul_ps(diff, diff)));
+            }
+            __m128 closer = _mm_cmplt_ps(d, best);
+            best = _mm_min_ps(d, best);
+            bestIndex = _mm_or_ps(_mm_and_ps(closer, _mm_set1_ps((float)p)), _mm_andnot_ps(closer, bestIndex));
+        }
+        float idx[4];
+        _mm_storeu_ps(idx, bestIndex);
+        for (int k = 0; k < 4; ++k)
+            indices[i + k] = (unsigned char)idx[k];
+        total = _mm_add_ps(total, best);
+    }
+    float sums[4];
+    _mm_storeu_ps(sums, total);
+    return sums[0] + sums[1] + sums[2] + sums[3];
+#elif BCENC_NEON
+    float32x4_t total = vdupq_n_f32(0.0f);
+    for (int i = 0; i < 16; i += 4) {
+        float32x4_t px[4];
+        for (int ch = 0; ch < 4; ++ch)
+            px[ch] = vld1q_f32(block.c[ch] + i);
+        float32x4_t best = vdupq_n_f32(1e30f);
+        uint32x4_t bestIndex = vdupq_n_u32(0);
+        for (int p = 0; p < count; ++p) {
+            float32x4_t d = vdupq_n_f32(0.0f);
+            for (int ch = 0; ch < 4; ++ch) {
+                float32x4_t diff = vsubq_f32(px[ch], vdupq_n_f32(palette[p][ch]));
+                d = vmlaq_f32(d, vdupq_n_f32(weight[ch]), vmulq_f32(diff, diff));
+            }
+            uint32x4_t closer = vcltq_f32(d, best);
+            best = vminq_f32(d, best);
+            bestIndex = vbslq_u32(closer, vdupq_n_u32(p), bestIndex);
+        }
+        uint32_t idx[4];
+        vst1q_u32(idx, bestIndex);
+        for (int k = 0; k < 4; ++k)
+            indices[i + k] = (unsigned char)idx[k];
+        total = vaddq_f32(total, best);
+    }
+    float sums[4];
+    vst1q_f32(sums, total);
+    return sums[0] + sums[1] + sums[2] + sums[3];
+#else
+    return bcNearestScalar(block, palette, count, weight, indices);
+#endif
+}
+
+inline float bcNearest(const BcBlock &block, const float (*palette)[4], int count,
+                       const float* weight, unsigned char* indices, bool simd) {
+    return simd ? bcNearest(block, palette, count, weight, indices)
+                : bcNearestScalar(block, palette, count, weight, indices);
+}
+
+// Mean and dominant direction of the block's first `channels` channels,
+// by power iteration on the covariance matrix.
+inline void bcPrincipalAxis(const BcBlock &block, int channels, float* mean, float* axis) {
+    for (int ch = 0; ch < 4; ++ch) {
+        mean[ch] = 0.0f;
+        for (int i = 0; i < 16; ++i)
+            mean[ch] += block.c[ch][i];
+        mean[ch] /= 16.0f;
+    }
+    float cov[4][4] = {};
+    for (int i = 0; i < 16; ++i)
+        for (int a = 0; a < channels; ++a)
+            for (int b = a; b < channels; ++b)
+                cov[a][b] += (block.c[a][i] - mean[a]) * (block.c[b][i] - mean[b]);
+    for (int a = 0; a < channels; ++a)
+        for (int b = 0; b < a; ++b)
+            cov[a][b] = cov[b][a];
+
+    for (int ch = 0; ch < 4; ++ch)
+        axis[ch] = ch < channels ? 1.0f : 0.0f;
+    for (int iter = 0; iter < 8; ++iter) {
+        float next[4] = {};
+        float len = 0.0f;
+        for (int a = 0; a < channels; ++a) {
+            for (int b = 0; b < channels; ++b)
+                next[a] += cov[a][b] * axis[b];
+            len += next[a] * next[a];
+        }
+        if (len < 1e-12f)
+            break;
+        len = 1.0f / std::sqrt(len);
+        for (int a = 0; a < channels; ++a)
+            axis[a] = next[a] * len;
+    }
+}
+
+// Endpoints at the extreme projections of the block onto its axis.
+inline void bcAxisEndpoints(const BcBlock &block, int channels, float* e0, float* e1) {
+    float mean[4], axis[4];
+    bcPrincipalAxis(block, channels, mean, axis);
+    float tMin = 1e30f, tMax = -1e30f;
+    for (int i = 0; i < 16; ++i) {
+        float t = 0.0f;
+        for (int ch = 0; ch < channels; ++ch)
+            t += (block.c[ch][i] - mean[ch]) * axis[ch];
+        tMin = std::min(tMin, t);
+        tMax = std::max(tMax, t);
+    }
+    for (int ch = 0; ch < 4; ++ch) {
+        e0[ch] = std::min(std::max(mean[ch] + tMin * axis[ch], 0.0f), 255.0f);
+        e1[ch] = std::min(std::max(mean[ch] + tMax * axis[ch], 0.0f), 255.0f);
+    }
+}
+
+// Endpoints minimising the squared error for fixed interpolation weights t.
+// False if the weights don't pin them down (all pixels on one end).
+inline bool bcLeastSquares(const BcBlock &block, const float* t, float* e0, float* e1) {
+    float aa = 0.0f, bb = 0.0f, ab = 0.0f;
+    float ax[4] = {}, bx[4] = {};
+    for (int i = 0; i < 16; ++i) {
+        float a = 1.0f - t[i], b = t[i];
+        aa += a * a;
+        bb += b * b;
+        ab += a * b;
+        for (int ch = 0; ch < 4; ++ch) {
+            ax[ch] += a * block.c[ch][i];
+            bx[ch] += b * block.c[ch][i];
+        }
+    }
+    float det = aa * bb - ab * ab;
+    if (std::fabs(det) < 1e-6f)
+        return false;
+    float inv = 1.0f / det;
+    for (int ch = 0; ch < 4; ++ch) {
+        e0[ch] = std::min(std::max((ax[ch] * bb - bx[ch] * ab) * inv, 0.0f), 255.0f);
+        e1[ch] = std::min(std::max((bx[ch] * aa - ax[ch] * ab) * inv, 0.0f), 255.0f);
+    }
+    return true;
+}
+
+inline uint16_t bcPack565(const float* c) {
+    int r = (int)(c[0] * 31.0f / 255.0f + 0.5f);
+    int g = (int)(c[1] * 63.0f / 255.0f + 0.5f);
+    int b = (int)(c[2] * 31.0f / 255.0f + 0.5f);
+    return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+inline void bcUnpack565(uint16_t v, int* c) {
+    int r = (v >> 11) & 31, g = (v >> 5) & 63, b = v & 31;
+    c[0] = (r << 3) | (r >> 2);
+    c[1] = (g << 2) | (g >> 4);
+    c[2] = (b << 3) | (b >> 2);
+}
+
+inline void bcWrite16(unsigned char* out, uint16_t v) {
+    out[0] = v & 0xff;
+    out[1] = v >> 8;
+}
+
+// BC1 colour block. The endpoints are always ordered c0 >= c1 with four
+// colour mode in mind, so the same block also serves as BC3's colour half.
+inline void bcEncodeBC1Block(const BcBlock &block, unsigned char* out, bool simd) {
+    static const float weight[4] = { 1.0f, 1.0f, 1.0f, 0.0f };
+    static const float t[4] = { 0.0f, 1.0f, 1.0f/3.0f, 2.0f/3.0f };
+    float e0[4], e1[4];
+    bcAxisEndpoints(block, 3, e0, e1);
+
+    float bestErr = 1e30f;
+    uint16_t best0 = 0, best1 = 0;
+    unsigned char bestIdx[16] = {};
+    for (int iter = 0; iter < 3; ++iter) {
+        uint16_t c0 = bcPack565(e1), c1 = bcPack565(e0);
+        if (c0 < c1)
+            std::swap(c0, c1);
+        int p0[3], p1[3];
+        bcUnpack565(c0, p0);
+        bcUnpack565(c1, p1);
+        float palette[4][4];
+        for (int ch = 0; ch < 3; ++ch) {
+            palette[0][ch] = (float)p0[ch];
+            palette[1][ch] = (float)p1[ch];
+            palette[2][ch] = (float)((2*p0[ch] + p1[ch]) / 3);
+            palette[3][ch] = (float)((p0[ch] + 2*p1[ch]) / 3);
+        }
+        for (int p = 0; p < 4; ++p)
+            palette[p][3] = 0.0f;
+        unsigned char idx[16];
+        float err = bcNearest(block, palette, c0 == c1 ? 1 : 4, weight, idx, simd);
+        if (err < bestErr) {
+            bestErr = err;
+            best0 = c0;
+            best1 = c1;
+            memcpy(bestIdx, idx, 16);
+        }
+        if (c0 == c1)
+            break;
+        float ti[16];
+        for (int i = 0; i < 16; ++i)
+            ti[i] = t[idx[i]];
+        if (!bcLeastSquares(block, ti, e1, e0))
+            break;
+    }
+
+    bcWrite16(out, best0);
+    bcWrite16(out + 2, best1);
+    uint32_t bits = 0;
+    for (int i = 0; i < 16; ++i)
+        bits |= (uint32_t)bestIdx[i] << (2*i);
+    for (int b = 0; b < 4; ++b)
+        out[4 + b] = (bits >> (8*b)) & 0xff;
+}
+
+// BC4 block of the alpha channel, eight value mode.
+inline void bcEncodeAlphaBlock(const BcBlock &block, unsigned char* out, bool simd) {
+    static const float weight[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+    float lo = 255.0f, hi = 0.0f;
+    for (int i = 0; i < 16; ++i) {
+        lo = std::min(lo, block.c[3][i]);
+        hi = std::max(hi, block.c[3][i]);
+    }
+    int a0 = (int)(hi + 0.5f), a1 = (int)(lo + 0.5f);
+    float palette[8][4] = {};
+    palette[0][3] = (float)a0;
+    palette[1][3] = (float)a1;
+    for (int p = 1; p < 7; ++p)
+        palette[p + 1][3] = (float)(((7 - p)*a0 + p*a1) / 7);
+    unsigned char idx[16];
+    bcNearest(block, palette, a0 == a1 ? 1 : 8, weight, idx, simd);
+
+    out[0] = (unsigned char)a0;
+    out[1] = (unsigned char)a1;
+    uint64_t bits = 0;
+    for (int i = 0; i < 16; ++i)
+        bits |= (uint64_t)idx[i] << (3*i);
+    for (int b = 0; b < 6; ++b)
+        out[2 + b] = (bits >> (8*b)) & 0xff;
+}
+
+static const int bc7Weights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+// Little endian bit stream over one 16 byte block.
+struct BcBits {
+    unsigned char* out;
+    int pos;
+
+    void put(uint32_t value, int count) {
+        for (int i = 0; i < count; ++i, ++pos)
+            if (value >> i & 1)
+                out[pos >> 3] |= 1 << (pos & 7);
+    }
+
+    uint32_t get(int count) {
+        uint32_t value = 0;
+        for (int i = 0; i < count; ++i, ++pos)
+            value |= (uint32_t)(out[pos >> 3] >> (pos & 7) & 1) << i;
+        return value;
+    }
+};
+
+// Snap an RGBA endpoint to 7 bits per channel plus a shared p-bit.
+inline void bc7Quantize(const float* e, int* q, int &p) {
+    float bestErr = 1e30f;
+    for (int pb = 0; pb < 2; ++pb) {
+        int cand[4];
+        float err = 0.0f;
+        for (int ch = 0; ch < 4; ++ch) {
+            cand[ch] = std::min(std::max((int)((e[ch] - pb) * 0.5f + 0.5f), 0), 127);
+            float d = e[ch] - ((cand[ch] << 1) | pb);
+            err += d * d;
+        }
+        if (err < bestErr) {
+            bestErr = err;
+            p = pb;
+            memcpy(q, cand, sizeof(cand));
+        }
+    }
+}
+
+// BC7 mode 6: one subset, RGBA endpoints, 4 bit indices.
+inline void bcEncodeBC7Block(const BcBlock &block, unsigned char* out, bool simd) {
+    static const float weight[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+    float e0[4], e1[4];
+    bcAxisEndpoints(block, 4, e0, e1);
+
+    float bestErr = 1e30f;
+    int bestQ0[4] = {}, bestQ1[4] = {}, bestP0 = 0, bestP1 = 0;
+    unsigned char bestIdx[16] = {};
+    for (int iter = 0; iter < 3; ++iter) {
+        int q0[4], q1[4], p0, p1;
+        bc7Quantize(e0, q0, p0);
+        bc7Quantize(e1, q1, p1);
+        float palette[16][4];
+        for (int ch = 0; ch < 4; ++ch) {
+            int a = (q0[ch] << 1) | p0, b = (q1[ch] << 1) | p1;
+            for (int k = 0; k < 16; ++k)
+                palette[k][ch] = (float)(((64 - bc7Weights4[k])*a + bc7Weights4[k]*b + 32) >> 6);
+        }
+        unsigned char idx[16];
+        float err = bcNearest(block, palette, 16, weight, idx, simd);
+        if (err < bestErr) {
+            bestErr = err;
+            memcpy(bestQ0, q0, sizeof(q0));
+            memcpy(bestQ1, q1, sizeof(q1));
+            bestP0 = p0;
+            bestP1 = p1;
+            memcpy(bestIdx, idx, 16);
+        }
+        float ti[16];
+        for (int i = 0; i < 16; ++i)
+            ti[i] = bc7Weights4[idx[i]] / 64.0f;
+        if (!bcLeastSquares(block, ti, e0, e1))
+            break;
+    }
+
+    // The first pixel's index is stored with its top bit implied zero.
+    if (bestIdx[0] & 8) {
+        std::swap(bestQ0, bestQ1);
+        std::swap(bestP0, bestP1);
+        for (int i = 0; i < 16; ++i)
+            bestIdx[i] = 15 - bestIdx[i];
+    }
+
+    memset(out, 0, 16);
+    BcBits bits = { out, 0 };
+    bits.put(1 << 6, 7);
+    for (int ch = 0; ch < 4; ++ch) {
+        bits.put(bestQ0[ch], 7);
+        bits.put(bestQ1[ch], 7);
+    }
+    bits.put(bestP0, 1);
+    bits.put(bestP1, 1);
+    bits.put(bestIdx[0], 3);
+    for (int i = 1; i < 16; ++i)
+        bits.put(bestIdx[i], 4);
+}
+
+// Compress a whole RGBA8 image. Block rows are split across the pool unless
+// threads is 1.
+inline std::vector<unsigned char> bcEncodeImage(const unsigned char* rgba, int w, int h, BcFormat format,
+                                                bool simd = true, unsigned threads = 0) {
+    int bw = (w + 3) / 4, bh = (h + 3) / 4;
+    int blockBytes = bcBlockBytes(format);
+    std::vector<unsigned char> out(bcImageBytes(w, h, format));
+    std::function<void(int)> row = [&](int by) {
+        BcBlock block;
+        for (int bx = 0; bx < bw; ++bx) {
+            bcLoadBlock(rgba, w, h, bx, by, block);
+            unsigned char* dst = &out[(by*bw + bx)*blockBytes];
+            if (format == BC_1)
+                bcEncodeBC1Block(block, dst, simd);
+            else if (format == BC_3) {
+                bcEncodeAlphaBlock(block, dst, simd);
+                bcEncodeBC1Block(block, dst + 8, simd);
+            }
+            else
+                bcEncodeBC7Block(block, dst, simd);
+        }
+    };
+    if (threads == 1)
+        for (int by = 0; by < bh; ++by)
+            row(by);
+    else
+        threadPool().parallelFor(bh, row, threads);
+    return out;
+}
+
+inline void bcDecodeColorBlock(const unsigned char* in, unsigned char* rgba, bool fourColor) {
+    uint16_t c0 = in[0] | in[1] << 8, c1 = in[2] | in[3] << 8;
+    int p[4][4];
+    bcUnpack565(c0, p[0]);
+    bcUnpack565(c1, p[1]);
+    p[0][3] = p[1][3] = p[2][3] = 255;
+    if (fourColor || c0 > c1) {
+        for (int ch = 0; ch < 3; ++ch) {
+            p[2][ch] = (2*p[0][ch] + p[1][ch]) / 3;
+            p[3][ch] = (p[0][ch] + 2*p[1][ch]) / 3;
+        }
+        p[3][3] = 255;
+    }
+    else {
+        for (int ch = 0; ch < 3; ++ch) {
+            p[2][ch] = (p[0][ch] + p[1][ch]) / 2;
+            p[3][ch] = 0;
+        }
+        p[3][3] = 0;
+    }
+    uint32_t bits = in[4] | in[5] << 8 | in[6] << 16 | (uint32_t)in[7] << 24;
+    for (int i = 0; i < 16; ++i)
+        for (int ch = 0; ch < 4; ++ch)
+            rgba[i*4 + ch] = (unsigned char)p[bits >> (2*i) & 3][ch];
+}
+
+inline void bcDecodeAlphaBlock(const unsigned char* in, unsigned char* rgba) {
+    int a[8];
+    a[0] = in[0];
+    a[1] = in[1];
+    if (a[0] > a[1])
+        for (int p = 1; p < 7; ++p)
+            a[p + 1] = ((7 - p)*a[0] + p*a[1]) / 7;
+    else {
+        for (int p = 1; p < 5; ++p)
+            a[p + 1] = ((5 - p)*a[0] + p*a[1]) / 5;
+        a[6] = 0;
+        a[7] = 255;
+    }
+    uint64_t bits = 0;
+    for (int b = 0; b < 6; ++b)
+        bits |= (uint64_t)in[2 + b] << (8*b);
+    for (int i = 0; i < 16; ++i)
+        rgba[i*4 + 3] = (unsigned char)a[bits >> (3*i) & 7];
+}
+
+// Mode 6 only, which is all the encoder writes. Other modes decode to black.
+inline void bcDecodeBC7Block(const unsigned char* in, unsigned char* rgba) {
+    BcBits bits = { (unsigned char*)in, 0 };
+    if (bits.get(7) != 1 << 6) {
+        memset(rgba, 0, 64);
+        return;
+    }
+    int q[2][4];
+    for (int ch = 0; ch < 4; ++ch) {
+        q[0][ch] = bits.get(7);
+        q[1][ch] = bits.get(7);
+    }
+    int p0 = bits.get(1), p1 = bits.get(1);
+    for (int ch = 0; ch < 4; ++ch) {
+        q[0][ch] = (q[0][ch] << 1) | p0;
+        q[1][ch] = (q[1][ch] << 1) | p1;
+    }
+    for (int i = 0; i < 16; ++i) {
+        int w = bc7Weights4[bits.get(i == 0 ? 3 : 4)];
+        for (int ch = 0; ch < 4; ++ch)
+            rgba[i*4 + ch] = (unsigned char)(((64 - w)*q[0][ch] + w*q[1][ch] + 32) >> 6);
+    }
+}
+
+// Back to RGBA8.
+inline std::vector<unsigned char> bcDecodeImage(const unsigned char* data, int w, int h, BcFormat format) {
+    int bw = (w + 3) / 4, bh = (h + 3) / 4;
+    int blockBytes = bcBlockBytes(format);
+    std::vector<unsigned char> rgba(w * h * 4);
+    unsigned char block[64];
+    for (int by = 0; by < bh; ++by)
+        for (int bx = 0; bx < bw; ++bx) {
+            const unsigned char* in = data + (by*bw + bx)*blockBytes;
+            if (format == BC_1)
+                bcDecodeColorBlock(in, block, false);
+            else if (format == BC_3) {
+                bcDecodeColorBlock(in + 8, block, true);
+                bcDecodeAlphaBlock(in, block);
+            }
+            else
+                bcDecodeBC7Block(in, block);
+            for (int y = 0; y < 4 && by*4 + y < h; ++y)
+                for (int x = 0; x < 4 && bx*4 + x < w; ++x)
+                    memcpy(&rgba[((by*4 + y)*w + bx*4 + x)*4], block + (y*4 + x)*4, 4);
+        }
+    return rgba;
+}
+
+// Peak signal to noise ratio in dB over RGB, plus alpha if asked.
+inline double bcPsnr(const unsigned char* a, const unsigned char* b, int pixels, bool alpha) {
+    int channels = alpha ? 4 : 3;
+    double sum = 0.0;
+    for (int i = 0; i < pixels; ++i)
+        for (int ch = 0; ch < channels; ++ch) {
+            double d = (double)a[i*4 + ch] - b[i*4 + ch];
+            sum += d * d;
+        }
+    double mse = sum / ((double)pixels * channels);
+    return mse > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / mse) : 99.0;
+}
+
+#endif
@@ -0,0 +1,530 @@
+// Headless benchmarks for the CPU side of world generation and culling.
+// Run with e.g. ./project --bench-normals. No window or GL context needed.
+
+#ifndef bench_h
+#define bench_h
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include <map>
+#include <string>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "OpenSimplexNoise.h"
+#include "camera.h"
+#include "camerapath.h"
+#include "chunk.h"
+#include "ctex.h"
+#include "log.h"
+#include "normals.h"
+#include "occlusion.h"
+#include "profiler.h"
+#include "renderdevice.h"
+#include "renderstats.h"
+#include "spatialhash.h"
+#include "threadpool.h"
+#include "world.h"
+
+// Seconds since an arbitrary point, for timing.
+inline double benchNow() {
+    using namespace std::chrono;
+    return duration_cast<duration<double> >(steady_clock::now().time_since_epoch()).count();
+}
+
+// Normals/sec of the central difference kernel: scalar, SIMD, and SIMD with
+// the rows split across the thread pool. The last one shows why a chunk's
+// normals are computed in one go rather than handed to the pool.
+inline void benchNormals() {
+    OpenSimplexNoise::Noise noise(1234);
+    int sizes[] = { 33, 65, 129 };
+    for (int s = 0; s < 3; ++s) {
+        int w = sizes[s], h = sizes[s];
+        std::vector<float> heights((w + 2)*(h + 2));
+        for (int z = 0; z < h + 2; ++z)
+            for (int x = 0; x < w + 2; ++x)
+                heights[z*(w + 2) + x] = 32.0f*noise.eval(0.0125*x, 0.0125*z);
+        std::vector<float> ref(3*w*h), out(3*w*h);
+        computeNormalsScalar(&heights[0], w, h, &ref[0], &ref[w*h], &ref[2*w*h], 0, h);
+
+        // Enough repetitions for ~50M normals per variant.
+        int reps = 50000000 / (w*h);
+        double t0 = benchNow();
+        for (int r = 0; r < reps; ++r)
+            computeNormalsScalar(&heights[0], w, h, &out[0], &out[w*h], &out[2*w*h], 0, h);
+        double t1 = benchNow();
+        for (int r = 0; r < reps; ++r)
+            computeNormals(&heights[0], w, h, &out[0], &out[w*h], &out[2*w*h], 0, h);
+        double t2 = benchNow();
+        int rowsPerTask = 8;
+        for (int r = 0; r < reps; ++r)
+            threadPool().parallelFor((h + rowsPerTask - 1) / rowsPerTask, [&](int task) {
+                int row0 = task * rowsPerTask;
+                int row1 = row0 + rowsPerTask < h ? row0 + rowsPerTask : h;
+                computeNormals(&heights[0], w, h, &out[0], &out[w*h], &out[2*w*h], row0, row1);
+            });
+        double t3 = benchNow();
+
+        float maxErr = 0.0f;
+        for (int i = 0; i < 3*w*h; ++i)
+            maxErr = std::max(maxErr, std::fabs(out[i] - ref[i]));
+
+        double n = 1.0*reps*w*h;
+        std::cout << "normals " << w << "x" << h
+                  << "  scalar: " << n/(t1 - t0)/1e6 << " M/s"
+                  << "  simd: " << n/(t2 - t1)/1e6 << " M/s"
+                  << "  simd+" << threadPool().size() + 1 << " threads: " << n/(t3 - t2)/1e6 << " M/s"
+                  << "  max error: " << maxErr << std::endl;
+    }
+}
+
+// Collision queries/sec of the spatial hash against a linear scan, over a
+// 5x5 chunk neighbourhood holding 1k to 10k objects. Fails if the hash and
+// the scan disagree on any query.
+inline bool benchCollision() {
+    bool pass = true;
+    int counts[] = { 1000, 2500, 5000, 10000 };
+    float extent = 5*64.0f;
+    uint32_t state = 12345;
+    for (int c = 0; c < 4; ++c) {
+        std::vector<glm::vec2> objs(counts[c]);
+        for (int i = 0; i < counts[c]; ++i) {
+            state = state * 1664525u + 1013904223u;
+            float x = (state >> 8) * (1.0f / 16777216.0f) * extent;
+            state = state * 1664525u + 1013904223u;
+            float y = (state >> 8) * (1.0f / 16777216.0f) * extent;
+            objs[i] = glm::vec2(x, y);
+        }
+        std::vector<glm::vec2> queries(100000);
+        for (int i = 0; i < queries.size(); ++i) {
+            state = state * 1664525u + 1013904223u;
+            float x = (state >> 8) * (1.0f / 16777216.0f) * extent;
+            state = state * 1664525u + 1013904223u;
+            float y = (state >> 8) * (1.0f / 16777216.0f) * extent;
+            queries[i] = glm::vec2(x, y);
+        }
+
+        double t0 = benchNow();
+        SpatialHash hash;
+        hash.build(objs, 1.0f);
+        double t1 = benchNow();
+        int hits = 0;
+        int rounds = 20;
+        for (int r = 0; r < rounds; ++r)
+            for (int i = 0; i < queries.size(); ++i)
+                hits += hash.anyWithin(queries[i], 1.0f);
+        double t2 = benchNow();
+        int scanHits = 0;
+        for (int i = 0; i < queries.size(); ++i)
+            for (int k = 0; k < objs.size(); ++k)
+                if (glm::distance(queries[i], objs[k]) < 1.0f) {
+                    ++scanHits;
+                    break;
+                }
+        double t3 = benchNow();
+
+        std::cout << "collision " << counts[c] << " objects"
+                  << "  build: " << (t1 - t0)*1e3 << " ms"
+                  << "  hash: " << rounds*queries.size()/(t2 - t1)/1e6 << " M queries/s"
+                  << "  scan: " << queries.size()/(t3 - t2)/1e6 << " M queries/s"
+                  << (hits == rounds*scanHits ? "" : "  MISMATCH") << std::endl;
+        pass = pass && hits == rounds*scanHits;
+    }
+    return pass;
+}
+
+// Block compression throughput (scalar, SIMD, SIMD on the pool) and quality
+// for each format, on grass.jpg or the image given after --bench-bc. Fails
+// any format whose PSNR is under what the baker accepts, or whose scalar,
+// SIMD and pooled encodes differ.
+inline bool benchBlockCompression(const char* path) {
+    int w, h, n;
+    unsigned char* pixels = stbi_load(path, &w, &h, &n, 4);
+    if (!pixels) {
+        std::cout << "bc: failed to load " << path << std::endl;
+        return false;
+    }
+    uint32_t formats[] = { CTEX_BC1, CTEX_BC3, CTEX_BC7 };
+    bool pass = true;
+    for (int f = 0; f < 3; ++f) {
+        BcFormat bc = ctexBcFormat(formats[f]);
+        double t0 = benchNow();
+        std::vector<unsigned char> scalar = bcEncodeImage(pixels, w, h, bc, false, 1);
+        double t1 = benchNow();
+        std::vector<unsigned char> simd = bcEncodeImage(pixels, w, h, bc, true, 1);
+        double t2 = benchNow();
+        std::vector<unsigned char> pooled = bcEncodeImage(pixels, w, h, bc, true);
+        double t3 = benchNow();
+
+        std::vector<unsigned char> decoded = bcDecodeImage(&pooled[0], w, h, bc);
+        double psnr = bcPsnr(pixels, &decoded[0], w*h, formats[f] != CTEX_BC1);
+        bool ok = psnr >= ctexMinPsnr(formats[f]);
+        bool same = scalar == pooled && simd == pooled;
+        pass = pass && ok && same;
+
+        double mpix = (double)w*h/1e6;
+        std::cout << "bc " << ctexFormatName(formats[f]) << " " << w << "x" << h
+                  << "  scalar: " << mpix/(t1 - t0) << " Mpix/s"
+                  << "  simd: " << mpix/(t2 - t1) << " Mpix/s"
+                  << "  simd+" << threadPool().size() + 1 << " threads: " << mpix/(t3 - t2) << " Mpix/s"
+                  << "  PSNR: " << psnr << " dB " << (ok ? "PASS" : "FAIL")
+                  << (same ? "" : "  MISMATCH") << std::endl;
+    }
+    stbi_image_free(pixels);
+    return pass;
+}
+
+// Cost of one profiler zone, recording and not, against an empty loop.
+// Single thread; every thread has its own ring, so this is also the cost
+// with the pool busy.
+inline void benchProfiler() {
+    const int zones = 20000000;
+    volatile int sink = 0;
+    double t0 = benchNow();
+    for (int i = 0; i < zones; ++i)
+        sink = sink + 1;
+    double t1 = benchNow();
+    for (int i = 0; i < zones; ++i) {
+        PROFILE_ZONE("bench");
+        sink = sink + 1;
+    }
+    double t2 = benchNow();
+    bool was = bProfiler;
+    bProfiler = false;
+    for (int i = 0; i < zones; ++i) {
+        PROFILE_ZONE("bench");
+        sink = sink + 1;
+    }
+    bProfiler = was;
+    double t3 = benchNow();
+    std::cout << "profiler zone  recording: " << 1e9*((t2 - t1) - (t1 - t0))/zones << " ns"
+              << "  off: " << 1e9*((t3 - t2) - (t1 - t0))/zones << " ns" << std::endl;
+}
+
+// Cost of one log message with three arguments, written and skipped at run
+// time, against an empty loop. Messages go out in rounds smaller than the
+// ring, flushed (untimed) to a stream that discards them.
+inline void benchLog() {
+    struct Discard : std::streambuf {
+        int overflow(int c) { return c; }
+    } discard;
+    const int rounds = 2000, messages = LOG_RING / 2;
+    volatile int sink = 0;
+    double loop = 0.0, written = 0.0, skipped = 0.0;
+    std::ostream discarded(&discard);
+    logger().flush();
+    logger().setOutput(&discarded);
+    for (int r = 0; r < rounds; ++r) {
+        double t0 = benchNow();
+        for (int i = 0; i < messages; ++i)
+            sink = sink + 1;
+        double t1 = benchNow();
+        for (int i = 0; i < messages; ++i)
+            logger().write(LOG_LEVEL_INFO, "Generating chunk ({},{}) {}", i, r, 0.5f);
+        double t2 = benchNow();
+        logger().setLevel(LOG_LEVEL_ERROR);
+        double t3 = benchNow();
+        for (int i = 0; i < messages; ++i)
+            logger().write(LOG_LEVEL_INFO, "Generating chunk ({},{}) {}", i, r, 0.5f);
+        double t4 = benchNow();
+        logger().setLevel(LOG_MIN_LEVEL);
+        logger().flush();
+        loop += t1 - t0;
+        written += t2 - t1;
+        skipped += t4 - t3;
+    }
+    logger().setOutput(&std::cout);
+    double total = (double)rounds * messages;
+    std::cout << "log message  written: " << 1e9*(written - loop)/total << " ns"
+              << "  skipped: " << 1e9*(skipped - loop)/total << " ns" << std::endl;
+}
+
+// Software occlusion along a camera path, over the world of seed 1234 with
+// the usual 5x5 chunks around the camera: time to rasterize the occluders
+// (scalar, SIMD, SIMD on the pool), and how many chunks and objects in the
+// frustum the buffer hides. Only the models' bounds are used.
+inline bool benchOcclusion(const char* pathFile, std::vector<Model> &large, std::vector<Model> &small) {
+    CameraPath path;
+    if (!path.load(pathFile))
+        return false;
+    OpenSimplexNoise::Noise noise(1234);
+    const int size = 64, vd = 2;
+    std::map<std::pair<int, int>, Chunk*> chunks;
+
+    OcclusionBuffer buffer, reference;
+    std::vector<glm::vec3> vertices;
+    std::vector<unsigned int> indices;
+    std::vector<glm::vec3> chunkLo, chunkHi;
+    std::vector<std::vector<CullCandidate> > objects;
+    int currentX = 1 << 30, currentZ = 1 << 30;
+    int frames = 0;
+    double scalarTime = 0.0, simdTime = 0.0, pooledTime = 0.0;
+    float maxDifference = 0.0f;
+    unsigned long chunksInView = 0, chunksCulled = 0, objectsInView = 0, objectsCulled = 0;
+    for (float t = 0.0f; t <= path.duration(); t += 1.0f / 30.0f, ++frames) {
+        CameraKey key = path.sample(t);
+        int cx = (int)std::floor(key.position.x / size), cz = (int)std::floor(key.position.z / size);
+        // the displayed chunks, relative to the camera's like world does
+        if (cx != currentX || cz != currentZ) {
+            currentX = cx;
+            currentZ = cz;
+            vertices.clear();
+            indices.clear();
+            chunkLo.clear();
+            chunkHi.clear();
+            objects.clear();
+            for (int x = cx - vd; x <= cx + vd; ++x)
+                for (int z = cz - vd; z <= cz + vd; ++z) {
+                    Chunk*& chunk = chunks[std::make_pair(x, z)];
+                    if (!chunk)
+                        chunk = new Chunk(size, size, x, z, &large, &small, &noise, 1234);
+                    glm::mat4 trans = glm::translate(glm::mat4(1.0f), glm::vec3(size * (x - cx), 0.0f, size * (z - cz)));
+                    chunk->occluderMesh(trans, vertices, indices);
+                    chunkLo.push_back(glm::vec3(0.0f));
+                    chunkHi.push_back(glm::vec3(0.0f));
+                    chunk->bounds(trans, chunkLo.back(), chunkHi.back());
+                    objects.push_back(std::vector<CullCandidate>());
+                    chunk->objectInstances(trans, objects.size() - 1, objects.back());
+                }
+        }
+        Chunk* current = chunks[std::make_pair(cx, cz)];
+        glm::vec3 eye(key.position.x - size * cx, 0.0f, key.position.z - size * cz);
+        eye.y = current->interpolateHeight(eye.x, eye.z) + key.position.y;
+        Camera camera(eye, glm::vec3(0.0f, 1.0f, 0.0f), key.yaw, key.pitch);
+        glm::mat4 viewProj = glm::perspective(glm::radians(camera.Zoom), 1280.0f / 720.0f, 0.1f, 1000.0f) *
+                             camera.GetViewMatrix();
+
+        double t0 = benchNow();
+        reference.render(viewProj, vertices, indices, false, 1);
+        double t1 = benchNow();
+        buffer.render(viewProj, vertices, indices, true, 1);
+        double t2 = benchNow();
+        buffer.render(viewProj, vertices, indices);
+        double t3 = benchNow();
+        scalarTime += t1 - t0;
+        simdTime += t2 - t1;
+        pooledTime += t3 - t2;
+        for (unsigned int p = 0; p < buffer.buffer().size(); ++p)
+            maxDifference = std::max(maxDifference, std::fabs(buffer.buffer()[p] - reference.buffer()[p]));
+
+        // only what the frustum keeps counts, that is culled anyway
+        glm::vec4 planes[6];
+        frustumPlanes(viewProj, planes);
+        for (unsigned int c = 0; c < objects.size(); ++c) {
+            glm::vec3 centre = (chunkLo[c] + chunkHi[c]) * 0.5f, half = (chunkHi[c] - chunkLo[c]) * 0.5f;
+            bool inside = true;
+            for (int p = 0; p < 6; ++p)
+                if (glm::dot(glm::vec3(planes[p]), centre) + glm::dot(glm::abs(glm::vec3(planes[p])), half) + planes[p].w < 0.0f)
+                    inside = false;
+            if (!inside)
+                continue;
+            bool chunkHidden = buffer.occluded(chunkLo[c], chunkHi[c]);
+            chunksInView++;
+            chunksCulled += chunkHidden;
+            for (unsigned int i = 0; i < objects[c].size(); ++i) {
+                const CullCandidate &object = objects[c][i];
+                const Model &model = object.model < large.size() ? large[object.model] : small[object.model - large.size()];
+                float cy = cos(object.placement.w), sy = sin(object.placement.w);
+                glm::vec3 b = model.boundsCenter;
+                glm::vec3 sphere = glm::vec3(object.placement) + glm::vec3(cy*b.x + sy*b.z, b.y, cy*b.z - sy*b.x);
+                bool visible = true;
+                for (int p = 0; p < 6; ++p)
+                    if (glm::dot(glm::vec3(planes[p]), sphere) + planes[p].w < -model.boundsRadius)
+                        visible = false;
+                if (!visible)
+                    continue;
+                objectsInView++;
+                glm::vec3 reach(model.boundsRadius);
+                objectsCulled += chunkHidden || buffer.occluded(sphere - reach, sphere + reach);
+            }
+        }
+    }
+    for (std::map<std::pair<int, int>, Chunk*>::iterator it = chunks.begin(); it != chunks.end(); ++it)
+        delete it->second;
+
+    std::cout << "occlusion " << pathFile << ": " << frames << " frames, " << OCCLUSION_WIDTH << "x" << OCCLUSION_HEIGHT
+              << ", " << indices.size() / 3 << " occluder triangles" << std::endl;
+    std::cout << "  raster per frame  scalar: " << 1000.0*scalarTime/frames << " ms"
+              << "  simd: " << 1000.0*simdTime/frames << " ms"
+              << "  simd+" << threadPool().size() + 1 << " threads: " << 1000.0*pooledTime/frames << " ms"
+              << "  max difference: " << maxDifference << std::endl;
+    std::cout << "  in the frustum, culled  chunks: " << 100.0*chunksCulled/std::max(chunksInView, 1ul) << "% ("
+              << chunksCulled << " of " << chunksInView << ")"
+              << "  objects: " << 100.0*objectsCulled/std::max(objectsInView, 1ul) << "% ("
+              << objectsCulled << " of " << objectsInView << ")" << std::endl;
+    return true;
+}
+
+// --bench-occlusion [path], over assets/paths/hills.path by default. The
+// models are loaded on the CPU only. Returns true if asked; status is what
+// the program should exit with.
+inline bool runOcclusionBench(int argc, char** argv, const std::vector<std::string> &largePaths,
+                              const std::vector<std::string> &smallPaths, int &status) {
+    for (int i = 1; i < argc; ++i)
+        if (std::strcmp(argv[i], "--bench-occlusion") == 0) {
+            bool given = i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0;
+            std::vector<Model> large(largePaths.size()), small(smallPaths.size());
+            for (unsigned int m = 0; m < largePaths.size(); ++m)
+                large[m].loadModel(largePaths[m]);
+            for (unsigned int m = 0; m < smallPaths.size(); ++m)
+                small[m].loadModel(smallPaths[m]);
+            status = benchOcclusion(given ? argv[i + 1] : "assets/paths/hills.path", large, small) ? 0 : 1;
+            return true;
+        }
+    return false;
+}
+
+// The world of seed 1234 along a camera path on the null render device (see
+// renderdevice.h): chunk loads, occlusion, LOD selection and the draws of
+// both passes, with nothing drawn and no GL context. Prints the CPU time
+// of each part per frame, what the frame asks of the GPU, and a checksum of
+// the recorded commands: the same seed and path give the same checksum
+// unless what is drawn changed. The batch, impostors, GPU culler and
+// occlusion queries need GL, so the objects go model by model.
+inline bool benchNullRender(const char* pathFile, std::vector<Model> &large, std::vector<Model> &small) {
+    CameraPath path;
+    if (!path.load(pathFile))
+        return false;
+    NullDevice device;
+    RenderDevice* previous = setRenderDevice(&device);
+    bool queries = bOcclusionQueries;
+    bOcclusionQueries = false;
+    for (unsigned int m = 0; m < large.size(); ++m)
+        for (unsigned int i = 0; i < large[m].meshes.size(); ++i)
+            large[m].meshes[i].setupMesh();
+    for (unsigned int m = 0; m < small.size(); ++m)
+        for (unsigned int i = 0; i < small[m].meshes.size(); ++i)
+            small[m].meshes[i].setupMesh();
+    Shader shader("assets/shaders/main.vs", "assets/shaders/main.fs");
+    Shader depthShader("assets/shaders/shadowdepth.vs", "assets/shaders/shadowdepth.fs");
+
+    OpenSimplexNoise::Noise noise(1234);
+    const int size = 64;
+    double start = benchNow();
+    world w(0, 0, size, size, 2, &noise, 1234, large, small, 0);
+    double initialLoad = benchNow() - start;
+    device.clear();
+
+    int frames = 0, loads = 0;
+    double loadTime = 0.0, viewTime = 0.0, shadowTime = 0.0, colorTime = 0.0;
+    RenderCounters total;
+    unsigned long commands = 0;
+    uint64_t checksum = 14695981039346656037ull;
+    for (float t = 0.0f; t <= path.duration(); t += 1.0f / 30.0f, ++frames) {
+        CameraKey key = path.sample(t);
+        glm::vec2 position(key.position.x, key.position.z);
+        double t0 = benchNow();
+        while (w.stepTowards(position))
+            ++loads;
+        glm::vec2 local = position - w.origin();
+        glm::vec3 eye(local.x, 0.0f, local.y);
+        eye.y = w.interpolateHeight(eye.x, eye.z) + key.position.y;
+        Camera camera(eye, glm::vec3(0.0f, 1.0f, 0.0f), key.yaw, key.pitch);
+        glm::mat4 viewProj = glm::perspective(glm::radians(camera.Zoom), 1280.0f / 720.0f, 0.1f, 1000.0f) *
+                             camera.GetViewMatrix();
+        glm::vec3 light = eye + glm::vec3(0.0f, 200.0f, 0.0f);
+        glm::mat4 lightViewProj = glm::ortho(-400.0f, 400.0f, -400.0f, 400.0f, -100.0f, 400.5f) *
+                                  glm::lookAt(light, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+
+        double t1 = benchNow();
+        w.setView(eye, glm::radians(camera.Zoom), viewProj, lightViewProj);
+        double t2 = benchNow();
+        {
+            RENDER_PASS("shadow pass");
+            depthShader.use();
+            depthShader.setMat4("lightSpaceMatrix", lightViewProj);
+            w.renderChunks(depthShader, 0);
+        }
+        double t3 = benchNow();
+        {
+            RENDER_PASS("color pass");
+            shader.use();
+            shader.setMat4("view", camera.GetViewMatrix());
+            w.renderChunks(shader, 1);
+        }
+        double t4 = benchNow();
+        loadTime += t1 - t0;
+        viewTime += t2 - t1;
+        shadowTime += t3 - t2;
+        colorTime += t4 - t3;
+        renderStats().endFrame();
+        total.add(renderStats().lastTotal());
+        commands += device.commands().size();
+        checksum = (checksum ^ device.checksum()) * 1099511628211ull;
+        device.clear();
+    }
+    bOcclusionQueries = queries;
+    setRenderDevice(previous);
+
+    double n = std::max(frames, 1);
+    std::cout << "null render " << pathFile << ": " << frames << " frames, initial load "
+              << 1000.0*initialLoad << " ms, " << loads << " chunk loads" << std::endl;
+    std::cout << "  cpu per frame  chunk loads: " << 1000.0*loadTime/n << " ms"
+              << "  view and occlusion: " << 1000.0*viewTime/n << " ms"
+              << "  shadow pass: " << 1000.0*shadowTime/n << " ms"
+              << "  color pass: " << 1000.0*colorTime/n << " ms" << std::endl;
+    std::cout << "  per frame  draws: " << total.drawCalls/n << "  triangles: " << total.triangles/n
+              << "  uniforms: " << total.uniforms/n << "  texture binds: " << total.textureBinds/n
+              << "  vao binds: " << total.vaoBinds/n << "  program switches: " << total.programSwitches/n
+              << "  commands: " << commands/n << std::endl;
+    std::cout << "  command checksum: " << std::hex << checksum << std::dec << std::endl;
+    return true;
+}
+
+// --bench-null [path], over assets/paths/hills.path by default. The models
+// are loaded on the CPU only. Returns true if asked; status is what the
+// program should exit with.
+inline bool runNullRenderBench(int argc, char** argv, const std::vector<std::string> &largePaths,
+                               const std::vector<std::string> &smallPaths, int &status) {
+    for (int i = 1; i < argc; ++i)
+        if (std::strcmp(argv[i], "--bench-null") == 0) {
+            bool given = i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0;
+            std::vector<Model> large(largePaths.size()), small(smallPaths.size());
+            for (unsigned int m = 0; m < largePaths.size(); ++m)
+                large[m].loadModel(largePaths[m]);
+            for (unsigned int m = 0; m < smallPaths.size(); ++m)
+                small[m].loadModel(smallPaths[m]);
+            status = benchNullRender(given ? argv[i + 1] : "assets/paths/hills.path", large, small) ? 0 : 1;
+            return true;
+        }
+    return false;
+}
+
+// Dispatch command line benchmarks. Returns true if one ran, in which case
+// the program should exit without opening a window, with status (1 if a
+// benchmark's check failed).
+inline bool runBenchmarks(int argc, char** argv, int &status) {
+    bool ran = false;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--bench-normals") == 0) {
+            benchNormals();
+            ran = true;
+        }
+        if (std::strcmp(argv[i], "--bench-profiler") == 0) {
+            benchProfiler();
+            ran = true;
+        }
+        if (std::strcmp(argv[i], "--bench-log") == 0) {
+            benchLog();
+            ran = true;
+        }
+        if (std::strcmp(argv[i], "--bench-collision") == 0) {
+            if (!benchCollision())
+                status = 1;
+            ran = true;
+        }
+        if (std::strcmp(argv[i], "--bench-bc") == 0) {
+            bool given = i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0;
+            if (!benchBlockCompression(given ? argv[i + 1] : "assets/textures/surfaces/grass.jpg"))
+                status = 1;
+            ran = true;
+        }
+    }
+    return ran;
+}
+
+#endif
@@ -0,0 +1,113 @@
+// Camera paths, for benchmarks that need the same walk every run.
+//
+// A path is a text file of keyframes, one per line:
+//
+//     time x y z yaw pitch
+//
+// time in seconds, x and z in world units from the corner of chunk (0, 0),
+// y the eye height above the ground (2 when walking), yaw and pitch in
+// degrees like Camera. Lines starting with # are comments. Record one with
+// --record-path <file>; positions between keys follow a Catmull-Rom spline.
+
+#ifndef camerapath_h
+#define camerapath_h
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+struct CameraKey {
+    float time = 0.0f;
+    glm::vec3 position = glm::vec3(0.0f);
+    float yaw = -90.0f;
+    float pitch = 0.0f;
+};
+
+class CameraPath {
+public:
+    bool load(const std::string &path) {
+        std::ifstream in(path.c_str());
+        if (!in) {
+            std::cout << "camera path: failed to open " << path << std::endl;
+            return false;
+        }
+        keys.clear();
+        std::string line;
+        while (std::getline(in, line)) {
+            if (line.empty() || line[0] == '#')
+                continue;
+            std::istringstream fields(line);
+            CameraKey key;
+            if (fields >> key.time >> key.position.x >> key.position.y >> key.position.z >> key.yaw >> key.pitch)
+                add(key);
+        }
+        if (keys.empty())
+            std::cout << "camera path: no keys in " << path << std::endl;
+        return !keys.empty();
+    }
+
+    bool save(const std::string &path) const {
+        std::ofstream out(path.c_str());
+        if (!out) {
+            std::cout << "camera path: failed to write " << path << std::endl;
+            return false;
+        }
+        out << "# time x y z yaw pitch, see camerapath.h" << std::endl;
+        for (unsigned int k = 0; k < keys.size(); ++k)
+            out << keys[k].time << " " << keys[k].position.x << " " << keys[k].position.y << " "
+                << keys[k].position.z << " " << keys[k].yaw << " " << keys[k].pitch << std::endl;
+        return true;
+    }
+
+    // Keys must come in time order; out of order ones are dropped.
+    void add(const CameraKey &key) {
+        if (keys.empty() || key.time > keys.back().time)
+            keys.push_back(key);
+    }
+
+    bool empty() const {
+        return keys.empty();
+    }
+
+    float duration() const {
+        return keys.empty() ? 0.0f : keys.back().time;
+    }
+
+    // The camera at time t, clamped to the path.
+    CameraKey sample(float t) const {
+        if (keys.empty())
+            return CameraKey();
+        if (t <= keys.front().time)
+            return keys.front();
+        if (t >= keys.back().time)
+            return keys.back();
+        unsigned int k = 0;
+        while (keys[k + 1].time < t)
+            ++k;
+        const CameraKey &a = keys[k], &b = keys[k + 1];
+        const CameraKey &before = keys[k > 0 ? k - 1 : k];
+        const CameraKey &after = keys[std::min(k + 2, (unsigned int)keys.size() - 1)];
+        float s = (t - a.time) / (b.time - a.time);
+        CameraKey key;
+        key.time = t;
+        key.position = catmullRom(before.position, a.position, b.position, after.position, s);
+        key.yaw = a.yaw + (b.yaw - a.yaw) * s;
+        key.pitch = a.pitch + (b.pitch - a.pitch) * s;
+        return key;
+    }
+
+private:
+    std::vector<CameraKey> keys;
+
+    static glm::vec3 catmullRom(const glm::vec3 &p0, const glm::vec3 &p1, const glm::vec3 &p2, const glm::vec3 &p3, float s) {
+        float s2 = s * s, s3 = s2 * s;
+        return 0.5f * (2.0f * p1 + (p2 - p0) * s + (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3) * s2 +
+                       (3.0f * p1 - p0 - 3.0f * p2 + p3) * s3);
+    }
+};
+
+#endif
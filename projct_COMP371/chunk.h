@@ -4,43 +4,184 @@
 #include <iostream>
 #include <cmath>
 #include <cstdlib>
+#include <algorithm>
 #include <glm/glm.hpp>
 #include "draw.h"
+#include "log.h"
 #include "Model.h"
+#include "batch.h"
+#include "gpucull.h"
+#include "impostor.h"
+#include "occlusion.h"
+#include "profiler.h"
+#include "streambuffer.h"
+#include "threadpool.h"
+#include "normals.h"
+#include "scatter.h"
 
 #include "OpenSimplexNoise.h"
 
 #define MAXSIZE_X 128
 #define MAXSIZE_Y 128
 
+// GPU side of the terrain. Every chunk has the same grid, so all of them share
+// one index buffer; a chunk only owns a slot in an arena. There are two paths:
+//
+//  - full: interleaved position, normal, uv (8 floats, 32 bytes per vertex).
+//  - compact: one 16 bit quantized height per vertex, plus a one cell apron so
+//    the normals at the chunk edge can be taken from the neighbours. The vertex
+//    shader rebuilds x/z from gl_VertexID, the uv from x/z and the normal from
+//    the neighbouring heights, all read through a texture buffer (2 bytes per
+//    vertex).
+//
+// Arenas are only created the first time their path is used. GL 3.2 only
+// promises 65536 texels in a texture buffer, less than a compact arena of 50
+// 65x65 chunks; where the compact arena doesn't fit the full path is used.
+struct TerrainBuffer {
+    bool compact = true;
+    int width = 0;
+    int height = 0;
+    unsigned int slots = 0;
+    unsigned int EBO = 0;
+
+    StreamArena* arena = NULL;
+    unsigned int VAO = 0;
+
+    StreamArena* heightArena = NULL;
+    unsigned int compactVAO = 0;
+    unsigned int heightTBO = 0;
+    bool compactFits = true;
+
+    std::vector<GLsizei> counts;
+    std::vector<void*> offsets;
+    std::vector<GLint> base;
+
+    void init(int w, int h, unsigned int slotCount) {
+        width = w;
+        height = h;
+        slots = slotCount;
+
+        // One strip per row, all of them in a single index buffer.
+        std::vector<unsigned int> indices;
+        indices.reserve((height - 1) * width * 2);
+        for (int i = height-1; i > 0; --i)
+            for (int j = 0; j < width; ++j) {
+                indices.push_back(j + width * i);
+                indices.push_back(j + width * (i-1));
+            }
+        for (int strip = 0; strip < height - 1; ++strip) {
+            counts.push_back(width * 2);
+            offsets.push_back((void*)(sizeof(unsigned int) * width * 2 * strip));
+        }
+        EBO = renderDevice().createBuffer();
+        renderDevice().bindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        renderDevice().bufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+        renderDevice().bindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+        GLint limit = renderDevice().maxTextureBufferTexels();
+        compactFits = (long long)texelsPerSlot() * slots <= limit;
+        if (!compactFits)
+            std::cout << "terrain: " << texelsPerSlot() * slots << " heights don't fit a texture buffer of " << limit
+                      << " texels, using full vertices" << std::endl;
+        compact = compact && compactFits;
+    }
+
+    int vertsPerSlot() const {
+        return width * height;
+    }
+
+    // Heights per compact slot, apron included.
+    int texelsPerSlot() const {
+        return (width + 2) * (height + 2);
+    }
+
+    StreamArena* fullArena() {
+        if (arena == NULL) {
+            arena = new StreamArena(GL_ARRAY_BUFFER, vertsPerSlot() * 8 * sizeof(float), slots);
+            VAO = renderDevice().createVertexArray();
+            renderDevice().bindVertexArray(VAO);
+            renderDevice().bindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+            renderDevice().bindBuffer(GL_ARRAY_BUFFER, arena->buffer);
+            unsigned int stride = (3 + 2 + 3) * sizeof(float);
+            renderDevice().vertexAttrib(0, 3, GL_FLOAT, stride, 0);
+            renderDevice().vertexAttrib(1, 3, GL_FLOAT, stride, 3 * sizeof(float));
+            renderDevice().vertexAttrib(2, 2, GL_FLOAT, stride, 6 * sizeof(float));
+            renderDevice().bindVertexArray(0);
+        }
+        return arena;
+    }
+
+    StreamArena* compactArena() {
+        if (heightArena == NULL) {
+            heightArena = new StreamArena(GL_TEXTURE_BUFFER, texelsPerSlot() * sizeof(unsigned short), slots);
+            heightTBO = renderDevice().createTexture();
+            renderDevice().bindTexture(GL_TEXTURE_BUFFER, heightTBO);
+            renderDevice().textureBuffer(GL_R16, heightArena->buffer);
+            renderDevice().bindTexture(GL_TEXTURE_BUFFER, 0);
+            // No attributes at all, everything is pulled in the vertex shader.
+            compactVAO = renderDevice().createVertexArray();
+            renderDevice().bindVertexArray(compactVAO);
+            renderDevice().bindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+            renderDevice().bindVertexArray(0);
+        }
+        return heightArena;
+    }
+
+    // Draw every strip of the chunk living in the given slot in one call.
+    void draw(int slot) {
+        counted::bindVertexArray(VAO);
+        base.assign(counts.size(), slot * vertsPerSlot());
+        counted::multiDrawElementsBaseVertex(GL_TRIANGLE_STRIP, &counts[0], GL_UNSIGNED_INT,
+                                             (const void* const*)&offsets[0], (GLsizei)counts.size(), &base[0]);
+    }
+
+    // Same, for the compact path. The slot is selected with terrainBase.
+    void drawCompact(int slot, Shader& shader) {
+        shader.setInt("terrainBase", slot * texelsPerSlot());
+        shader.setInt("terrainWidth", width);
+        renderDevice().activeTexture(GL_TEXTURE2);
+        counted::bindTexture(GL_TEXTURE_BUFFER, heightTBO);
+        counted::bindVertexArray(compactVAO);
+        counted::multiDrawElements(GL_TRIANGLE_STRIP, &counts[0], GL_UNSIGNED_INT,
+                                   (const void* const*)&offsets[0], (GLsizei)counts.size());
+    }
+};
+
+// Threads one chunk may split its heightmap over, caller included. 0 is
+// the whole pool. The chunk benchmark (--bench-chunks) pins it.
+unsigned int chunkRowThreads = 0;
+
+// False makes chunks use the scalar normals kernel, for comparison.
+bool bSimdNormals = true;
+
+// Where the time of a chunk's generation went, in nanoseconds.
+struct ChunkTimings {
+    uint64_t heights = 0;
+    uint64_t normals = 0;
+    uint64_t scatter = 0;
+};
+
 class Chunk {
 public:
-    unsigned int terrainVAO = 0;
+    // Slots of the terrain arenas holding this chunk's mesh, -1 if not meshed.
+    int meshSlot = -1;
+    int heightSlot = -1;
     float density = 0.4;
+    ChunkTimings timings;
     
-    // Verify if, for all items in the chunk, the given position is inside
-    // any of them. Return false if this is the case, otherwise default to
-    // true.
-    bool isValid(glm::vec3 pos) {
-        for (int i = 0; i < largePOS.size(); ++i) {
-            pos.y = largePOS[i].y;
-            if (glm::distance(pos, largePOS[i]) < 1.0f) {
-                std::cout << "collided" << std::endl;
-                return false;
-            }
-        }
-        for (int i = 0; i < smallPOS.size(); ++i) {
-            pos.y = smallPOS[i].y;
-            if (glm::distance(pos, smallPOS[i]) < 1.0f) {
-                std::cout << "collided" << std::endl;
-                return false;
-            }
-        }
-        return true;
+    // Footprints (x, z) of every object in the chunk, in chunk coordinates.
+    // The world hashes these for collision queries.
+    const std::vector<glm::vec2>& objects() const {
+        return objectPOS;
     }
     
     // Wew. Generate a Chunk.
-    Chunk(int w, int h, int x, int y, vector<Model> m, vector<Model> s, OpenSimplexNoise::Noise* n) {
+    // The model lists are owned by the world and shared by every chunk.
+    Chunk(int w, int h, int x, int y, vector<Model>* m, vector<Model>* s, OpenSimplexNoise::Noise* n, uint64_t seed,
+          float objectDensity = 0.4f) {
+        PROFILE_ZONE("Chunk::Chunk");
+        uint64_t start = profilerNanos();
+        density = objectDensity;
         // Width and height must be 1 more. Prevents gap from chunks.
         width = w+1;
         height = h+1;
@@ -51,46 +192,62 @@ public:
         largeOBJ = m;
         smallOBJ = s;
         simpleNoise = n;
-        // This holds the mesh for the terrain.
-        terrainVAO = 0;
         
         // Debugging
-        std::cout << "initializing chunk with dimensions " <<w<<"x"<<h<<" at position ("<<x<<"," <<y<<")" <<std::endl;
+        LOG_DEBUG("initializing chunk with dimensions {}x{} at position ({},{})", w, h, x, y);
         
         // Create the chunk's heightmap. Values are taken as a linear function of
-        // the simplex noise map.
-        heightMap = new double[(MAXSIZE_X + 1)*(MAXSIZE_Y + 1)];
-        for (int i = 0; i < width; ++i)
-            for (int j = 0; j < height; ++j) {
-                setHeight(i, j, eval(i,j));
-            }
+        // the simplex noise map. The map has a one cell apron on every side;
+        // the noise is continuous, so the apron holds exactly the border cells
+        // of the neighbouring chunks, whether or not they exist yet.
+        heightMap.resize((width + 2)*(height + 2));
+        normalMap.resize(3*width*height);
+        threadPool().parallelFor(height + 2, [this](int row) {
+            for (int i = -1; i <= width; ++i)
+                setHeight(i, row - 1, eval(i, row - 1));
+        }, chunkRowThreads);
+        uint64_t heightsDone = profilerNanos();
+        timings.heights = heightsDone - start;
+        
+        // Then the normals. A 65x65 chunk takes a few microseconds with SIMD,
+        // less than handing rows to the pool would cost (see --bench-normals).
+        (bSimdNormals ? computeNormals : computeNormalsScalar)(&heightMap[0], width, height, &normalMap[0],
+                                                              &normalMap[width*height], &normalMap[2*width*height], 0, height);
+        uint64_t normalsDone = profilerNanos();
+        timings.normals = normalsDone - heightsDone;
         
         // Depending on density, will append items to be drawn on the map.
-        for (int i = 0; i < width*height*density*density; ++i) {
-            float xpos = 1.0*rand()/RAND_MAX*width;
-            float ypos = 1.0*rand()/RAND_MAX*height;
-            float  val = 1.0*rand()/RAND_MAX;
+        // Candidates come from a Poisson disk (no two closer than 1/density)
+        // seeded by the chunk's coordinates, so the same chunk always gets the
+        // same objects. The noise is only probed for points the disk kept.
+        ChunkRNG rng(seed, x, y);
+        float radius = 1.0f / density;
+        std::vector<glm::vec2> candidates = poissonDisk(width, height, radius, rng);
+        for (int i = 0; i < candidates.size(); ++i) {
+            float xpos = candidates[i].x;
+            float ypos = candidates[i].y;
+            float  val = rng.uniform();
             float  lim = simpleNoise->eval(xpos, ypos);
-            if (val >= 2*(lim+1))
+            if (val < 2*(lim+1))
+                continue;
+            if (rng.uniform() < 0.5f)
                 largePOS.push_back(glm::vec3(xpos, lim, ypos));
-            xpos = 1.0*rand()/RAND_MAX*width;
-            ypos = 1.0*rand()/RAND_MAX*height;
-            val = 1.0*rand()/RAND_MAX;
-            lim = simpleNoise->eval(xpos, ypos);
-            if (val >= 2*(lim+1))
+            else
                 smallPOS.push_back(glm::vec3(xpos, lim, ypos));
+            objectPOS.push_back(candidates[i]);
         }
+        timings.scatter = profilerNanos() - normalsDone;
         // Debug msgs are nice. i like debug messages.
-        std::cout << "Planted " << largePOS.size() << " trees." << std::endl;
-        std::cout << "Placed " << smallPOS.size() << " things." << std::endl;
+        LOG_DEBUG("Planted {} trees.", largePOS.size());
+        LOG_DEBUG("Placed {} things.", smallPOS.size());
     }
     // Debug msgs are mean. I hate debug messages.
     void print() {
-        std::cout << "Current CHUNK: (" << offsetX << "," <<offsetY << ")" << std::endl;
+        LOG_DEBUG("Current CHUNK: ({},{})", offsetX, offsetY);
     }
     // Get the height from x,y value
     double getHeight(int x, int y) {
-        return heightMap[y*width + x];
+        return heightMap[(y + 1)*(width + 2) + x + 1];
     }
     // This uses linear interpolation using 4 points rather than the triangle
     // This will not work if the terrain is too steep. In which case,
@@ -108,105 +265,204 @@ public:
         return (y2 - y)*f1 + (y - y1)*f2;
     }
     
-    // Render the chunk
-    void render(Shader shader, glm::mat4 trans, unsigned int ft, int l) {
-        floorTexture = ft;
-        // If the VAO for the terrain mesh is already set up, skip this.
-        if (terrainVAO == 0) {
-            std::cout << "d00d" << std::endl;
-            glGenVertexArrays(1, &terrainVAO);
-            
-            unsigned int vbo, ebo;
-            glGenBuffers(1, &vbo);
-            glGenBuffers(1, &ebo);
-            
-            std::vector<glm::vec3> positions;
-            std::vector<glm::vec2> uv;
-            std::vector<glm::vec3> normals;
-            std::vector<unsigned int> indices;
-            
-            for (int i = 0; i < height; ++i)
-                for (int j = 0; j < width; ++j) {
-                    float zPos = 1.0f*i;
-                    float yPos = 1.0f*getHeight(j,i);
-                    float xPos = 1.0f*j;
-                    
-                    positions.push_back(glm::vec3(xPos, yPos, zPos));
-                    uv.push_back(glm::vec2(i%2, j%2));
- 
-                    normals.push_back(glm::vec3(0.0,1.0,0.0));
-                }
-            
-            for (int i = height-1; i > 0; --i)
-                for (int j = 0; j < width; ++j) {
-                    indices.push_back(j + width * i);
-                    indices.push_back(j + width * (i-1));
-                }
-            
-            indexCount = static_cast<unsigned int>(indices.size());
-            std::vector<float> data;
-            for (unsigned int i = 0; i < positions.size(); ++i) {
-                data.push_back(positions[i].x);
-                data.push_back(positions[i].y);
-                data.push_back(positions[i].z);
-                data.push_back(normals[i].x);
-                data.push_back(normals[i].y);
-                data.push_back(normals[i].z);
-                data.push_back(uv[i].x);
-                data.push_back(uv[i].y);
+    // Write the interleaved terrain vertices (position, normal, uv) straight
+    // into dst, which is mapped GPU memory.
+    void writeMesh(float* dst) {
+        for (int i = 0; i < height; ++i)
+            for (int j = 0; j < width; ++j) {
+                *dst++ = 1.0f*j;
+                *dst++ = 1.0f*getHeight(j,i);
+                *dst++ = 1.0f*i;
+                *dst++ = normalMap[i*width + j];
+                *dst++ = normalMap[width*height + i*width + j];
+                *dst++ = normalMap[2*width*height + i*width + j];
+                *dst++ = 1.0f*(i%2);
+                *dst++ = 1.0f*(j%2);
             }
-            glBindVertexArray(terrainVAO);
-            glBindBuffer(GL_ARRAY_BUFFER, vbo);
-            glBufferData(GL_ARRAY_BUFFER, data.size() * sizeof(float), &data[0], GL_DYNAMIC_DRAW);
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-            glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_DYNAMIC_DRAW);
-            unsigned int stride = (3 + 2 + 3) * sizeof(float);
-            glEnableVertexAttribArray(0);
-            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
-            glEnableVertexAttribArray(1);
-            glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (void*)(3 * sizeof(float)));
-            glEnableVertexAttribArray(2);
-            glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride, (void*)(6 * sizeof(float)));
-            
-        }
-        // Initialized. Now draw.
-        glBindVertexArray(terrainVAO);
-        
-        // For all strips, draw all triangles.
-        int numStrips = (height-1);
-        int numTrisPerStrip = (width)*2-2;
+    }
+
+    // Write the quantized heights for the compact path, apron included.
+    void writeHeights(unsigned short* dst) {
+        for (int i = -1; i <= height; ++i)
+            for (int j = -1; j <= width; ++j) {
+                double h = getHeight(j,i);
+                double q = (h + scaleY) / (2.0*scaleY);
+                q = q < 0.0 ? 0.0 : (q > 1.0 ? 1.0 : q);
+                *dst++ = (unsigned short)(q*65535.0 + 0.5);
+            }
+    }
+
+    bool isMeshed() {
+        return meshSlot >= 0 || heightSlot >= 0;
+    }
+
+    // Give the terrain slots back to the arenas, e.g. when the chunk goes out of view.
+    void releaseMesh(TerrainBuffer& terrain) {
+        if (meshSlot >= 0)
+            terrain.arena->release(meshSlot);
+        if (heightSlot >= 0)
+            terrain.heightArena->release(heightSlot);
+        meshSlot = -1;
+        heightSlot = -1;
+    }
+
+    // Render the chunk. view picks the level of detail of every tree and rock;
+    // distant trees are queued on their species' impostor (if baked) instead.
+    // With a batch, trees and rocks are only queued on it (trees are models
+    // 0..n-1 of the batch, small objects follow). Without objects only the
+    // terrain is drawn (the GPU culler has the rest, see objectInstances).
+    // Objects hidden in occlusion, if given, are skipped. With a condition
+    // (an occlusion query) the objects are drawn under conditional rendering.
+    void render(Shader shader, glm::mat4 trans, unsigned int ft, int l, TerrainBuffer& terrain, const LodView& view,
+                std::vector<Impostor>* impostors, VegetationBatch* batch, bool objects,
+                const OcclusionBuffer* occlusion, GLuint condition) {
+        PROFILE_ZONE("Chunk::render");
+        floorTexture = ft;
+        // If the mesh is already in the arena, skip this.
+        if (terrain.compact && heightSlot < 0) {
+            LOG_TRACE("d00d, meshing chunk ({},{})", offsetX, offsetY);
+            StreamArena* arena = terrain.compactArena();
+            heightSlot = arena->acquire();
+            if (heightSlot < 0)
+                return;
+            writeHeights((unsigned short*)arena->slotPtr(heightSlot));
+            arena->commit(heightSlot);
+        }
+        if (!terrain.compact && meshSlot < 0) {
+            LOG_TRACE("d00d, meshing chunk ({},{})", offsetX, offsetY);
+            StreamArena* arena = terrain.fullArena();
+            meshSlot = arena->acquire();
+            if (meshSlot < 0)
+                return;
+            writeMesh((float*)arena->slotPtr(meshSlot));
+            arena->commit(meshSlot);
+        }
+
+        // Initialized. Now draw all strips.
         shader.setMat4("model", trans);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, floorTexture);
-        glActiveTexture(GL_TEXTURE1);
-        for(unsigned strip = 0; strip < numStrips; strip++)
-                {
-                     glDrawElements(GL_TRIANGLE_STRIP,   // primitive type
-                                   numTrisPerStrip+2,   // number of indices to render
-                                   GL_UNSIGNED_INT,     // index data type
-                                   (void*)(sizeof(unsigned) * (numTrisPerStrip+2) * strip)); // offset to starting index
-                }
+        renderDevice().activeTexture(GL_TEXTURE0);
+        counted::bindTexture(GL_TEXTURE_2D, floorTexture);
+        if (terrain.compact) {
+            shader.setBool("compactTerrain", true);
+            shader.setVec2("terrainScale", -scaleY, 2.0*scaleY);
+            terrain.drawCompact(heightSlot, shader);
+            shader.setBool("compactTerrain", false);
+        }
+        renderDevice().activeTexture(GL_TEXTURE1);
+        if (!terrain.compact)
+            terrain.draw(meshSlot);
+        if (!objects)
+            return;
+        if (condition)
+            renderDevice().beginConditionalRender(condition);
         
         // Draw the chunk at the right space relative to the camera.
         //glm::mat4 model = glm::translate(trans, glm::vec3(width/2.0, eval(width/2.0,height/2.0)+3.0, height/2.0));
         glm::mat4 model = glm::mat4(1.0f);
         shader.setMat4("model", model);
+        largeLOD.resize(largePOS.size(), 0);
+        smallLOD.resize(smallPOS.size(), 0);
         for (int i = 0; i < largePOS.size(); ++i) {
             model = glm::scale(model, glm::vec3(simpleNoise->eval(largePOS[i].x,largePOS[i].z)));
             glm::mat4 model = glm::translate(trans, glm::vec3(largePOS[i].x, eval(largePOS[i].x, largePOS[i].z), largePOS[i].z));
             shader.setMat4("model", model);
-            largeOBJ[i%largeOBJ.size()].Draw(shader);
+            Impostor* impostor = NULL;
+            if (impostors && impostors->size() == largeOBJ->size() && (*impostors)[i%largeOBJ->size()].loaded())
+                impostor = &(*impostors)[i%largeOBJ->size()];
+            drawLod((*largeOBJ)[i%largeOBJ->size()], shader, model, view, largeLOD[i], l == 1 ? impostor : NULL,
+                    batch, i%largeOBJ->size(), 0.0f, occlusion);
         }
         if (l == 1) {
             for (int i = 0; i < smallPOS.size(); ++i) {
                 glm::mat4 model = glm::translate(trans, glm::vec3(smallPOS[i].x, eval(smallPOS[i].x, smallPOS[i].z), smallPOS[i].z));
-                shader.setMat4("model", model*glm::rotate(glm::mat4(1.0f), 7.0f*smallPOS[i].y, glm::vec3(0.0f, 1.0f, 0.0)));
-                smallOBJ[i%smallOBJ.size()].Draw(shader);
+                model = model*glm::rotate(glm::mat4(1.0f), 7.0f*smallPOS[i].y, glm::vec3(0.0f, 1.0f, 0.0));
+                shader.setMat4("model", model);
+                drawLod((*smallOBJ)[i%smallOBJ->size()], shader, model, view, smallLOD[i], NULL,
+                        batch, largeOBJ->size() + i%smallOBJ->size(), 7.0f*smallPOS[i].y, occlusion);
             }
         }
-
+        if (condition)
+            renderDevice().endConditionalRender();
     }
     
+    // Conservative stand-in for the terrain, for the occlusion buffer: one
+    // vertex every OCCLUSION_STEP, as low as the lowest height of the cells
+    // around it, so it stays under the real surface. Appended in world space.
+    void occluderMesh(glm::mat4 trans, std::vector<glm::vec3>& vertices, std::vector<unsigned int>& indices) {
+        int nodes = (width - 1) / OCCLUSION_STEP + 1;
+        if (occluderHeights.empty()) {
+            occluderHeights.resize(nodes * nodes);
+            for (int gi = 0; gi < nodes; ++gi)
+                for (int gj = 0; gj < nodes; ++gj) {
+                    int i = gi * OCCLUSION_STEP, j = gj * OCCLUSION_STEP;
+                    float lowest = 1e30f;
+                    for (int y = std::max(i - OCCLUSION_STEP, 0); y <= std::min(i + OCCLUSION_STEP, height - 1); ++y)
+                        for (int x = std::max(j - OCCLUSION_STEP, 0); x <= std::min(j + OCCLUSION_STEP, width - 1); ++x)
+                            lowest = std::min(lowest, (float)getHeight(x, y));
+                    occluderHeights[gi * nodes + gj] = lowest;
+                }
+        }
+        unsigned int first = vertices.size();
+        for (int gi = 0; gi < nodes; ++gi)
+            for (int gj = 0; gj < nodes; ++gj)
+                vertices.push_back(glm::vec3(trans * glm::vec4(gj * OCCLUSION_STEP, occluderHeights[gi * nodes + gj],
+                                                               gi * OCCLUSION_STEP, 1.0f)));
+        for (int gi = 0; gi + 1 < nodes; ++gi)
+            for (int gj = 0; gj + 1 < nodes; ++gj) {
+                unsigned int a = first + gi * nodes + gj, b = a + 1, c = a + nodes, d = c + 1;
+                unsigned int quad[6] = { a, c, b, b, c, d };
+                indices.insert(indices.end(), quad, quad + 6);
+            }
+    }
+
+    // World space box around the terrain and every object's bounding sphere.
+    void bounds(glm::mat4 trans, glm::vec3& lo, glm::vec3& hi) {
+        float low = 1e30f, high = -1e30f;
+        for (unsigned int k = 0; k < heightMap.size(); ++k) {
+            low = std::min(low, heightMap[k]);
+            high = std::max(high, heightMap[k]);
+        }
+        lo = glm::vec3(trans * glm::vec4(0.0f, low, 0.0f, 1.0f));
+        hi = glm::vec3(trans * glm::vec4(width - 1, high, height - 1, 1.0f));
+        for (int i = 0; i < largePOS.size(); ++i) {
+            const Model& object = (*largeOBJ)[i%largeOBJ->size()];
+            glm::vec3 centre = glm::vec3(trans * glm::vec4(largePOS[i].x, eval(largePOS[i].x, largePOS[i].z), largePOS[i].z, 1.0f));
+            centre += object.boundsCenter;
+            lo = glm::min(lo, centre - glm::vec3(object.boundsRadius));
+            hi = glm::max(hi, centre + glm::vec3(object.boundsRadius));
+        }
+        for (int i = 0; i < smallPOS.size(); ++i) {
+            const Model& object = (*smallOBJ)[i%smallOBJ->size()];
+            glm::vec3 centre = glm::vec3(trans * glm::vec4(smallPOS[i].x, eval(smallPOS[i].x, smallPOS[i].z), smallPOS[i].z, 1.0f));
+            // turned about y, so the centre's offset may point anywhere level
+            float reach = glm::length(glm::vec2(object.boundsCenter.x, object.boundsCenter.z)) + object.boundsRadius;
+            lo = glm::min(lo, centre + glm::vec3(-reach, object.boundsCenter.y - object.boundsRadius, -reach));
+            hi = glm::max(hi, centre + glm::vec3(reach, object.boundsCenter.y + object.boundsRadius, reach));
+        }
+    }
+
+    // Every tree and rock, placed like render() does, for the GPU culler.
+    // Model ids as for the batch; the chunk's index goes with them for the
+    // occlusion mask.
+    void objectInstances(glm::mat4 trans, unsigned int chunk, std::vector<CullCandidate>& out) {
+        for (int i = 0; i < largePOS.size(); ++i) {
+            CullCandidate candidate = CullCandidate();
+            glm::vec3 pos = glm::vec3(trans * glm::vec4(largePOS[i].x, eval(largePOS[i].x, largePOS[i].z), largePOS[i].z, 1.0f));
+            candidate.placement = glm::vec4(pos, 0.0f);
+            candidate.model = i%largeOBJ->size();
+            candidate.chunk = chunk;
+            out.push_back(candidate);
+        }
+        for (int i = 0; i < smallPOS.size(); ++i) {
+            CullCandidate candidate = CullCandidate();
+            glm::vec3 pos = glm::vec3(trans * glm::vec4(smallPOS[i].x, eval(smallPOS[i].x, smallPOS[i].z), smallPOS[i].z, 1.0f));
+            candidate.placement = glm::vec4(pos, 7.0f*smallPOS[i].y);
+            candidate.model = largeOBJ->size() + i%smallOBJ->size();
+            candidate.chunk = chunk;
+            out.push_back(candidate);
+        }
+    }
+
     // Linear function of the simple noise map. For probbing terrain height.
     double eval(int i, int j) {
         return scaleY*(simpleNoise->eval(scaleX*(offsetX*width + i - offsetX), scaleX*(offsetY*height + j -offsetY)));
@@ -219,25 +475,71 @@ private:
     int offsetY;
     int res;
     
-    unsigned int indexCount;
-    unsigned int nStrips;
-    unsigned int tPerStrip;
     double scaleY = 32.0;
     double scaleX = 0.0125;
     
-    double* heightMap;
+    // (width+2) x (height+2), apron included. See getHeight.
+    std::vector<float> heightMap;
+    // Three planes (x, y, z) of width x height.
+    std::vector<float> normalMap;
     
     unsigned int floorTexture;
     
-    std::vector<Model> largeOBJ;
+    std::vector<Model>* largeOBJ;
     std::vector<glm::vec3> largePOS;
-    std::vector<Model> smallOBJ;
+    std::vector<Model>* smallOBJ;
     std::vector<glm::vec3> smallPOS;
+    // Level of detail each object was drawn at last, for the hysteresis.
+    std::vector<unsigned char> largeLOD;
+    std::vector<unsigned char> smallLOD;
+    // Footprints of all objects above.
+    std::vector<glm::vec2> objectPOS;
+    // Occluder vertex heights, made on first use. See occluderMesh.
+    std::vector<float> occluderHeights;
     
     
     OpenSimplexNoise::Noise* simpleNoise;
+
+    // Draw one object at the level its projected size asks for. With an
+    // impostor, far objects are queued on it and those in the crossfade band
+    // go to both. With a batch the mesh is queued as batch model id, placed
+    // at model's origin turned by yaw. Nothing is drawn if the bounding
+    // sphere is behind the occluders.
+    void drawLod(Model& object, Shader& shader, const glm::mat4& model, const LodView& view, unsigned char& lod,
+                 Impostor* impostor, VegetationBatch* batch, unsigned int id, float yaw, const OcclusionBuffer* occlusion) {
+        glm::vec3 centre = glm::vec3(model * glm::vec4(object.boundsCenter, 1.0f));
+        float size = screenSize(view, centre, object.boundsRadius);
+        lod = (unsigned char)selectLod(size, lod, object.lodLevels());
+        if (occlusion) {
+            occlusionStats.objectsTested++;
+            glm::vec3 reach = glm::vec3(object.boundsRadius);
+            if (occlusion->occluded(centre - reach, centre + reach)) {
+                occlusionStats.objectsCulled++;
+                return;
+            }
+        }
+        lodStats.full += object.lodTriangles(0);
+        float meshFade = impostor ? impostorMeshFade(size) : 1.0f;
+        if (meshFade < 1.0f) {
+            impostor->add(centre, meshFade);
+            lodStats.drawn += 2;
+            if (meshFade <= 0.0f)
+                return;
+        }
+        lodStats.drawn += object.lodTriangles(lod);
+        if (batch) {
+            batch->add(id, lod, glm::vec3(model[3]), yaw, meshFade);
+            return;
+        }
+        if (meshFade < 1.0f)
+            shader.setFloat("fade", meshFade);
+        object.Draw(shader, lod);
+        if (meshFade < 1.0f)
+            shader.setFloat("fade", 1.0f);
+    }
+
     void setHeight(int x, int y, double z) {
-        heightMap[y*width + x] = z;
+        heightMap[(y + 1)*(width + 2) + x + 1] = z;
     }
 };
 
@@ -0,0 +1,287 @@
+// Chunk generation throughput, with an optional check against a baseline.
+//
+//     ./project --bench-chunks [--bench-chunks-out results.json]
+//               [--bench-chunks-baseline baseline.json]
+//               [--bench-chunks-tolerance percent]
+//
+// Chunks of 32, 64 and 128 cells, at three object densities, are generated
+// on 1, 2, 4... threads up to the whole pool, and then meshed both ways
+// (see TerrainBuffer) into CPU memory. Every configuration is run
+// CHUNK_BENCH_RUNS times and the fastest run kept. The report has chunks
+// per second, nanoseconds per noise sample of the heightmap, the time of
+// every stage per chunk and, in a build counting them, the heap
+// allocations per chunk. There is no SIMD noise; what has a scalar and a
+// SIMD path is the normals kernel, so the 64 cell chunks are also run with
+// the scalar one.
+//
+// Threads are chunks generated side by side: each chunk's rows stay on the
+// thread generating it (chunkRowThreads is 1), so no more threads than that
+// take part. The chunks' debug logs are skipped while timing.
+//
+// The results go to a JSON file, one configuration per line. Given a
+// baseline (an earlier results file), any configuration whose chunks per
+// second dropped by more than the tolerance (CHUNK_BENCH_TOLERANCE percent
+// unless given) fails the run, and the program exits with 1.
+
+#ifndef chunkbench_h
+#define chunkbench_h
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "OpenSimplexNoise.h"
+#include "bench.h"
+#include "chunk.h"
+#include "log.h"
+#include "threadpool.h"
+
+#define CHUNK_BENCH_RUNS 3
+#define CHUNK_BENCH_SAMPLES (64 * 65 * 65)   // cells per configuration, about
+#define CHUNK_BENCH_TOLERANCE 10.0
+
+// Heap allocations since the start, all threads. Build with
+// -DBENCH_COUNT_ALLOCATIONS=1 to count them: the global operator new is
+// then replaced, one relaxed atomic add per allocation for the whole game,
+// so it is off by default and the report leaves the column out. Only
+// main.cpp may include this file.
+#ifndef BENCH_COUNT_ALLOCATIONS
+#define BENCH_COUNT_ALLOCATIONS 0
+#endif
+
+inline std::atomic<uint64_t>& benchAllocations() {
+    static std::atomic<uint64_t> count(0);
+    return count;
+}
+
+#if BENCH_COUNT_ALLOCATIONS
+void* operator new(std::size_t size) {
+    benchAllocations().fetch_add(1, std::memory_order_relaxed);
+    void* p = std::malloc(size ? size : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](std::size_t size) {
+    return ::operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    std::free(p);
+}
+
+#if __cpp_sized_deallocation
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept {
+    std::free(p);
+}
+#endif
+#endif
+
+struct ChunkBenchResult {
+    int size;
+    float density;
+    unsigned int threads;
+    bool simd;
+    int chunks;
+    double chunksPerSecond;
+    double nanosPerSample;      // heightmap fill
+    double heightsMicros;       // per chunk, from here on
+    double normalsMicros;
+    double scatterMicros;
+    double meshMicros;          // full and compact
+    double allocations;
+
+    std::string key() const {
+        std::ostringstream out;
+        out << "size=" << size << " density=" << density << " threads=" << threads
+            << " normals=" << (simd ? "simd" : "scalar");
+        return out.str();
+    }
+};
+
+// One configuration, fastest of CHUNK_BENCH_RUNS.
+inline ChunkBenchResult benchChunkConfig(int size, float density, unsigned int threads, bool simd) {
+    OpenSimplexNoise::Noise noise(1234);
+    std::vector<Model> large, small;
+    ChunkBenchResult best = { size, density, threads, simd, 0, 0.0 };
+    best.chunks = std::max(4, CHUNK_BENCH_SAMPLES / ((size + 1) * (size + 1)));
+    std::vector<float> vertices((size + 1) * (size + 1) * 8);
+    std::vector<unsigned short> heights((size + 3) * (size + 3));
+    bSimdNormals = simd;
+    chunkRowThreads = 1;
+    logger().setLevel(LOG_LEVEL_WARN);
+    for (int run = 0; run < CHUNK_BENCH_RUNS; ++run) {
+        std::vector<Chunk*> chunks(best.chunks);
+        uint64_t allocations = benchAllocations().load();
+        double start = benchNow();
+        threadPool().parallelFor(best.chunks, [&](int k) {
+            chunks[k] = new Chunk(size, size, k % 8, k / 8, &large, &small, &noise, 1234, density);
+        }, threads);
+        double generated = benchNow();
+        allocations = benchAllocations().load() - allocations;
+        for (int k = 0; k < best.chunks; ++k) {
+            chunks[k]->writeMesh(&vertices[0]);
+            chunks[k]->writeHeights(&heights[0]);
+        }
+        double meshed = benchNow();
+        double perSecond = best.chunks / (generated - start);
+        if (perSecond > best.chunksPerSecond) {
+            ChunkTimings total;
+            for (int k = 0; k < best.chunks; ++k) {
+                total.heights += chunks[k]->timings.heights;
+                total.normals += chunks[k]->timings.normals;
+                total.scatter += chunks[k]->timings.scatter;
+            }
+            best.chunksPerSecond = perSecond;
+            best.nanosPerSample = (double)total.heights / (best.chunks * (size + 3) * (size + 3));
+            best.heightsMicros = total.heights / 1e3 / best.chunks;
+            best.normalsMicros = total.normals / 1e3 / best.chunks;
+            best.scatterMicros = total.scatter / 1e3 / best.chunks;
+            best.meshMicros = (meshed - generated) * 1e6 / best.chunks;
+            best.allocations = (double)allocations / best.chunks;
+        }
+        for (int k = 0; k < best.chunks; ++k)
+            delete chunks[k];
+    }
+    logger().setLevel(LOG_MIN_LEVEL);
+    bSimdNormals = true;
+    chunkRowThreads = 0;
+    return best;
+}
+
+// chunks_per_sec of every configuration in a results file, by key.
+inline bool readChunkBaseline(const std::string &path, std::map<std::string, double> &out) {
+    std::ifstream in(path.c_str());
+    if (!in) {
+        std::cout << "chunk bench: failed to read " << path << std::endl;
+        return false;
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+        size_t key = line.find("\"key\": \"");
+        size_t rate = line.find("\"chunks_per_sec\": ");
+        if (key == std::string::npos || rate == std::string::npos)
+            continue;
+        key += 8;
+        out[line.substr(key, line.find('"', key) - key)] = std::atof(line.c_str() + rate + 18);
+    }
+    return true;
+}
+
+// Runs everything, writes the report and checks the baseline if given.
+// False if a configuration regressed.
+inline bool benchChunks(const std::string &reportFile, const std::string &baselineFile, double tolerance) {
+    std::vector<unsigned int> threads;
+    unsigned int most = threadPool().size() + 1;
+    for (unsigned int t = 1; t < most; t *= 2)
+        threads.push_back(t);
+    threads.push_back(most);
+    const int sizes[] = { 32, 64, 128 };
+    const float densities[] = { 0.2f, 0.4f, 0.8f };
+
+    std::vector<ChunkBenchResult> results;
+    for (int s = 0; s < 3; ++s)
+        for (int d = 0; d < 3; ++d)
+            for (unsigned int t = 0; t < threads.size(); ++t)
+                results.push_back(benchChunkConfig(sizes[s], densities[d], threads[t], true));
+    for (unsigned int t = 0; t < threads.size(); ++t)
+        results.push_back(benchChunkConfig(64, 0.4f, threads[t], false));
+
+    std::cout << "chunk generation, " << most << " threads at most" << std::endl;
+    std::cout << "  size density threads normals   chunks/s   ns/sample  heights us  normals us  scatter us"
+                 "  mesh us" << (BENCH_COUNT_ALLOCATIONS ? "  allocs" : "") << std::endl;
+    for (unsigned int r = 0; r < results.size(); ++r) {
+        const ChunkBenchResult &c = results[r];
+        char line[160];
+        std::snprintf(line, sizeof(line), "  %4d %7.1f %7u %-7s %10.1f %11.2f %11.1f %11.1f %11.1f %8.1f",
+                      c.size, c.density, c.threads, c.simd ? "simd" : "scalar", c.chunksPerSecond, c.nanosPerSample,
+                      c.heightsMicros, c.normalsMicros, c.scatterMicros, c.meshMicros);
+        if (BENCH_COUNT_ALLOCATIONS)
+            std::snprintf(line + std::strlen(line), sizeof(line) - std::strlen(line), " %7.1f", c.allocations);
+        std::cout << line << std::endl;
+    }
+
+    std::ofstream out(reportFile.c_str());
+    if (!out)
+        std::cout << "chunk bench: failed to write " << reportFile << std::endl;
+    out << "{\n  \"threads\": " << most << ",\n  \"results\": [\n";
+    for (unsigned int r = 0; r < results.size(); ++r) {
+        const ChunkBenchResult &c = results[r];
+        out << "    { \"key\": \"" << c.key() << "\", \"size\": " << c.size << ", \"density\": " << c.density
+            << ", \"threads\": " << c.threads << ", \"normals\": \"" << (c.simd ? "simd" : "scalar")
+            << "\", \"chunks\": " << c.chunks << ", \"chunks_per_sec\": " << c.chunksPerSecond
+            << ", \"ns_per_sample\": " << c.nanosPerSample << ", \"heights_us\": " << c.heightsMicros
+            << ", \"normals_us\": " << c.normalsMicros << ", \"scatter_us\": " << c.scatterMicros
+            << ", \"mesh_us\": " << c.meshMicros;
+        if (BENCH_COUNT_ALLOCATIONS)
+            out << ", \"allocations_per_chunk\": " << c.allocations;
+        out << " }" << (r + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}" << std::endl;
+    std::cout << "chunk bench: report in " << reportFile << std::endl;
+
+    if (baselineFile.empty())
+        return true;
+    std::map<std::string, double> baseline;
+    if (!readChunkBaseline(baselineFile, baseline))
+        return false;
+    int compared = 0, regressed = 0;
+    for (unsigned int r = 0; r < results.size(); ++r) {
+        std::map<std::string, double>::iterator it = baseline.find(results[r].key());
+        if (it == baseline.end() || it->second <= 0.0)
+            continue;
+        ++compared;
+        double change = 100.0 * (results[r].chunksPerSecond / it->second - 1.0);
+        if (change < -tolerance) {
+            ++regressed;
+            std::cout << "  regressed: " << results[r].key() << ", " << it->second << " -> "
+                      << results[r].chunksPerSecond << " chunks/s (" << change << "%)" << std::endl;
+        }
+    }
+    std::cout << "chunk bench: " << regressed << " of " << compared << " configurations more than " << tolerance
+              << "% slower than " << baselineFile << std::endl;
+    return regressed == 0;
+}
+
+// --bench-chunks and its options. Returns true if asked; status is what the
+// program should exit with.
+inline bool runChunkBench(int argc, char** argv, int &status) {
+    bool asked = false;
+    std::string reportFile = "chunkbench.json", baselineFile;
+    double tolerance = CHUNK_BENCH_TOLERANCE;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--bench-chunks") == 0)
+            asked = true;
+        if (std::strcmp(argv[i], "--bench-chunks-out") == 0 && i + 1 < argc)
+            reportFile = argv[++i];
+        if (std::strcmp(argv[i], "--bench-chunks-baseline") == 0 && i + 1 < argc)
+            baselineFile = argv[++i];
+        if (std::strcmp(argv[i], "--bench-chunks-tolerance") == 0 && i + 1 < argc)
+            tolerance = std::atof(argv[++i]);
+    }
+    if (!asked)
+        return false;
+    status = benchChunks(reportFile, baselineFile, tolerance) ? 0 : 1;
+    return true;
+}
+
+#endif
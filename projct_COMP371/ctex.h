@@ -0,0 +1,356 @@
+// Pre-baked texture container (.ctex).
+//
+// JPG/PNG/BMP decoding and glGenerateMipmap are done once, offline, by
+// --bake-textures. The result sits next to the source image as
+// <image>.ctex: a fixed header followed by every mip level, tightly packed.
+// At runtime the file is mapped read-only and each level is handed to GL
+// straight from the mapping; nothing is decoded or copied on the CPU.
+//
+// Levels are RGBA8 or block compressed (bcenc.h); the header says which.
+//
+// Layout (little endian):
+//   CtexHeader
+//   level 0 data, level 1 data, ...   (offsets in the header, from file start)
+
+#ifndef ctex_h
+#define ctex_h
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <fstream>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// mesh.h compiles the stb_image implementation; only declarations here.
+#ifndef STBI_INCLUDE_STB_IMAGE_H
+#include "stb_image.h"
+#endif
+
+#include "bcenc.h"
+
+#define CTEX_MAGIC 0x58455443u // "CTEX"
+#define CTEX_VERSION 1
+#define CTEX_MAX_LEVELS 16
+
+enum CtexFormat {
+    CTEX_RGBA8 = 0,
+    CTEX_BC1 = 1,
+    CTEX_BC3 = 2,
+    CTEX_BC7 = 3
+};
+
+struct CtexLevel {
+    uint32_t offset;
+    uint32_t size;
+    uint32_t width;
+    uint32_t height;
+};
+
+struct CtexHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t format;
+    uint32_t levels;
+    CtexLevel level[CTEX_MAX_LEVELS];
+};
+
+inline BcFormat ctexBcFormat(uint32_t format) {
+    return format == CTEX_BC1 ? BC_1 : (format == CTEX_BC3 ? BC_3 : BC_7);
+}
+
+inline const char* ctexFormatName(uint32_t format) {
+    const char* names[] = { "RGBA8", "BC1", "BC3", "BC7" };
+    return format < 4 ? names[format] : "?";
+}
+
+// Set to false (--no-baked) to ignore .ctex files and decode the sources.
+bool bUseBakedTextures = true;
+
+inline std::string ctexPath(const std::string &source) {
+    return source + ".ctex";
+}
+
+// Read-only mapping of a whole file. Falls back to reading it into memory
+// where mmap is not available.
+class MappedFile {
+public:
+    ~MappedFile() {
+        close();
+    }
+
+    bool open(const std::string &path) {
+#ifdef _WIN32
+        std::ifstream in(path.c_str(), std::ios::binary | std::ios::ate);
+        if (!in)
+            return false;
+        buffer.resize((size_t)in.tellg());
+        in.seekg(0);
+        in.read(&buffer[0], buffer.size());
+        bytes = (const unsigned char*)&buffer[0];
+        length = buffer.size();
+        return true;
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            ::close(fd);
+            return false;
+        }
+        void* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED)
+            return false;
+        bytes = (const unsigned char*)p;
+        length = st.st_size;
+        return true;
+#endif
+    }
+
+    void close() {
+#ifndef _WIN32
+        if (bytes)
+            munmap((void*)bytes, length);
+#endif
+        bytes = NULL;
+        length = 0;
+    }
+
+    const unsigned char* data() const {
+        return bytes;
+    }
+
+    size_t size() const {
+        return length;
+    }
+
+private:
+    const unsigned char* bytes = NULL;
+    size_t length = 0;
+#ifdef _WIN32
+    std::vector<char> buffer;
+#endif
+};
+
+// A mapped container.
+class CtexImage {
+public:
+    const CtexHeader* header = NULL;
+
+    bool open(const std::string &path) {
+        if (!file.open(path))
+            return false;
+        if (file.size() < sizeof(CtexHeader))
+            return false;
+        header = (const CtexHeader*)file.data();
+        if (header->magic != CTEX_MAGIC || header->version != CTEX_VERSION || header->format > CTEX_BC7 ||
+            header->levels == 0 || header->levels > CTEX_MAX_LEVELS)
+            return false;
+        for (uint32_t l = 0; l < header->levels; ++l)
+            if ((size_t)header->level[l].offset + header->level[l].size > file.size())
+                return false;
+        return true;
+    }
+
+    const unsigned char* levelData(int l) const {
+        return file.data() + header->level[l].offset;
+    }
+
+    // Bytes of all levels, i.e. what the texture takes on the GPU.
+    size_t dataBytes() const {
+        size_t total = 0;
+        for (uint32_t l = 0; l < header->levels; ++l)
+            total += header->level[l].size;
+        return total;
+    }
+
+private:
+    MappedFile file;
+};
+
+// Open <source>.ctex if baked textures are enabled and it exists.
+inline CtexImage* openBaked(const std::string &source) {
+    if (!bUseBakedTextures)
+        return NULL;
+    CtexImage* image = new CtexImage();
+    if (!image->open(ctexPath(source))) {
+        delete image;
+        return NULL;
+    }
+    return image;
+}
+
+// Next mip level of an RGBA8 image, 2x2 box filter. Odd edges are clamped.
+inline std::vector<unsigned char> downsampleRGBA(const std::vector<unsigned char> &src, int w, int h) {
+    int nw = w > 1 ? w / 2 : 1;
+    int nh = h > 1 ? h / 2 : 1;
+    std::vector<unsigned char> dst(nw * nh * 4);
+    for (int y = 0; y < nh; ++y)
+        for (int x = 0; x < nw; ++x) {
+            int x0 = std::min(2*x, w - 1), x1 = std::min(2*x + 1, w - 1);
+            int y0 = std::min(2*y, h - 1), y1 = std::min(2*y + 1, h - 1);
+            for (int c = 0; c < 4; ++c) {
+                int sum = src[(y0*w + x0)*4 + c] + src[(y0*w + x1)*4 + c] +
+                          src[(y1*w + x0)*4 + c] + src[(y1*w + x1)*4 + c];
+                dst[(y*nw + x)*4 + c] = (unsigned char)((sum + 2) / 4);
+            }
+        }
+    return dst;
+}
+
+// Write a container from a list of levels.
+inline bool writeCtex(const std::string &path, uint32_t format,
+                      const std::vector<std::vector<unsigned char> > &levels,
+                      const std::vector<int> &widths, const std::vector<int> &heights) {
+    CtexHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = CTEX_MAGIC;
+    header.version = CTEX_VERSION;
+    header.format = format;
+    header.levels = (uint32_t)levels.size();
+    uint32_t offset = sizeof(CtexHeader);
+    for (unsigned int l = 0; l < levels.size(); ++l) {
+        header.level[l].offset = offset;
+        header.level[l].size = (uint32_t)levels[l].size();
+        header.level[l].width = widths[l];
+        header.level[l].height = heights[l];
+        offset += header.level[l].size;
+    }
+    FILE* out = fopen(path.c_str(), "wb");
+    if (!out)
+        return false;
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+    for (unsigned int l = 0; l < levels.size() && ok; ++l)
+        ok = fwrite(&levels[l][0], 1, levels[l].size(), out) == levels[l].size();
+    fclose(out);
+    return ok;
+}
+
+// Lowest level 0 PSNR (dB) a baked texture may have before the bake fails.
+inline double ctexMinPsnr(uint32_t format) {
+    return format == CTEX_BC7 ? 34.0 : 28.0;
+}
+
+// Decode a source image and bake it with its full mip chain, compressed
+// unless format is CTEX_RGBA8. -1 picks BC1 for opaque images and BC3 for
+// the rest. Prints decode time vs. map time, texture memory with generated
+// vs. baked mips, and the PSNR of the compressed top level.
+inline bool bakeTexture(const std::string &source, int format) {
+    using namespace std::chrono;
+    steady_clock::time_point t0 = steady_clock::now();
+    int w, h, n;
+    unsigned char* pixels = stbi_load(source.c_str(), &w, &h, &n, 4);
+    if (!pixels) {
+        std::cout << "bake: failed to decode " << source << std::endl;
+        return false;
+    }
+    steady_clock::time_point t1 = steady_clock::now();
+
+    if (format < 0) {
+        bool opaque = true;
+        for (int i = 0; i < w*h && opaque; ++i)
+            opaque = pixels[i*4 + 3] == 255;
+        format = opaque ? CTEX_BC1 : CTEX_BC3;
+    }
+
+    std::vector<std::vector<unsigned char> > levels;
+    std::vector<int> widths, heights;
+    levels.push_back(std::vector<unsigned char>(pixels, pixels + w*h*4));
+    widths.push_back(w);
+    heights.push_back(h);
+    stbi_image_free(pixels);
+    while ((widths.back() > 1 || heights.back() > 1) && levels.size() < CTEX_MAX_LEVELS) {
+        levels.push_back(downsampleRGBA(levels.back(), widths.back(), heights.back()));
+        widths.push_back(std::max(widths.back() / 2, 1));
+        heights.push_back(std::max(heights.back() / 2, 1));
+    }
+
+    double psnr = 0.0;
+    steady_clock::time_point t2 = steady_clock::now();
+    if (format != CTEX_RGBA8) {
+        BcFormat bc = ctexBcFormat(format);
+        for (unsigned int l = 0; l < levels.size(); ++l) {
+            std::vector<unsigned char> encoded = bcEncodeImage(&levels[l][0], widths[l], heights[l], bc);
+            if (l == 0) {
+                std::vector<unsigned char> decoded = bcDecodeImage(&encoded[0], w, h, bc);
+                psnr = bcPsnr(&levels[0][0], &decoded[0], w*h, format != CTEX_BC1);
+            }
+            levels[l].swap(encoded);
+        }
+    }
+    steady_clock::time_point t3 = steady_clock::now();
+
+    if (!writeCtex(ctexPath(source), format, levels, widths, heights)) {
+        std::cout << "bake: failed to write " << ctexPath(source) << std::endl;
+        return false;
+    }
+
+    // What the runtime will do now: map the file.
+    steady_clock::time_point t4 = steady_clock::now();
+    CtexImage baked;
+    bool ok = baked.open(ctexPath(source));
+    steady_clock::time_point t5 = steady_clock::now();
+
+    // glGenerateMipmap on a GL_RGB upload: drivers store RGB8 as RGBA8 and
+    // the chain adds a third.
+    size_t sourceBytes = (size_t)w * h * 4 * 4 / 3;
+    std::cout << source << ": " << w << "x" << h << "x" << n << ", " << levels.size() << " levels, "
+              << ctexFormatName(format)
+              << "  decode " << duration_cast<duration<double, std::milli> >(t1 - t0).count() << " ms"
+              << " -> map " << duration_cast<duration<double, std::milli> >(t5 - t4).count() << " ms"
+              << "  memory " << sourceBytes / 1024 << " KiB -> " << (ok ? baked.dataBytes() / 1024 : 0) << " KiB";
+    if (format != CTEX_RGBA8)
+        std::cout << "  encode " << duration_cast<duration<double, std::milli> >(t3 - t2).count() << " ms"
+                  << "  PSNR " << psnr << " dB";
+    std::cout << std::endl;
+    if (format != CTEX_RGBA8 && psnr < ctexMinPsnr(format)) {
+        std::cout << "bake: " << source << " is below " << ctexMinPsnr(format) << " dB" << std::endl;
+        return false;
+    }
+    return ok;
+}
+
+// --bake-textures [image...] [--bake-format auto|rgba8|bc1|bc3|bc7]: bake the
+// given images, or the default list. Returns true if asked; status is what
+// the program should exit with, 1 if any image was rejected.
+inline bool runBakeTool(int argc, char** argv, const std::vector<std::string> &defaults, int &status) {
+    int format = -1;
+    for (int i = 1; i + 1 < argc; ++i)
+        if (std::strcmp(argv[i], "--bake-format") == 0) {
+            const char* names[] = { "rgba8", "bc1", "bc3", "bc7" };
+            for (int f = 0; f < 4; ++f)
+                if (std::strcmp(argv[i + 1], names[f]) == 0)
+                    format = f;
+        }
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--bake-textures") != 0)
+            continue;
+        std::vector<std::string> sources;
+        for (int j = i + 1; j < argc && strncmp(argv[j], "--", 2) != 0; ++j)
+            sources.push_back(argv[j]);
+        if (sources.empty())
+            sources = defaults;
+        int failed = 0;
+        for (unsigned int s = 0; s < sources.size(); ++s)
+            failed += bakeTexture(sources[s], format) ? 0 : 1;
+        std::cout << "baked " << sources.size() - failed << "/" << sources.size() << " textures" << std::endl;
+        status = failed ? 1 : 0;
+        return true;
+    }
+    return false;
+}
+
+#endif
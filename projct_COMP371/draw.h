@@ -7,66 +7,31 @@
 #include "shader.h"
 
 unsigned int loadTexture(const char *path);
+unsigned int uploadCubemap(const std::vector<ImageData> &faces);
+unsigned int uploadCachedCubemap(CachedTexture* entry);
 unsigned int loadCubemap(std::vector<std::string> faces);
 
 unsigned int loadTexture(char const * path)
 {
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
-
-    int width, height, nrComponents;
-    unsigned char *data = stbi_load(path, &width, &height, &nrComponents, 0);
-    if (data)
-    {
-        GLenum format;
-        if (nrComponents == 1)
-            format = GL_RED;
-        else if (nrComponents == 3)
-            format = GL_RGB;
-        else if (nrComponents == 4) {
-            format = GL_RGBA;
-        }
-
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-
-        stbi_image_free(data);
-    }
-    else
-    {
-        std::cout << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(data);
-    }
-
-    return textureID;
+    return loadCached(path, GL_NEAREST, GL_NEAREST);
 }
 
-unsigned int loadCubemap(std::vector<std::string> faces)
+// Upload six decoded faces (+X, -X, +Y, -Y, +Z, -Z) as a cubemap.
+unsigned int uploadCubemap(const std::vector<ImageData> &faces)
 {
     unsigned int textureID;
     glGenTextures(1, &textureID);
     glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
 
-    int width, height, nrChannels;
     for (unsigned int i = 0; i < faces.size(); i++)
     {
-        unsigned char *data = stbi_load(faces[i].c_str(), &width, &height, &nrChannels, 0);
-        if (data)
-        {
-            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-            stbi_image_free(data);
-        }
+        // the skybox only samples level 0 of baked faces
+        if (faces[i].baked)
+            uploadBakedLevel(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, *faces[i].baked, 0, GL_RGB);
+        else if (faces[i].pixels)
+            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, faces[i].width, faces[i].height, 0, GL_RGB, GL_UNSIGNED_BYTE, faces[i].pixels);
         else
-        {
-            std::cout << "Cubemap texture failed to load at path: " << faces[i] << std::endl;
-            stbi_image_free(data);
-        }
+            std::cout << "Cubemap texture failed to load at path: " << faces[i].path << std::endl;
     }
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
@@ -77,6 +42,33 @@ unsigned int loadCubemap(std::vector<std::string> faces)
     return textureID;
 }
 
+// Make sure a cached cubemap is on the GPU and return it.
+unsigned int uploadCachedCubemap(CachedTexture* entry)
+{
+    if (entry->id)
+        return entry->id;
+    unsigned int textureID = uploadCubemap(entry->images);
+    size_t bytes = 0;
+    for (unsigned int i = 0; i < entry->images.size(); i++)
+    {
+        bytes += textureBytes(entry->images[i], false);
+        freeImage(entry->images[i]);
+    }
+    entry->images.clear();
+    textureCache().resident(entry, textureID, bytes);
+    return textureID;
+}
+
+unsigned int loadCubemap(std::vector<std::string> faces)
+{
+    bool decode;
+    CachedTexture* entry = textureCache().request(TextureCache::keyCubemap(faces), faces[0], decode);
+    if (decode)
+        for (unsigned int i = 0; i < faces.size(); i++)
+            entry->images.push_back(decodeImage(faces[i]));
+    return uploadCachedCubemap(entry);
+}
+
 unsigned int chunkborderVAO, chunkborderVBO;
 void RenderBorder(int width, int height, Shader shader) {
     if (chunkborderVAO == 0){
@@ -109,27 +101,24 @@ void RenderBorder(int width, int height, Shader shader) {
             glm::vec3( 0.5f, 0.5f,-0.5f), glm::vec3(1.0f, 0.0f, 0.0f),
             glm::vec3( 0.5f, 0.5f, 0.5f), glm::vec3(1.0f, 0.0f, 0.0f),
         };
-        glGenVertexArrays(1, &chunkborderVAO);
-        glGenBuffers(1, &chunkborderVBO);
+        chunkborderVAO = renderDevice().createVertexArray();
+        chunkborderVBO = renderDevice().createBuffer();
         // fill buffer
-        glBindBuffer(GL_ARRAY_BUFFER, chunkborderVBO);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(chunkBorder), chunkBorder, GL_STATIC_DRAW);
+        renderDevice().bindBuffer(GL_ARRAY_BUFFER, chunkborderVBO);
+        renderDevice().bufferData(GL_ARRAY_BUFFER, sizeof(chunkBorder), chunkBorder, GL_STATIC_DRAW);
         // link vertex attributes
-        glBindVertexArray(chunkborderVAO);
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
-        glEnableVertexAttribArray(2);
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
-        glBindVertexArray(0);
+        renderDevice().bindVertexArray(chunkborderVAO);
+        renderDevice().vertexAttrib(0, 3, GL_FLOAT, 8 * sizeof(float), 0);
+        renderDevice().vertexAttrib(1, 3, GL_FLOAT, 8 * sizeof(float), 3 * sizeof(float));
+        renderDevice().vertexAttrib(2, 2, GL_FLOAT, 8 * sizeof(float), 6 * sizeof(float));
+        renderDevice().bindBuffer(GL_ARRAY_BUFFER, 0);
+        renderDevice().bindVertexArray(0);
     }
-    glBindVertexArray(chunkborderVAO);
+    counted::bindVertexArray(chunkborderVAO);
     shader.use();
     shader.setMat4("model", glm::scale(glm::mat4(1.0f), glm::vec3(1.0f*width, 100.0f, 1.0f*height)));
-    glDrawArrays(GL_TRIANGLES, 0, 36);
-    glBindVertexArray(0);
+    counted::drawArrays(GL_TRIANGLES, 0, 36);
+    renderDevice().bindVertexArray(0);
 }
 
 unsigned int cubeVAO = 0;
@@ -183,26 +172,23 @@ void renderCube()
             -0.5f,  0.5f, -0.5f,  0.0f,  0.5f,  0.0f, 0.0f, 2.5f, // top-left
             -0.5f,  0.5f,  0.5f,  0.0f,  0.5f,  0.0f, 0.0f, 0.0f  // bottom-left
         };
-        glGenVertexArrays(1, &cubeVAO);
-        glGenBuffers(1, &cubeVBO);
+        cubeVAO = renderDevice().createVertexArray();
+        cubeVBO = renderDevice().createBuffer();
         // fill buffer
-        glBindBuffer(GL_ARRAY_BUFFER, cubeVBO);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+        renderDevice().bindBuffer(GL_ARRAY_BUFFER, cubeVBO);
+        renderDevice().bufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
         // link vertex attributes
-        glBindVertexArray(cubeVAO);
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
-        glEnableVertexAttribArray(2);
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
-        glBindVertexArray(0);
+        renderDevice().bindVertexArray(cubeVAO);
+        renderDevice().vertexAttrib(0, 3, GL_FLOAT, 8 * sizeof(float), 0);
+        renderDevice().vertexAttrib(1, 3, GL_FLOAT, 8 * sizeof(float), 3 * sizeof(float));
+        renderDevice().vertexAttrib(2, 2, GL_FLOAT, 8 * sizeof(float), 6 * sizeof(float));
+        renderDevice().bindBuffer(GL_ARRAY_BUFFER, 0);
+        renderDevice().bindVertexArray(0);
     }
     // render Cube
-    glBindVertexArray(cubeVAO);
-    glDrawArrays(GL_TRIANGLES, 0, 24);
-    glBindVertexArray(0);
+    counted::bindVertexArray(cubeVAO);
+    counted::drawArrays(GL_TRIANGLES, 0, 24);
+    renderDevice().bindVertexArray(0);
 }
 
 #endif
@@ -0,0 +1,236 @@
+// Scripted flythrough, for frame times that can be compared between runs.
+//
+//     ./project --flythrough [path] [--seed N] [--flythrough-frames N]
+//               [--flythrough-out report.json]
+//
+// The world comes from a fixed seed (FLYTHROUGH_SEED unless --seed) and the
+// camera follows a camera path (assets/paths/hills.path by default) instead
+// of the keyboard and mouse, FLYTHROUGH_STEP seconds of path per frame or
+// --flythrough-frames frames spread over it. Frames are drawn into an
+// offscreen framebuffer of a surfaceless context (see headless.h), so no
+// display or GPU is needed; llvmpipe does. Every frame ends with glFinish,
+// so its time includes the GPU's work.
+//
+// The report has the frame time percentiles, how long the chunk loads took
+// when the path crossed into new chunks, the render stats (renderstats.h)
+// per frame and the GPU pass times (gputimer.h).
+
+#ifndef flythrough_h
+#define flythrough_h
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+
+#include "bench.h"
+#include "camera.h"
+#include "camerapath.h"
+#include "gputimer.h"
+#include "renderstats.h"
+#include "world.h"
+
+#define FLYTHROUGH_SEED 1234
+#define FLYTHROUGH_STEP (1.0f / 60.0f)
+
+class Flythrough {
+public:
+    // Pick up the flags. False without --flythrough.
+    bool parse(int argc, char** argv) {
+        for (int i = 1; i < argc; ++i) {
+            if (std::strcmp(argv[i], "--flythrough") == 0) {
+                enabled = true;
+                if (i + 1 < argc && std::strncmp(argv[i + 1], "--", 2) != 0)
+                    pathFile = argv[++i];
+            }
+            if (std::strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+                seedValue = std::strtoull(argv[++i], NULL, 10);
+            if (std::strcmp(argv[i], "--flythrough-frames") == 0 && i + 1 < argc)
+                frames = std::max(2, std::atoi(argv[++i]));
+            if (std::strcmp(argv[i], "--flythrough-out") == 0 && i + 1 < argc)
+                reportFile = argv[++i];
+        }
+        return enabled;
+    }
+
+    bool active() const {
+        return enabled;
+    }
+
+    uint64_t seed() const {
+        return seedValue;
+    }
+
+    // Load the path and make the framebuffer everything is drawn into. Needs
+    // the context to be current.
+    bool start(int width, int height) {
+        if (!path.load(pathFile))
+            return false;
+        step = frames > 0 ? path.duration() / (frames - 1) : FLYTHROUGH_STEP;
+        this->width = width;
+        this->height = height;
+        glGenFramebuffers(1, &fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glGenRenderbuffers(2, renderbuffers);
+        glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[0]);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, renderbuffers[0]);
+        glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[1]);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, renderbuffers[1]);
+        bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        if (!complete)
+            std::cout << "flythrough: offscreen framebuffer incomplete" << std::endl;
+        return complete;
+    }
+
+    // What the frame is drawn into in place of the window.
+    GLuint target() const {
+        return fbo;
+    }
+
+    bool done() const {
+        return enabled && time > path.duration() + step * 0.5f;
+    }
+
+    // Put the camera where the path is this frame. When the path leaves the
+    // current chunk the world moves along, and the chunk loads are timed.
+    void place(Camera &camera, world &w) {
+        if (frameMillis.empty())
+            initialLoad = w.lastLoadMillis;
+        CameraKey key = path.sample(time);
+        glm::vec2 position(key.position.x, key.position.z);
+        while (w.stepTowards(position)) {
+            loadMillis.push_back(w.lastLoadMillis);
+            chunksGenerated += w.lastGenerated;
+        }
+        glm::vec2 local = position - w.origin();
+        glm::vec3 eye(local.x, 0.0f, local.y);
+        eye.y = w.interpolateHeight(eye.x, eye.z) + key.position.y;
+        float zoom = camera.Zoom;
+        camera = Camera(eye, glm::vec3(0.0f, 1.0f, 0.0f), key.yaw, key.pitch);
+        camera.Zoom = zoom;
+    }
+
+    void beginFrame() {
+        frameStart = benchNow();
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    }
+
+    // Call after the frame's render stats are closed.
+    void endFrame() {
+        glFinish();
+        frameMillis.push_back((benchNow() - frameStart) * 1000.0);
+        const std::vector<PassCounters> &passes = renderStats().last();
+        for (unsigned int p = 0; p < passes.size(); ++p) {
+            unsigned int k = 0;
+            while (k < passTotals.size() && std::strcmp(passTotals[k].name, passes[p].name) != 0)
+                ++k;
+            if (k == passTotals.size())
+                passTotals.push_back(PassCounters{ passes[p].name, RenderCounters() });
+            passTotals[k].counters.add(passes[p].counters);
+        }
+        time += step;
+    }
+
+    // Write the JSON report, and a summary to the console.
+    bool report() const {
+        std::ofstream out(reportFile.c_str());
+        if (!out) {
+            std::cout << "flythrough: failed to write " << reportFile << std::endl;
+            return false;
+        }
+        unsigned int count = frameMillis.size();
+        std::vector<double> sorted = frameMillis;
+        std::sort(sorted.begin(), sorted.end());
+        double total = 0.0;
+        for (unsigned int f = 0; f < count; ++f)
+            total += sorted[f];
+        std::vector<double> loads = loadMillis;
+        std::sort(loads.begin(), loads.end());
+        double loadTotal = 0.0;
+        for (unsigned int l = 0; l < loads.size(); ++l)
+            loadTotal += loads[l];
+
+        out << "{\n";
+        out << "  \"path\": \"" << pathFile << "\",\n";
+        out << "  \"seed\": " << seedValue << ",\n";
+        out << "  \"renderer\": \"" << glGetString(GL_RENDERER) << "\",\n";
+        out << "  \"resolution\": [" << width << ", " << height << "],\n";
+        out << "  \"frames\": " << count << ",\n";
+        out << "  \"step_seconds\": " << step << ",\n";
+        out << "  \"frame_ms\": { \"mean\": " << (count ? total / count : 0.0)
+            << ", \"p50\": " << percentile(sorted, 0.5) << ", \"p90\": " << percentile(sorted, 0.9)
+            << ", \"p95\": " << percentile(sorted, 0.95) << ", \"p99\": " << percentile(sorted, 0.99)
+            << ", \"max\": " << (count ? sorted.back() : 0.0) << " },\n";
+        out << "  \"chunk_loads\": { \"initial_ms\": " << initialLoad << ", \"count\": " << loads.size()
+            << ", \"generated\": " << chunksGenerated
+            << ", \"mean_ms\": " << (loads.empty() ? 0.0 : loadTotal / loads.size())
+            << ", \"p50_ms\": " << percentile(loads, 0.5) << ", \"p99_ms\": " << percentile(loads, 0.99)
+            << ", \"max_ms\": " << (loads.empty() ? 0.0 : loads.back())
+            << ", \"per_chunk_ms\": " << (chunksGenerated ? loadTotal / chunksGenerated : 0.0) << " },\n";
+        out << "  \"render_stats_per_frame\": {";
+        RenderCounters frame;
+        for (unsigned int p = 0; p < passTotals.size(); ++p)
+            frame.add(passTotals[p].counters);
+        writeCounters(out, "frame", frame, count, true);
+        for (unsigned int p = 0; p < passTotals.size(); ++p)
+            writeCounters(out, passTotals[p].name, passTotals[p].counters, count, false);
+        out << "\n  },\n";
+        out << "  \"gpu_ms\": {";
+        std::vector<GpuPassStats> gpu = gpuTimers().stats();
+        for (unsigned int p = 0; p < gpu.size(); ++p)
+            out << (p ? "," : "") << "\n    \"" << gpu[p].name << "\": { \"mean\": " << gpu[p].average
+                << ", \"p99\": " << gpu[p].p99 << ", \"samples\": " << gpu[p].samples << " }";
+        out << "\n  }\n}" << std::endl;
+
+        std::cout << "flythrough: " << count << " frames of " << pathFile << ", frame ms mean "
+                  << (count ? total / count : 0.0) << " p50 " << percentile(sorted, 0.5) << " p99 "
+                  << percentile(sorted, 0.99) << ", " << loads.size() << " chunk loads, report in "
+                  << reportFile << std::endl;
+        return true;
+    }
+
+private:
+    bool enabled = false;
+    std::string pathFile = "assets/paths/hills.path";
+    std::string reportFile = "flythrough.json";
+    uint64_t seedValue = FLYTHROUGH_SEED;
+    int frames = 0;
+    CameraPath path;
+    float step = FLYTHROUGH_STEP;
+    float time = 0.0f;
+    int width = 0, height = 0;
+    GLuint fbo = 0;
+    GLuint renderbuffers[2] = { 0, 0 };
+    double frameStart = 0.0;
+    std::vector<double> frameMillis;
+    double initialLoad = 0.0;
+    std::vector<double> loadMillis;
+    unsigned int chunksGenerated = 0;
+    std::vector<PassCounters> passTotals;
+
+    static double percentile(const std::vector<double> &sorted, double q) {
+        if (sorted.empty())
+            return 0.0;
+        return sorted[std::min((size_t)(sorted.size() * q), sorted.size() - 1)];
+    }
+
+    static void writeCounters(std::ofstream &out, const char* name, const RenderCounters &c, unsigned int frames,
+                              bool first) {
+        double n = std::max(frames, 1u);
+        out << (first ? "" : ",") << "\n    \"" << name << "\": { \"draw_calls\": " << c.drawCalls / n
+            << ", \"triangles\": " << c.triangles / n << ", \"instances\": " << c.instances / n
+            << ", \"uniforms\": " << c.uniforms / n << ", \"texture_binds\": " << c.textureBinds / n
+            << ", \"vao_binds\": " << c.vaoBinds / n << ", \"program_switches\": " << c.programSwitches / n
+            << ", \"buffer_bytes\": " << c.bufferBytes / n << " }";
+    }
+};
+
+#endif
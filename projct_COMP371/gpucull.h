@@ -0,0 +1,506 @@
+// Culling and LOD selection of the trees and rocks on the GPU.
+//
+// The world hands every object of the loaded chunks to setCandidates() once
+// (again when the player changes chunk). Each pass then runs cull.cs over
+// all of them: the bounding sphere is tested against the frustum, the LOD is
+// picked from the camera (with the same hysteresis as selectLod, the level
+// of each instance lives in a buffer), and the survivors are appended to
+// the instance run of their model, mesh and LOD, whose DrawElementsIndirect
+// command counts them. Trees in the impostor band are appended to their
+// species' impostor as well. The vegetation batch then draws the commands
+// with one glMultiDrawElementsIndirect and each impostor with one
+// glDrawArraysIndirect, without the CPU seeing a single instance.
+//
+// Every model gets one command per mesh and level, and a run as long as its
+// instance count for each, so appends never overflow.
+//
+// cullReference() does the same on the CPU; --check-gpu-cull compares the
+// two on random scenes.
+
+#ifndef gpucull_h
+#define gpucull_h
+
+#include <GL/glew.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "batch.h"
+#include "headless.h"
+#include "impostor.h"
+#include "lod.h"
+#include "shader.h"
+
+#define GPUCULL_GROUP 64
+#define GPUCULL_NO_IMPOSTOR 0xffffffffu
+#define GPUCULL_MASK_CHUNKS 256     // bits of cull.cs's chunkMask
+
+// Set to false (--no-gpu-cull) to cull and pick LODs on the CPU.
+bool bGpuCull = true;
+
+// One tree or rock, as cull.cs reads it.
+struct CullCandidate {
+    glm::vec4 placement; // world position, yaw
+    GLuint model;
+    GLuint chunk;        // index into CullParams::visibleChunks
+    GLuint unused[2];
+};
+
+// What glDrawArraysIndirect reads.
+struct DrawArraysIndirectCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint first;
+    GLuint baseInstance;
+};
+
+// What one cull needs besides the candidates.
+struct CullParams {
+    glm::mat4 viewProj;         // frustum to test against
+    LodView view;               // camera for the LOD
+    unsigned int modelLimit;    // models from here on are skipped
+    bool impostors;
+    // Chunks not hidden by the occlusion buffer, NULL for all. Only the
+    // first GPUCULL_MASK_CHUNKS can be culled.
+    const std::vector<char>* visibleChunks = NULL;
+};
+
+// The six planes of viewProj, normalized, inside positive.
+inline void frustumPlanes(const glm::mat4 &m, glm::vec4* planes) {
+    for (int i = 0; i < 3; ++i) {
+        glm::vec4 row(m[0][i], m[1][i], m[2][i], m[3][i]);
+        glm::vec4 w(m[0][3], m[1][3], m[2][3], m[3][3]);
+        planes[2*i] = w + row;
+        planes[2*i + 1] = w - row;
+    }
+    for (int p = 0; p < 6; ++p)
+        planes[p] = planes[p] / glm::length(glm::vec3(planes[p]));
+}
+
+class GpuCuller {
+public:
+    static bool supported() {
+        return GLEW_VERSION_4_3 && VegetationBatch::supported();
+    }
+
+    bool enabled() const {
+        return ready() && bGpuCull;
+    }
+
+    // init() succeeded.
+    bool ready() const {
+        return program != NULL;
+    }
+
+    // Lay out commands for the models of batch. impostors[i] is the
+    // impostor of model i, if loaded.
+    bool init(const VegetationBatch &batch, const std::vector<Model*> &models, std::vector<Impostor>* impostors) {
+        if (!supported()) {
+            std::cout << "gpucull: needs GL 4.3, culling on the CPU" << std::endl;
+            return false;
+        }
+        const std::vector<std::vector<VegetationBatch::Part> > &parts = batch.layout();
+        infos.assign(models.size(), ModelInfo());
+        layers.clear();
+        for (unsigned int m = 0; m < models.size(); ++m) {
+            ModelInfo &info = infos[m];
+            info.bounds = glm::vec4(models[m]->boundsCenter, models[m]->boundsRadius);
+            info.lods = glm::uvec4(std::min(models[m]->lodLevels(), (unsigned int)MAX_LODS), layers.size(),
+                                   parts[m].size(), GPUCULL_NO_IMPOSTOR);
+            if (impostors && m < impostors->size() && (*impostors)[m].loaded())
+                info.lods.w = m;
+            for (unsigned int k = 0; k < parts[m].size(); ++k)
+                layers.push_back(parts[m][k].layer);
+        }
+        this->parts = parts;
+        this->impostors = impostors;
+        program = new Shader("assets/shaders/cull.cs");
+        glGenBuffers(BUFFERS, buffers);
+        upload(MODELS, infos.size() * sizeof(ModelInfo), &infos[0], GL_STATIC_DRAW);
+        upload(LAYERS, layers.size() * sizeof(GLint), layers.empty() ? NULL : &layers[0], GL_STATIC_DRAW);
+        std::cout << "gpucull: " << models.size() << " models" << std::endl;
+        return true;
+    }
+
+    // Objects of all loaded chunks. Resets their LODs.
+    void setCandidates(const std::vector<CullCandidate> &all) {
+        if (program == NULL)
+            return;
+        candidates = all;
+        lods.assign(candidates.size(), 0);
+        // runs sized by the instances of each model
+        std::vector<unsigned int> perModel(infos.size(), 0);
+        for (unsigned int i = 0; i < candidates.size(); ++i)
+            ++perModel[candidates[i].model];
+        commands.clear();
+        impostorCommands.clear();
+        instanceCapacity = 0;
+        impostorCapacity = 0;
+        for (unsigned int m = 0; m < infos.size(); ++m) {
+            ModelInfo &info = infos[m];
+            info.region.x = commands.size();
+            for (unsigned int k = 0; k < parts[m].size(); ++k)
+                for (unsigned int l = 0; l < info.lods.x; ++l) {
+                    const VegetationBatch::Part &part = parts[m][k];
+                    unsigned int level = std::min(l, (unsigned int)part.lodCount.size() - 1);
+                    DrawElementsIndirectCommand command;
+                    command.count = part.lodCount[level];
+                    command.instanceCount = 0;
+                    command.firstIndex = part.firstIndex + part.lodStart[level];
+                    command.baseVertex = part.baseVertex;
+                    command.baseInstance = instanceCapacity;
+                    commands.push_back(command);
+                    instanceCapacity += perModel[m];
+                }
+        }
+        if (impostors)
+            for (unsigned int m = 0; m < impostors->size() && m < infos.size(); ++m) {
+                DrawArraysIndirectCommand command = { 4, 0, 0, impostorCapacity };
+                impostorCommands.push_back(command);
+                impostorCapacity += perModel[m];
+            }
+        upload(MODELS, infos.size() * sizeof(ModelInfo), &infos[0], GL_STATIC_DRAW);
+        upload(CANDIDATES, candidates.size() * sizeof(CullCandidate), candidates.empty() ? NULL : &candidates[0], GL_STATIC_DRAW);
+        upload(LODS, lods.size() * sizeof(GLuint), lods.empty() ? NULL : &lods[0], GL_DYNAMIC_COPY);
+        upload(COMMAND_TEMPLATE, commands.size() * sizeof(DrawElementsIndirectCommand), commands.empty() ? NULL : &commands[0], GL_STATIC_DRAW);
+        upload(COMMANDS, commands.size() * sizeof(DrawElementsIndirectCommand), NULL, GL_DYNAMIC_COPY);
+        upload(INSTANCES, std::max(instanceCapacity, 1u) * sizeof(BatchInstance), NULL, GL_DYNAMIC_COPY);
+        upload(IMPOSTOR_TEMPLATE, impostorCommands.size() * sizeof(DrawArraysIndirectCommand),
+               impostorCommands.empty() ? NULL : &impostorCommands[0], GL_STATIC_DRAW);
+        upload(IMPOSTOR_COMMANDS, impostorCommands.size() * sizeof(DrawArraysIndirectCommand), NULL, GL_DYNAMIC_COPY);
+        upload(IMPOSTOR_INSTANCES, std::max(impostorCapacity, 1u) * sizeof(glm::vec4), NULL, GL_DYNAMIC_COPY);
+    }
+
+    // Fill the commands and instance runs for one pass.
+    void cull(const CullParams &params) {
+        if (!enabled() || candidates.empty())
+            return;
+        copy(COMMAND_TEMPLATE, COMMANDS, commands.size() * sizeof(DrawElementsIndirectCommand));
+        copy(IMPOSTOR_TEMPLATE, IMPOSTOR_COMMANDS, impostorCommands.size() * sizeof(DrawArraysIndirectCommand));
+        glm::vec4 planes[6];
+        frustumPlanes(params.viewProj, planes);
+        program->use();
+        glUniform1ui(glGetUniformLocation(program->ID, "candidateCount"), candidates.size());
+        glUniform1ui(glGetUniformLocation(program->ID, "modelLimit"), params.modelLimit);
+        glUniform4fv(glGetUniformLocation(program->ID, "planes"), 6, &planes[0][0]);
+        program->setVec3("eye", params.view.eye);
+        program->setFloat("projScale", params.view.projScale);
+        program->setBool("lodEnabled", bLodEnabled);
+        glUniform1fv(glGetUniformLocation(program->ID, "lodScreenSizes"), MAX_LODS - 1, lodScreenSizes);
+        program->setFloat("lodBand", lodBand);
+        program->setBool("impostors", params.impostors && bImpostors && !impostorCommands.empty());
+        program->setFloat("impostorScreenSize", impostorScreenSize);
+        program->setFloat("impostorBand", impostorBand);
+        GLuint mask[GPUCULL_MASK_CHUNKS / 32];
+        chunkMask(params, mask);
+        glUniform1uiv(glGetUniformLocation(program->ID, "chunkMask"), GPUCULL_MASK_CHUNKS / 32, mask);
+        RENDER_COUNT(uniforms, 5);  // the glUniform calls above
+        // the first eight buffers are bound at their index
+        for (int b = CANDIDATES; b <= IMPOSTOR_INSTANCES; ++b)
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, b, buffers[b]);
+        glDispatchCompute((candidates.size() + GPUCULL_GROUP - 1) / GPUCULL_GROUP, 1, 1);
+        glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+    }
+
+    // Draw what the last cull() kept.
+    void draw(Shader &shader, VegetationBatch &batch) {
+        if (!enabled() || commands.empty())
+            return;
+        shader.use();
+        batch.drawIndirect(shader, buffers[INSTANCES], buffers[COMMANDS], commands.size());
+    }
+
+    // And the impostors the last cull() with impostors queued.
+    void drawImpostors(Shader &shader) {
+        if (!enabled() || !impostors)
+            return;
+        for (unsigned int m = 0; m < impostorCommands.size(); ++m)
+            if ((*impostors)[m].loaded())
+                (*impostors)[m].flushIndirect(shader, buffers[IMPOSTOR_INSTANCES], buffers[IMPOSTOR_COMMANDS],
+                                              m * sizeof(DrawArraysIndirectCommand));
+    }
+
+    // cull.cs on the CPU, from and into CPU copies of the same buffers.
+    // lodState is the LOD of every candidate, updated like on the GPU.
+    void cullReference(const CullParams &params, std::vector<GLuint> &lodState,
+                       std::vector<DrawElementsIndirectCommand> &outCommands, std::vector<BatchInstance> &outInstances,
+                       std::vector<DrawArraysIndirectCommand> &outImpostorCommands,
+                       std::vector<glm::vec4> &outImpostorInstances) const {
+        outCommands = commands;
+        outImpostorCommands = impostorCommands;
+        outInstances.assign(instanceCapacity, BatchInstance());
+        outImpostorInstances.assign(impostorCapacity, glm::vec4(0.0f));
+        glm::vec4 planes[6];
+        frustumPlanes(params.viewProj, planes);
+        bool useImpostors = params.impostors && bImpostors && !impostorCommands.empty();
+        GLuint mask[GPUCULL_MASK_CHUNKS / 32];
+        chunkMask(params, mask);
+        for (unsigned int i = 0; i < candidates.size(); ++i) {
+            const CullCandidate &candidate = candidates[i];
+            unsigned int m = candidate.model;
+            if (m >= params.modelLimit)
+                continue;
+            const ModelInfo &info = infos[m];
+            float c = cos(candidate.placement.w), s = sin(candidate.placement.w);
+            glm::vec3 b(info.bounds);
+            glm::vec3 centre = glm::vec3(candidate.placement) + glm::vec3(c*b.x + s*b.z, b.y, c*b.z - s*b.x);
+            float radius = info.bounds.w;
+            int lod = selectLod(screenSize(params.view, centre, radius), lodState[i], info.lods.x);
+            lodState[i] = lod;
+            if (candidate.chunk < GPUCULL_MASK_CHUNKS && !(mask[candidate.chunk / 32] & (1u << (candidate.chunk % 32))))
+                continue;
+            bool inside = true;
+            for (int p = 0; p < 6; ++p)
+                if (glm::dot(glm::vec3(planes[p]), centre) + planes[p].w < -radius)
+                    inside = false;
+            if (!inside)
+                continue;
+            float fade = 1.0f;
+            if (useImpostors && info.lods.w != GPUCULL_NO_IMPOSTOR) {
+                fade = impostorMeshFade(screenSize(params.view, centre, radius));
+                if (fade < 1.0f) {
+                    DrawArraysIndirectCommand &command = outImpostorCommands[info.lods.w];
+                    outImpostorInstances[command.baseInstance + command.instanceCount++] = glm::vec4(centre, fade);
+                    if (fade <= 0.0f)
+                        continue;
+                }
+            }
+            for (unsigned int k = 0; k < info.lods.z; ++k) {
+                DrawElementsIndirectCommand &command = outCommands[info.region.x + k*info.lods.x + lod];
+                BatchInstance &instance = outInstances[command.baseInstance + command.instanceCount++];
+                instance.placement = candidate.placement;
+                instance.fade = fade;
+                instance.layer = layers[info.lods.y + k];
+            }
+        }
+    }
+
+    // What the last cull() left on the GPU.
+    void readBack(std::vector<GLuint> &lodState, std::vector<DrawElementsIndirectCommand> &outCommands,
+                  std::vector<BatchInstance> &outInstances, std::vector<DrawArraysIndirectCommand> &outImpostorCommands,
+                  std::vector<glm::vec4> &outImpostorInstances) const {
+        lodState.resize(lods.size());
+        outCommands.resize(commands.size());
+        outInstances.resize(instanceCapacity);
+        outImpostorCommands.resize(impostorCommands.size());
+        outImpostorInstances.resize(impostorCapacity);
+        download(LODS, lodState);
+        download(COMMANDS, outCommands);
+        download(INSTANCES, outInstances);
+        download(IMPOSTOR_COMMANDS, outImpostorCommands);
+        download(IMPOSTOR_INSTANCES, outImpostorInstances);
+    }
+
+    // Current LOD of every candidate, as uploaded by setCandidates.
+    const std::vector<GLuint>& initialLods() const {
+        return lods;
+    }
+
+private:
+    // One bit per chunk, set if it may be seen.
+    static void chunkMask(const CullParams &params, GLuint* mask) {
+        for (int w = 0; w < GPUCULL_MASK_CHUNKS / 32; ++w)
+            mask[w] = 0xffffffffu;
+        if (!params.visibleChunks)
+            return;
+        for (unsigned int c = 0; c < params.visibleChunks->size() && c < GPUCULL_MASK_CHUNKS; ++c)
+            if (!(*params.visibleChunks)[c])
+                mask[c / 32] &= ~(1u << (c % 32));
+    }
+
+    // cull.cs's ModelInfo
+    struct ModelInfo {
+        glm::vec4 bounds;  // centre, radius
+        glm::uvec4 lods;   // levels, first part, parts, impostor
+        glm::uvec4 region; // first command
+    };
+
+    enum {
+        CANDIDATES, LODS, MODELS, LAYERS, COMMANDS, INSTANCES, IMPOSTOR_COMMANDS, IMPOSTOR_INSTANCES,
+        COMMAND_TEMPLATE, IMPOSTOR_TEMPLATE, BUFFERS
+    };
+
+    Shader* program = NULL;
+    unsigned int buffers[BUFFERS];
+    std::vector<std::vector<VegetationBatch::Part> > parts;
+    std::vector<Impostor>* impostors = NULL;
+    std::vector<ModelInfo> infos;
+    std::vector<GLint> layers;
+    std::vector<CullCandidate> candidates;
+    std::vector<GLuint> lods;
+    std::vector<DrawElementsIndirectCommand> commands;          // templates, no instances
+    std::vector<DrawArraysIndirectCommand> impostorCommands;
+    unsigned int instanceCapacity = 0;
+    unsigned int impostorCapacity = 0;
+
+    void upload(int buffer, size_t bytes, const void* data, GLenum usage) {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[buffer]);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, std::max(bytes, (size_t)16), NULL, usage);
+        if (data)
+            counted::bufferSubData(GL_SHADER_STORAGE_BUFFER, 0, bytes, data);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    void copy(int from, int to, size_t bytes) {
+        if (bytes == 0)
+            return;
+        glBindBuffer(GL_COPY_READ_BUFFER, buffers[from]);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffers[to]);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, bytes);
+    }
+
+    template <typename T>
+    void download(int buffer, std::vector<T> &out) const {
+        if (out.empty())
+            return;
+        // the cull's shader storage writes, made visible to buffer reads
+        glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[buffer]);
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, out.size() * sizeof(T), &out[0]);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+};
+
+// Compare cull.cs with cullReference on random scenes of models and views.
+// Runs need the same instances per command and the same LODs; the order in
+// a run is whatever the atomics gave, so runs are sorted first.
+inline bool checkGpuCull(GpuCuller &culler, unsigned int models, unsigned int largeCount, unsigned int seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::vector<CullCandidate> candidates(20000);
+    for (unsigned int i = 0; i < candidates.size(); ++i) {
+        candidates[i].placement = glm::vec4(800.0f*unit(rng) - 400.0f, 30.0f*unit(rng) - 15.0f,
+                                            800.0f*unit(rng) - 400.0f, 6.2831853f*unit(rng));
+        candidates[i].model = rng() % models;
+        candidates[i].chunk = rng() % 25;
+    }
+    culler.setCandidates(candidates);
+    std::vector<GLuint> lodState = culler.initialLods();
+    bool ok = true;
+    for (int frame = 0; frame < 8; ++frame) {
+        glm::vec3 eye(600.0f*unit(rng) - 300.0f, 5.0f + 40.0f*unit(rng), 600.0f*unit(rng) - 300.0f);
+        glm::vec3 target = eye + glm::vec3(unit(rng) - 0.5f, 0.2f*unit(rng) - 0.15f, unit(rng) - 0.5f);
+        float fovy = glm::radians(30.0f + 40.0f*unit(rng));
+        CullParams params;
+        params.viewProj = glm::perspective(fovy, 16.0f / 9.0f, 0.1f, 1000.0f) *
+                          glm::lookAt(eye, target, glm::vec3(0.0f, 1.0f, 0.0f));
+        params.view.eye = eye;
+        params.view.projScale = 1.0f / tan(fovy * 0.5f);
+        // odd frames are shadow passes: trees only, no impostors
+        params.modelLimit = frame % 2 ? largeCount : models;
+        params.impostors = frame % 2 == 0;
+        // and every other camera pass hides some chunks
+        std::vector<char> visible(25);
+        for (unsigned int c = 0; c < visible.size(); ++c)
+            visible[c] = unit(rng) < 0.6f;
+        if (frame % 4 == 2)
+            params.visibleChunks = &visible;
+
+        std::vector<DrawElementsIndirectCommand> refCommands, gpuCommands;
+        std::vector<BatchInstance> refInstances, gpuInstances;
+        std::vector<DrawArraysIndirectCommand> refImpostors, gpuImpostors;
+        std::vector<glm::vec4> refImpostorInstances, gpuImpostorInstances;
+        std::vector<GLuint> gpuLods;
+        culler.cullReference(params, lodState, refCommands, refInstances, refImpostors, refImpostorInstances);
+        culler.cull(params);
+        culler.readBack(gpuLods, gpuCommands, gpuInstances, gpuImpostors, gpuImpostorInstances);
+
+        unsigned int lodMismatches = 0, countMismatches = 0, instanceMismatches = 0, kept = 0;
+        for (unsigned int i = 0; i < lodState.size(); ++i)
+            lodMismatches += lodState[i] != gpuLods[i];
+        for (unsigned int c = 0; c < refCommands.size(); ++c) {
+            const DrawElementsIndirectCommand &ref = refCommands[c], &gpu = gpuCommands[c];
+            if (ref.instanceCount != gpu.instanceCount || ref.count != gpu.count || ref.baseInstance != gpu.baseInstance) {
+                ++countMismatches;
+                continue;
+            }
+            kept += ref.instanceCount;
+            std::vector<std::vector<float> > a, b;
+            for (unsigned int k = 0; k < ref.instanceCount; ++k) {
+                const BatchInstance &x = refInstances[ref.baseInstance + k], &y = gpuInstances[gpu.baseInstance + k];
+                a.push_back({ x.placement.x, x.placement.y, x.placement.z, x.placement.w, x.fade, (float)x.layer });
+                b.push_back({ y.placement.x, y.placement.y, y.placement.z, y.placement.w, y.fade, (float)y.layer });
+            }
+            std::sort(a.begin(), a.end());
+            std::sort(b.begin(), b.end());
+            for (unsigned int k = 0; k < a.size(); ++k)
+                for (int f = 0; f < 6; ++f)
+                    if (fabs(a[k][f] - b[k][f]) > 1e-3f) {
+                        ++instanceMismatches;
+                        break;
+                    }
+        }
+        unsigned int impostorKept = 0;
+        for (unsigned int c = 0; c < refImpostors.size(); ++c) {
+            if (refImpostors[c].instanceCount != gpuImpostors[c].instanceCount) {
+                ++countMismatches;
+                continue;
+            }
+            impostorKept += refImpostors[c].instanceCount;
+            std::vector<std::vector<float> > a, b;
+            for (unsigned int k = 0; k < refImpostors[c].instanceCount; ++k) {
+                const glm::vec4 &x = refImpostorInstances[refImpostors[c].baseInstance + k];
+                const glm::vec4 &y = gpuImpostorInstances[gpuImpostors[c].baseInstance + k];
+                a.push_back({ x.x, x.y, x.z, x.w });
+                b.push_back({ y.x, y.y, y.z, y.w });
+            }
+            std::sort(a.begin(), a.end());
+            std::sort(b.begin(), b.end());
+            for (unsigned int k = 0; k < a.size(); ++k)
+                for (int f = 0; f < 4; ++f)
+                    if (fabs(a[k][f] - b[k][f]) > 1e-3f) {
+                        ++instanceMismatches;
+                        break;
+                    }
+        }
+        std::cout << "gpucull check, view " << frame << ": " << kept << " mesh instances, " << impostorKept
+                  << " impostors; mismatched LODs " << lodMismatches << ", commands " << countMismatches
+                  << ", instances " << instanceMismatches << std::endl;
+        // the GPU's state carries on, so one mismatch doesn't cascade
+        lodState = gpuLods;
+        ok = ok && lodMismatches == 0 && countMismatches == 0 && instanceMismatches == 0;
+    }
+    std::cout << "gpucull check " << (ok ? "passed" : "FAILED") << std::endl;
+    return ok;
+}
+
+// --check-gpu-cull: checkGpuCull on the real models, in a headless GL 4.3
+// context (llvmpipe works). Returns true if asked; status is what the
+// program should exit with.
+inline bool runGpuCullCheck(int argc, char** argv, const std::vector<std::string> &large,
+                            const std::vector<std::string> &small, int &status) {
+    bool asked = false;
+    for (int i = 1; i < argc; ++i)
+        asked = asked || std::string(argv[i]) == "--check-gpu-cull";
+    if (!asked)
+        return false;
+    status = 1;
+    HeadlessContext context;
+    if (!context.create(4, 3))
+        return true;
+    std::vector<Model> models(large.size() + small.size());
+    std::vector<Model*> pointers;
+    for (unsigned int m = 0; m < models.size(); ++m) {
+        models[m].loadModel(m < large.size() ? large[m] : small[m - large.size()]);
+        models[m].upload();
+        pointers.push_back(&models[m]);
+    }
+    std::vector<Impostor> impostors(large.size());
+    for (unsigned int m = 0; m < large.size(); ++m)
+        impostors[m].load(large[m], models[m]);
+    VegetationBatch batch;
+    GpuCuller culler;
+    if (!batch.build(pointers) || !culler.init(batch, pointers, &impostors)) {
+        std::cout << "gpucull check: the culler could not be set up" << std::endl;
+        return true;
+    }
+    status = checkGpuCull(culler, models.size(), large.size(), 1234) ? 0 : 1;
+    return true;
+}
+
+#endif
@@ -0,0 +1,199 @@
+// GPU time of the render passes.
+//
+//     {
+//         GPU_ZONE("shadow pass");
+//         ...
+//
+// A zone puts a timestamp query (glQueryCounter) before and after its
+// commands. Every pass has GPU_TIMER_FRAMES sets of queries, used in turn,
+// and a set is only read when its turn comes again, that many frames
+// later: by then the GPU is normally done with it, and if it isn't the
+// sample is dropped rather than waited for. Zones may nest.
+//
+// Every pass keeps its last GPU_TIMER_HISTORY times for the average and
+// 99th percentile shown on the HUD. The times also go to the profiler's
+// "GPU" track, shifted onto the CPU clock.
+
+#ifndef gputimer_h
+#define gputimer_h
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+
+#include "profiler.h"
+
+#define GPU_TIMER_FRAMES 3      // frames before a result is read
+#define GPU_TIMER_HISTORY 240   // samples behind average and p99
+
+// Set to false to stop issuing queries.
+bool bGpuTimers = true;
+
+// Milliseconds of one pass over the history.
+struct GpuPassStats {
+    const char* name;
+    double last;
+    double average;
+    double p99;
+    unsigned int samples;
+};
+
+class GpuTimers {
+public:
+    static bool supported() {
+        return GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+    }
+
+    bool enabled() const {
+        return bGpuTimers && supported();
+    }
+
+    // Read the queries of GPU_TIMER_FRAMES frames ago, then start a frame.
+    void beginFrame() {
+        if (!enabled())
+            return;
+        if (!synced)
+            sync();
+        frame = (frame + 1) % GPU_TIMER_FRAMES;
+        for (unsigned int p = 0; p < passes.size(); ++p) {
+            Pass &pass = passes[p];
+            if (!pass.issued[frame])
+                continue;
+            pass.issued[frame] = false;
+            GLint available = 0;
+            glGetQueryObjectiv(pass.queries[frame][1], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available) {
+                ++dropped;
+                continue;
+            }
+            GLuint64 start = 0, end = 0;
+            glGetQueryObjectui64v(pass.queries[frame][0], GL_QUERY_RESULT, &start);
+            glGetQueryObjectui64v(pass.queries[frame][1], GL_QUERY_RESULT, &end);
+            double millis = (end - start) / 1e6;
+            if (pass.history.size() < GPU_TIMER_HISTORY)
+                pass.history.push_back(millis);
+            else
+                pass.history[pass.next] = millis;
+            pass.next = (pass.next + 1) % GPU_TIMER_HISTORY;
+            pass.last = millis;
+            track->push(pass.name, start + offset, end + offset);
+        }
+    }
+
+    void begin(const char* name) {
+        if (!enabled())
+            return;
+        Pass &pass = find(name);
+        glQueryCounter(pass.queries[frame][0], GL_TIMESTAMP);
+        pass.began = true;
+    }
+
+    void end(const char* name) {
+        if (!enabled())
+            return;
+        Pass &pass = find(name);
+        if (!pass.began)
+            return;
+        glQueryCounter(pass.queries[frame][1], GL_TIMESTAMP);
+        pass.issued[frame] = true;
+        pass.began = false;
+    }
+
+    std::vector<GpuPassStats> stats() const {
+        std::vector<GpuPassStats> out;
+        for (unsigned int p = 0; p < passes.size(); ++p) {
+            const Pass &pass = passes[p];
+            GpuPassStats stats = { pass.name, pass.last, 0.0, 0.0, (unsigned int)pass.history.size() };
+            if (!pass.history.empty()) {
+                std::vector<double> sorted = pass.history;
+                std::sort(sorted.begin(), sorted.end());
+                for (unsigned int s = 0; s < sorted.size(); ++s)
+                    stats.average += sorted[s];
+                stats.average /= sorted.size();
+                stats.p99 = sorted[std::min((size_t)(sorted.size() * 0.99), sorted.size() - 1)];
+            }
+            out.push_back(stats);
+        }
+        return out;
+    }
+
+    // Results that were not in when their turn came.
+    unsigned int droppedSamples() const {
+        return dropped;
+    }
+
+private:
+    struct Pass {
+        const char* name;
+        GLuint queries[GPU_TIMER_FRAMES][2];
+        bool issued[GPU_TIMER_FRAMES];
+        bool began;
+        std::vector<double> history;
+        unsigned int next;
+        double last;
+    };
+    std::vector<Pass> passes;
+    int frame = 0;
+    unsigned int dropped = 0;
+    bool synced = false;
+    int64_t offset = 0;     // GPU timestamp to profilerNanos()
+    ProfileRing* track = NULL;
+
+    // Passes are few, a scan is enough. Names are compared by content so
+    // the same literal in two files is one pass.
+    Pass& find(const char* name) {
+        for (unsigned int p = 0; p < passes.size(); ++p)
+            if (passes[p].name == name || std::strcmp(passes[p].name, name) == 0)
+                return passes[p];
+        Pass pass;
+        pass.name = name;
+        glGenQueries(2 * GPU_TIMER_FRAMES, &pass.queries[0][0]);
+        for (int f = 0; f < GPU_TIMER_FRAMES; ++f)
+            pass.issued[f] = false;
+        pass.began = false;
+        pass.next = 0;
+        pass.last = 0.0;
+        passes.push_back(pass);
+        return passes.back();
+    }
+
+    // Line up the GPU clock with the CPU one, once. They drift apart
+    // slowly, which is fine for looking at a trace.
+    void sync() {
+        GLint64 now = 0;
+        glGetInteger64v(GL_TIMESTAMP, &now);
+        offset = (int64_t)profilerNanos() - now;
+        track = &profiler().timeline("GPU");
+        synced = true;
+    }
+};
+
+inline GpuTimers& gpuTimers() {
+    static GpuTimers timers;
+    return timers;
+}
+
+// Times the GPU commands issued from construction to destruction.
+class GpuZone {
+public:
+    explicit GpuZone(const char* zone) : name(zone) {
+        gpuTimers().begin(name);
+    }
+
+    ~GpuZone() {
+        gpuTimers().end(name);
+    }
+
+private:
+    const char* name;
+};
+
+#if PROFILER_ENABLED
+#define GPU_ZONE(name) GpuZone PROFILE_CONCAT(gpuZone, __LINE__)(name)
+#else
+#define GPU_ZONE(name)
+#endif
+
+#endif
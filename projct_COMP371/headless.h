@@ -0,0 +1,133 @@
+// GL context without a window, for the offline tools (--bake-impostors).
+//
+// On Linux this is an EGL context with no surface at all, on Mesa's
+// surfaceless platform, so it needs no X or Wayland display and runs on
+// llvmpipe in CI (LIBGL_ALWAYS_SOFTWARE=1 forces it on machines with a GPU).
+// Everything is drawn into framebuffer objects. Anywhere else, or if EGL
+// fails, it falls back to a hidden GLFW window. Define NO_EGL to build
+// without libEGL.
+
+#ifndef headless_h
+#define headless_h
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+#include <iostream>
+
+#if defined(__linux__) && !defined(NO_EGL)
+#define HEADLESS_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+class HeadlessContext {
+public:
+    ~HeadlessContext() {
+        destroy();
+    }
+
+    // Make a core profile context of at least major.minor current.
+    bool create(int major, int minor) {
+#ifdef HEADLESS_EGL
+        if (createEGL(major, minor))
+            return initGlew(true);
+        std::cout << "headless: no surfaceless EGL context, trying a hidden window" << std::endl;
+#endif
+        if (!glfwInit())
+            return false;
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, major);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, minor);
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+#ifdef __APPLE__
+        glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+#endif
+        glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+        window = glfwCreateWindow(64, 64, "headless", NULL, NULL);
+        if (window == NULL) {
+            std::cout << "headless: failed to create a hidden window" << std::endl;
+            glfwTerminate();
+            return false;
+        }
+        glfwMakeContextCurrent(window);
+        return initGlew(false);
+    }
+
+    void destroy() {
+#ifdef HEADLESS_EGL
+        if (context != EGL_NO_CONTEXT) {
+            eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+            eglDestroyContext(display, context);
+            eglTerminate(display);
+            context = EGL_NO_CONTEXT;
+        }
+#endif
+        if (window) {
+            glfwDestroyWindow(window);
+            glfwTerminate();
+            window = NULL;
+        }
+    }
+
+private:
+    GLFWwindow* window = NULL;
+
+    bool initGlew(bool egl) {
+        glewExperimental = true;
+        // glewInit() also loads the window system entry points (GLX or WGL),
+        // which fails with an EGL context unless GLEW was built for EGL.
+        GLenum status = egl ? glewContextInit() : glewInit();
+        if (status != GLEW_OK) {
+            std::cout << "headless: failed to initialize GLEW" << std::endl;
+            return false;
+        }
+        std::cout << "headless: " << glGetString(GL_RENDERER) << ", " << glGetString(GL_VERSION) << std::endl;
+        return true;
+    }
+
+#ifdef HEADLESS_EGL
+    EGLDisplay display = EGL_NO_DISPLAY;
+    EGLContext context = EGL_NO_CONTEXT;
+
+    bool createEGL(int major, int minor) {
+        PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+            (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+        if (getPlatformDisplay)
+            display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+        if (display == EGL_NO_DISPLAY)
+            display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+        EGLint eglMajor, eglMinor;
+        if (display == EGL_NO_DISPLAY || !eglInitialize(display, &eglMajor, &eglMinor))
+            return false;
+        if (!eglBindAPI(EGL_OPENGL_API)) {
+            eglTerminate(display);
+            return false;
+        }
+        // the surfaceless platform has no window configs, only pbuffer ones
+        const EGLint configAttribs[] = { EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_NONE };
+        EGLConfig config;
+        EGLint configs = 0;
+        if (!eglChooseConfig(display, configAttribs, &config, 1, &configs) || configs == 0) {
+            eglTerminate(display);
+            return false;
+        }
+        const EGLint contextAttribs[] = {
+            EGL_CONTEXT_MAJOR_VERSION, major,
+            EGL_CONTEXT_MINOR_VERSION, minor,
+            EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+            EGL_NONE
+        };
+        context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttribs);
+        if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+            if (context != EGL_NO_CONTEXT)
+                eglDestroyContext(display, context);
+            context = EGL_NO_CONTEXT;
+            eglTerminate(display);
+            return false;
+        }
+        return true;
+    }
+#endif
+};
+
+#endif
@@ -0,0 +1,126 @@
+// Debug text drawn over the frame.
+//
+//     hud().print("color pass 1.20 ms");
+//     ...
+//     hud().draw(sWIDTH, sHEIGHT);
+//
+// Lines printed during a frame are drawn top left, white on a dark band,
+// with the bitmap font of hudfont.h, then forgotten. The quads go through
+// one buffer refilled every frame.
+
+#ifndef hud_h
+#define hud_h
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "hudfont.h"
+#include "shader.h"
+
+// Toggled with U.
+bool bHud = false;
+
+class Hud {
+public:
+    void print(const std::string &line) {
+        lines.push_back(line);
+    }
+
+    // Draws the lines printed since the last draw, on top of whatever is in
+    // the framebuffer. Leaves depth testing on and blending off.
+    void draw(int width, int height) {
+        if (lines.empty())
+            return;
+        if (!shader)
+            init();
+        std::vector<float> vertices;
+        float lineHeight = HUD_GLYPH_HEIGHT + 2.0f;
+        unsigned int longest = 0;
+        for (unsigned int l = 0; l < lines.size(); ++l)
+            longest = std::max(longest, (unsigned int)lines[l].size());
+        // the dark band behind the text is the atlas' solid glyph
+        quad(vertices, 0.0f, 0.0f, (longest + 1) * HUD_GLYPH_WIDTH, lines.size() * lineHeight + 4.0f,
+             HUD_CHAR_COUNT);
+        unsigned int background = vertices.size();
+        for (unsigned int l = 0; l < lines.size(); ++l) {
+            for (unsigned int c = 0; c < lines[l].size(); ++c) {
+                int glyph = (unsigned char)lines[l][c] - HUD_FIRST_CHAR;
+                if (glyph <= 0 || glyph >= HUD_CHAR_COUNT)
+                    continue;
+                float x = (c + 0.5f) * HUD_GLYPH_WIDTH, y = l * lineHeight + 2.0f;
+                quad(vertices, x, y, x + HUD_GLYPH_WIDTH, y + HUD_GLYPH_HEIGHT, glyph);
+            }
+        }
+        lines.clear();
+
+        counted::bindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        counted::bufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), &vertices[0], GL_STREAM_DRAW);
+        glDisable(GL_DEPTH_TEST);
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        shader->use();
+        shader->setVec2("screenSize", glm::vec2((float)width, (float)height));
+        shader->setInt("font", 0);
+        glActiveTexture(GL_TEXTURE0);
+        counted::bindTexture(GL_TEXTURE_2D, atlas);
+        shader->setVec4("color", glm::vec4(0.0f, 0.0f, 0.0f, 0.6f));
+        counted::drawArrays(GL_TRIANGLES, 0, background / 4);
+        shader->setVec4("color", glm::vec4(1.0f));
+        counted::drawArrays(GL_TRIANGLES, background / 4, (vertices.size() - background) / 4);
+        glDisable(GL_BLEND);
+        glEnable(GL_DEPTH_TEST);
+        glBindVertexArray(0);
+    }
+
+private:
+    std::vector<std::string> lines;
+    Shader* shader = NULL;
+    GLuint VAO = 0, VBO = 0, atlas = 0;
+
+    // Two triangles of (x, y, u, v), in pixels from the top left.
+    static void quad(std::vector<float> &out, float x0, float y0, float x1, float y1, int glyph) {
+        float u0 = (float)glyph / (HUD_CHAR_COUNT + 1), u1 = (float)(glyph + 1) / (HUD_CHAR_COUNT + 1);
+        float corners[6][4] = { { x0, y0, u0, 0.0f }, { x1, y0, u1, 0.0f }, { x0, y1, u0, 1.0f },
+                                { x1, y0, u1, 0.0f }, { x1, y1, u1, 1.0f }, { x0, y1, u0, 1.0f } };
+        out.insert(out.end(), &corners[0][0], &corners[0][0] + 24);
+    }
+
+    // The glyphs side by side in one row, then a solid one for the band.
+    void init() {
+        shader = new Shader("assets/shaders/hud.vs", "assets/shaders/hud.fs");
+        int width = (HUD_CHAR_COUNT + 1) * HUD_GLYPH_WIDTH;
+        std::vector<unsigned char> pixels(width * HUD_GLYPH_HEIGHT, 0);
+        for (int g = 0; g <= HUD_CHAR_COUNT; ++g)
+            for (int y = 0; y < HUD_GLYPH_HEIGHT; ++y)
+                for (int x = 0; x < HUD_GLYPH_WIDTH; ++x)
+                    if (g == HUD_CHAR_COUNT || hudFont[g][y] & (0x80 >> x))
+                        pixels[y * width + g * HUD_GLYPH_WIDTH + x] = 255;
+        glGenTextures(1, &atlas);
+        glBindTexture(GL_TEXTURE_2D, atlas);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, width, HUD_GLYPH_HEIGHT, 0, GL_RED, GL_UNSIGNED_BYTE, &pixels[0]);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glGenVertexArrays(1, &VAO);
+        glGenBuffers(1, &VBO);
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)0);
+        glBindVertexArray(0);
+    }
+};
+
+inline Hud& hud() {
+    static Hud instance;
+    return instance;
+}
+
+#endif
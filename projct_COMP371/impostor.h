@@ -0,0 +1,398 @@
+// Impostors for distant trees.
+//
+// --bake-impostors renders every tree species offscreen from IMPOSTOR_GRID^2
+// directions over the upper hemisphere, laid out hemi-octahedrally: cell
+// (x, y) of the atlas is the view from hemiOctDecode() of its centre. Two
+// atlases are written next to the model as baked textures (ctex.h):
+//   <model>.impostor.ctex         colour, alpha = coverage (BC3)
+//   <model>.impostor-normal.ctex  normal in xyz, depth in w (RGBA8)
+// The depth is along the view direction, 0 at radius in front of the centre
+// and 1 at radius behind it, so the runtime can put fragments back where the
+// mesh would have been and intersect the ground properly.
+//
+// At runtime an instance far enough away is drawn as a quad facing the
+// camera, textured with the view nearest to the camera direction. Between
+// the mesh and the impostor there is a band where both are drawn with
+// complementary dither patterns, so the switch is a crossfade, not a pop.
+//
+// The bake needs no window (headless.h), so the atlases can be made in CI.
+
+#ifndef impostor_h
+#define impostor_h
+
+#include <GL/glew.h>
+
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "ctex.h"
+#include "headless.h"
+#include "lod.h"
+#include "Model.h"
+#include "shader.h"
+#include "texcache.h"
+
+#define IMPOSTOR_GRID 8   // views per side of the atlas
+#define IMPOSTOR_CELL 128 // pixels per side of a view
+
+// Projected size (see screenSize in lod.h) below which trees turn into
+// impostors, and the crossfade band around it as a fraction of it.
+constexpr float impostorScreenSize = 0.15f;
+constexpr float impostorBand = 0.2f;
+static_assert(lodScreenSizes[MAX_LODS - 2] * (1.0f - lodBand) >= impostorScreenSize * (1.0f + impostorBand),
+              "the coarsest LOD must be reached before the impostor crossfade starts");
+
+// Set to false (key I, --no-impostors) to always draw meshes.
+bool bImpostors = true;
+
+inline std::string impostorColorPath(const std::string &model) {
+    return model + ".impostor.ctex";
+}
+
+inline std::string impostorNormalPath(const std::string &model) {
+    return model + ".impostor-normal.ctex";
+}
+
+// Unit direction for a point of the [-1, 1]^2 hemi-octahedral square, y up.
+inline glm::vec3 hemiOctDecode(glm::vec2 e) {
+    float x = (e.x + e.y) * 0.5f;
+    float z = (e.x - e.y) * 0.5f;
+    return glm::normalize(glm::vec3(x, 1.0f - std::fabs(x) - std::fabs(z), z));
+}
+
+// View direction (from the centre towards the camera) of an atlas cell.
+inline glm::vec3 impostorCellDirection(int x, int y) {
+    return hemiOctDecode(glm::vec2((x + 0.5f) / IMPOSTOR_GRID * 2.0f - 1.0f,
+                                   (y + 0.5f) / IMPOSTOR_GRID * 2.0f - 1.0f));
+}
+
+// How much of an instance is still the mesh: 1 above the band, 0 below it.
+inline float impostorMeshFade(float screenSize) {
+    if (!bImpostors)
+        return 1.0f;
+    float lo = impostorScreenSize * (1.0f - impostorBand);
+    float hi = impostorScreenSize * (1.0f + impostorBand);
+    return std::min(std::max((screenSize - lo) / (hi - lo), 0.0f), 1.0f);
+}
+
+class Impostor {
+public:
+    unsigned int color = 0;
+    unsigned int normal = 0;
+    glm::vec3 center = glm::vec3(0.0f);
+    float radius = 0.0f;
+
+    bool loaded() const {
+        return color != 0 && normal != 0;
+    }
+
+    // Load the atlases baked for the model at path. False if there are none.
+    bool load(const std::string &path, const Model &model) {
+        center = model.boundsCenter;
+        radius = model.boundsRadius;
+        color = loadAtlas(impostorColorPath(path), GL_LINEAR_MIPMAP_LINEAR);
+        normal = loadAtlas(impostorNormalPath(path), GL_NEAREST);
+        if (!loaded()) {
+            release();
+            std::cout << "impostor: no atlas for " << path << ", run --bake-impostors" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    void release() {
+        if (color)
+            textureCache().release(color);
+        if (normal)
+            textureCache().release(normal);
+        color = normal = 0;
+    }
+
+    // Queue an instance: world space centre of its bounds, and how much the
+    // mesh is drawn over it (see impostorMeshFade).
+    void add(glm::vec3 worldCenter, float meshFade) {
+        instances.push_back(glm::vec4(worldCenter, meshFade));
+    }
+
+    // Draw everything queued with one instanced call, then clear the queue.
+    // The shader's camera and lighting uniforms are the caller's.
+    void flush(Shader &shader) {
+        if (instances.empty())
+            return;
+        if (VAO == 0)
+            setup();
+        shader.setFloat("radius", radius);
+        shader.setInt("grid", IMPOSTOR_GRID);
+        glActiveTexture(GL_TEXTURE0);
+        counted::bindTexture(GL_TEXTURE_2D, color);
+        glActiveTexture(GL_TEXTURE2);
+        counted::bindTexture(GL_TEXTURE_2D, normal);
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        counted::bufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(glm::vec4), &instances[0], GL_STREAM_DRAW);
+        counted::bindVertexArray(VAO);
+        counted::drawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, (GLsizei)instances.size());
+        glBindVertexArray(0);
+        glActiveTexture(GL_TEXTURE0);
+        instances.clear();
+    }
+
+    // Draw with a DrawArraysIndirectCommand at commandOffset of commandBuffer
+    // whose instances (same vec4 as add()) are in instanceBuffer, both
+    // written by the GPU culler (see gpucull.h).
+    void flushIndirect(Shader &shader, unsigned int instanceBuffer, unsigned int commandBuffer, size_t commandOffset) {
+        if (VAO == 0)
+            setup();
+        shader.setFloat("radius", radius);
+        shader.setInt("grid", IMPOSTOR_GRID);
+        glActiveTexture(GL_TEXTURE0);
+        counted::bindTexture(GL_TEXTURE_2D, color);
+        glActiveTexture(GL_TEXTURE2);
+        counted::bindTexture(GL_TEXTURE_2D, normal);
+        counted::bindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+        glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)0);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+        counted::drawArraysIndirect(GL_TRIANGLE_STRIP, (void*)commandOffset);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)0);
+        glBindVertexArray(0);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+private:
+    std::vector<glm::vec4> instances;
+    unsigned int VAO = 0;
+    unsigned int quadVBO = 0;
+    unsigned int instanceVBO = 0;
+
+    // A baked atlas through the texture cache, so it shows up in the report.
+    static unsigned int loadAtlas(const std::string &path, GLint minFilter) {
+        CtexImage atlas;
+        if (!atlas.open(path))
+            return 0;
+        bool decode;
+        CachedTexture* entry = textureCache().request("impostor " + canonicalPath(path), path, decode);
+        if (!decode)
+            return entry->id;
+        unsigned int id;
+        glGenTextures(1, &id);
+        glBindTexture(GL_TEXTURE_2D, id);
+        for (unsigned int l = 0; l < atlas.header->levels; l++)
+            uploadBakedLevel(GL_TEXTURE_2D, atlas, l, GL_RGBA);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, atlas.header->levels - 1);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minFilter);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, minFilter == GL_NEAREST ? GL_NEAREST : GL_LINEAR);
+        size_t bytes = compressedFormat(atlas.header->format) ? atlas.dataBytes()
+                     : (size_t)atlas.header->level[0].width * atlas.header->level[0].height * 4 * 4 / 3;
+        textureCache().resident(entry, id, bytes);
+        return id;
+    }
+
+    void setup() {
+        // corners of the quad, in units of radius
+        float corners[] = { -1.0f, -1.0f,  1.0f, -1.0f,  -1.0f, 1.0f,  1.0f, 1.0f };
+        glGenVertexArrays(1, &VAO);
+        glGenBuffers(1, &quadVBO);
+        glGenBuffers(1, &instanceVBO);
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, quadVBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)0);
+        glVertexAttribDivisor(1, 1);
+        glBindVertexArray(0);
+    }
+};
+
+// Spread the colour of covered texels into the uncovered ones around them,
+// within each cell, so filtering and mips don't pull in black at the
+// silhouette. Coverage is the alpha of color; alpha itself is left alone.
+inline void dilateImpostor(std::vector<unsigned char> &color, std::vector<unsigned char> &normal, int size, int passes) {
+    std::vector<unsigned char> covered(size * size);
+    for (int i = 0; i < size * size; ++i)
+        covered[i] = color[i*4 + 3] > 0;
+    for (int pass = 0; pass < passes; ++pass) {
+        std::vector<unsigned char> next = covered;
+        for (int y = 0; y < size; ++y)
+            for (int x = 0; x < size; ++x) {
+                int i = y * size + x;
+                if (covered[i])
+                    continue;
+                int sum[8] = { 0 };
+                int count = 0;
+                const int dx[4] = { -1, 1, 0, 0 };
+                const int dy[4] = { 0, 0, -1, 1 };
+                for (int k = 0; k < 4; ++k) {
+                    int nx = x + dx[k], ny = y + dy[k];
+                    // stay inside the cell
+                    if (nx < 0 || ny < 0 || nx >= size || ny >= size ||
+                        nx / IMPOSTOR_CELL != x / IMPOSTOR_CELL || ny / IMPOSTOR_CELL != y / IMPOSTOR_CELL)
+                        continue;
+                    int n = ny * size + nx;
+                    if (!covered[n])
+                        continue;
+                    for (int c = 0; c < 3; ++c) {
+                        sum[c] += color[n*4 + c];
+                        sum[4 + c] += normal[n*4 + c];
+                    }
+                    sum[7] += normal[n*4 + 3];
+                    ++count;
+                }
+                if (count == 0)
+                    continue;
+                for (int c = 0; c < 3; ++c) {
+                    color[i*4 + c] = (unsigned char)(sum[c] / count);
+                    normal[i*4 + c] = (unsigned char)(sum[4 + c] / count);
+                }
+                normal[i*4 + 3] = (unsigned char)(sum[7] / count);
+                next[i] = 1;
+            }
+        covered.swap(next);
+    }
+}
+
+// Mip chain of an atlas, down to 4 pixels per cell, optionally compressed.
+inline bool writeImpostorAtlas(const std::string &path, std::vector<unsigned char> &pixels, int size, uint32_t format) {
+    std::vector<std::vector<unsigned char> > levels;
+    std::vector<int> sizes;
+    levels.push_back(pixels);
+    sizes.push_back(size);
+    for (int cell = IMPOSTOR_CELL; cell > 4; cell /= 2) {
+        levels.push_back(downsampleRGBA(levels.back(), sizes.back(), sizes.back()));
+        sizes.push_back(sizes.back() / 2);
+    }
+    if (format != CTEX_RGBA8)
+        for (unsigned int l = 0; l < levels.size(); ++l)
+            levels[l] = bcEncodeImage(&levels[l][0], sizes[l], sizes[l], ctexBcFormat(format));
+    return writeCtex(path, format, levels, sizes, sizes);
+}
+
+// Render the atlases of one model, which has to be loaded and uploaded.
+inline bool bakeImpostor(const std::string &path, Model &model, Shader &shader) {
+    using namespace std::chrono;
+    steady_clock::time_point t0 = steady_clock::now();
+    const int size = IMPOSTOR_GRID * IMPOSTOR_CELL;
+    if (model.meshes.empty() || model.boundsRadius <= 0.0f) {
+        std::cout << "impostor: nothing to bake in " << path << std::endl;
+        return false;
+    }
+
+    unsigned int fbo, depth, targets[2];
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glGenTextures(2, targets);
+    for (int t = 0; t < 2; ++t) {
+        glBindTexture(GL_TEXTURE_2D, targets[t]);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, size, size, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + t, GL_TEXTURE_2D, targets[t], 0);
+    }
+    glGenRenderbuffers(1, &depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, size, size);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+    GLenum buffers[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+    glDrawBuffers(2, buffers);
+    bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+
+    if (complete) {
+        glEnable(GL_DEPTH_TEST);
+        glDisable(GL_BLEND);
+        glViewport(0, 0, size, size);
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        shader.use();
+        float r = model.boundsRadius;
+        // depth 0..1 spans the bounding sphere along the view direction
+        glm::mat4 projection = glm::ortho(-r, r, -r, r, r, 3.0f * r);
+        shader.setMat4("projection", projection);
+        for (int y = 0; y < IMPOSTOR_GRID; ++y)
+            for (int x = 0; x < IMPOSTOR_GRID; ++x) {
+                glm::vec3 dir = impostorCellDirection(x, y);
+                glm::mat4 view = glm::lookAt(model.boundsCenter + dir * (2.0f * r), model.boundsCenter,
+                                             glm::vec3(0.0f, 1.0f, 0.0f));
+                shader.setMat4("view", view);
+                glViewport(x * IMPOSTOR_CELL, y * IMPOSTOR_CELL, IMPOSTOR_CELL, IMPOSTOR_CELL);
+                model.Draw(shader);
+            }
+    }
+
+    std::vector<unsigned char> color(size * size * 4), normal(size * size * 4);
+    if (complete) {
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glReadBuffer(GL_COLOR_ATTACHMENT0);
+        glReadPixels(0, 0, size, size, GL_RGBA, GL_UNSIGNED_BYTE, &color[0]);
+        glReadBuffer(GL_COLOR_ATTACHMENT1);
+        glReadPixels(0, 0, size, size, GL_RGBA, GL_UNSIGNED_BYTE, &normal[0]);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteRenderbuffers(1, &depth);
+    glDeleteTextures(2, targets);
+    glDeleteFramebuffers(1, &fbo);
+    if (!complete) {
+        std::cout << "impostor: incomplete framebuffer" << std::endl;
+        return false;
+    }
+    steady_clock::time_point t1 = steady_clock::now();
+
+    size_t coverage = 0;
+    for (int i = 0; i < size * size; ++i)
+        coverage += color[i*4 + 3] > 0;
+    dilateImpostor(color, normal, size, 8);
+    bool ok = writeImpostorAtlas(impostorColorPath(path), color, size, CTEX_BC3) &&
+              writeImpostorAtlas(impostorNormalPath(path), normal, size, CTEX_RGBA8);
+    steady_clock::time_point t2 = steady_clock::now();
+    std::cout << path << ": " << IMPOSTOR_GRID * IMPOSTOR_GRID << " views of " << IMPOSTOR_CELL << "px"
+              << ", radius " << model.boundsRadius
+              << ", coverage " << 100.0 * coverage / (size * size) << "%"
+              << "  render " << duration_cast<duration<double, std::milli> >(t1 - t0).count() << " ms"
+              << "  write " << duration_cast<duration<double, std::milli> >(t2 - t1).count() << " ms" << std::endl;
+    if (!ok)
+        std::cout << "impostor: failed to write the atlases for " << path << std::endl;
+    return ok;
+}
+
+// --bake-impostors [model...]: bake the impostor atlases of the given
+// models, or of every tree, without opening a window. Returns true if
+// asked; status is what the program should exit with.
+inline bool runImpostorBake(int argc, char** argv, const std::vector<std::string> &defaults, int &status) {
+    for (int i = 1; i < argc; ++i) {
+        if (std::string(argv[i]) != "--bake-impostors")
+            continue;
+        std::vector<std::string> paths;
+        for (int j = i + 1; j < argc && strncmp(argv[j], "--", 2) != 0; ++j)
+            paths.push_back(argv[j]);
+        if (paths.empty())
+            paths = defaults;
+        HeadlessContext context;
+        if (!context.create(3, 3)) {
+            status = 1;
+            return true;
+        }
+        int failed = 0;
+        {
+            Shader shader("assets/shaders/impostor_bake.vs", "assets/shaders/impostor_bake.fs");
+            for (unsigned int p = 0; p < paths.size(); ++p) {
+                Model model(paths[p]);
+                failed += bakeImpostor(paths[p], model, shader) ? 0 : 1;
+            }
+        }
+        std::cout << "baked " << paths.size() - failed << "/" << paths.size() << " impostors" << std::endl;
+        status = failed ? 1 : 0;
+        return true;
+    }
+    return false;
+}
+
+#endif
@@ -0,0 +1,210 @@
+// Recorded input, to play a session back the same way in any build.
+//
+//     ./project --record-input session.input
+//     ./project --replay-input session.input [--replay-step seconds]
+//
+// Recording keeps every key, cursor, scroll and resize event with its time
+// since the first frame, and writes them on exit to a small binary file:
+// INPUT_LOG_MAGIC, the version, the world's seed and the window size, then
+// 16 bytes per event (InputEvent, little endian).
+//
+// Replay builds the world from the recorded seed and ignores the live
+// keyboard and mouse. Every frame moves time on by a fixed step
+// (INPUT_REPLAY_STEP unless given) instead of the clock, the events up to
+// then go through the usual callbacks, and held keys (W, A, S, D...) come
+// from the replayed presses. So the camera, the chunk crossings and the
+// toggles come out the same in every build that replays the log, whatever
+// its frame rate; not quite the recorded session's, whose frames had their
+// own lengths. When the events run out the program stops and prints the
+// frame times and where it ended up.
+
+#ifndef inputlog_h
+#define inputlog_h
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+#include <GLFW/glfw3.h>
+
+#define INPUT_LOG_MAGIC "INPL"
+#define INPUT_LOG_VERSION 1
+#define INPUT_REPLAY_STEP (1.0f / 60.0f)
+
+enum InputEventType {
+    INPUT_KEY,
+    INPUT_CURSOR,
+    INPUT_SCROLL,
+    INPUT_RESIZE
+};
+
+// code is the key, action GLFW_PRESS, GLFW_RELEASE or GLFW_REPEAT. x and y
+// are the cursor position, the scroll offsets or the new size.
+struct InputEvent {
+    float time;
+    uint8_t type;
+    uint8_t action;
+    uint16_t code;
+    float x;
+    float y;
+};
+
+class InputLog {
+public:
+    // Pick up the flags. False without --record-input or --replay-input.
+    bool parse(int argc, char** argv) {
+        for (int i = 1; i < argc; ++i) {
+            if (std::strcmp(argv[i], "--record-input") == 0 && i + 1 < argc)
+                recordFile = argv[++i];
+            if (std::strcmp(argv[i], "--replay-input") == 0 && i + 1 < argc)
+                replayFile = argv[++i];
+            if (std::strcmp(argv[i], "--replay-step") == 0 && i + 1 < argc)
+                step = std::max(1e-4f, (float)std::atof(argv[++i]));
+        }
+        return recording() || replaying();
+    }
+
+    bool recording() const {
+        return !recordFile.empty();
+    }
+
+    bool replaying() const {
+        return !replayFile.empty();
+    }
+
+    // What the recorded session ran with.
+    uint64_t seed() const {
+        return header.seed;
+    }
+
+    int width() const {
+        return header.width;
+    }
+
+    int height() const {
+        return header.height;
+    }
+
+    // Recording: the events are timed from now on.
+    void start(uint64_t seed, int width, int height, double now) {
+        header.seed = seed;
+        header.width = width;
+        header.height = height;
+        startTime = now;
+    }
+
+    void record(InputEventType type, int code, int action, float x, float y, double now) {
+        if (!recording())
+            return;
+        InputEvent event = { (float)std::max(now - startTime, 0.0), (uint8_t)type, (uint8_t)action, (uint16_t)code,
+                             x, y };
+        events.push_back(event);
+    }
+
+    bool save() const {
+        std::ofstream out(recordFile.c_str(), std::ios::binary);
+        if (!out) {
+            std::cout << "input log: failed to write " << recordFile << std::endl;
+            return false;
+        }
+        out.write((const char*)&header, sizeof(header));
+        if (!events.empty())
+            out.write((const char*)&events[0], events.size() * sizeof(InputEvent));
+        std::cout << "input log: " << events.size() << " events to " << recordFile << std::endl;
+        return true;
+    }
+
+    // Replay: read the log given with --replay-input.
+    bool load() {
+        std::ifstream in(replayFile.c_str(), std::ios::binary);
+        Header read;
+        if (!in || !in.read((char*)&read, sizeof(read)) || std::memcmp(read.magic, INPUT_LOG_MAGIC, 4) != 0 ||
+            read.version != INPUT_LOG_VERSION) {
+            std::cout << "input log: " << replayFile << " is not an input log" << std::endl;
+            return false;
+        }
+        header = read;
+        events.clear();
+        InputEvent event;
+        while (in.read((char*)&event, sizeof(event)))
+            events.push_back(event);
+        next = 0;
+        clock = 0.0f;
+        return true;
+    }
+
+    // The simulated time a replayed frame lasts.
+    float frameStep() const {
+        return step;
+    }
+
+    // The events of the next replayed frame, in order. Keeps track of the
+    // held keys.
+    std::vector<InputEvent> nextFrame() {
+        std::vector<InputEvent> due;
+        clock += step;
+        while (next < events.size() && events[next].time <= clock) {
+            const InputEvent &event = events[next++];
+            if (event.type == INPUT_KEY && event.action == GLFW_PRESS)
+                held.insert(event.code);
+            if (event.type == INPUT_KEY && event.action == GLFW_RELEASE)
+                held.erase(event.code);
+            due.push_back(event);
+        }
+        return due;
+    }
+
+    bool keyHeld(int key) const {
+        return held.count(key) != 0;
+    }
+
+    // Every event replayed.
+    bool done() const {
+        return replaying() && next >= events.size();
+    }
+
+    // Wall clock seconds a replayed frame took.
+    void frameTime(double seconds) {
+        frameMillis.push_back(seconds * 1000.0);
+    }
+
+    void report(const std::string &endState) const {
+        std::vector<double> sorted = frameMillis;
+        std::sort(sorted.begin(), sorted.end());
+        double total = 0.0;
+        for (unsigned int f = 0; f < sorted.size(); ++f)
+            total += sorted[f];
+        double p50 = sorted.empty() ? 0.0 : sorted[sorted.size() / 2];
+        double p99 = sorted.empty() ? 0.0 : sorted[std::min((size_t)(sorted.size() * 0.99), sorted.size() - 1)];
+        std::cout << "replay: " << sorted.size() << " frames of " << step << " s, " << events.size()
+                  << " events, frame ms mean " << (sorted.empty() ? 0.0 : total / sorted.size()) << " p50 " << p50
+                  << " p99 " << p99 << std::endl;
+        std::cout << "replay: ended at " << endState << std::endl;
+    }
+
+private:
+    struct Header {
+        char magic[4] = { 'I', 'N', 'P', 'L' };
+        uint32_t version = INPUT_LOG_VERSION;
+        uint64_t seed = 0;
+        int32_t width = 0;
+        int32_t height = 0;
+    };
+    Header header;
+    std::string recordFile;
+    std::string replayFile;
+    float step = INPUT_REPLAY_STEP;
+    double startTime = 0.0;
+    std::vector<InputEvent> events;
+    unsigned int next = 0;
+    float clock = 0.0f;
+    std::set<int> held;
+    std::vector<double> frameMillis;
+};
+
+#endif
@@ -0,0 +1,218 @@
+// Startup asset loading.
+//
+// Assets are queued first, then run() decodes all of them (OBJ parsing with
+// Assimp, image decoding with stb_image) on the thread pool and finally does
+// every GL upload in one batch on the calling thread, which owns the context.
+// Textures go through the texture cache, so shared images are decoded once.
+// With parallel == false the same jobs are decoded one after the other, which
+// is what startup used to do; handy to compare with the startup trace.
+
+#ifndef loader_h
+#define loader_h
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Model.h"
+#include "draw.h"
+#include "threadpool.h"
+
+// Milliseconds since the program started, for the startup trace.
+inline double startupMillis() {
+    using namespace std::chrono;
+    static const steady_clock::time_point start = steady_clock::now();
+    return duration_cast<duration<double, std::milli> >(steady_clock::now() - start).count();
+}
+
+// Named timestamps from program start to the first frame.
+class StartupTrace {
+public:
+    void mark(const std::string &label) {
+        labels.push_back(label);
+        times.push_back(startupMillis());
+    }
+
+    void print() {
+        std::cout << "Startup trace:" << std::endl;
+        double last = 0.0;
+        for (unsigned int i = 0; i < labels.size(); ++i) {
+            std::cout << "  " << times[i] << " ms  (+" << times[i] - last << ")  " << labels[i] << std::endl;
+            last = times[i];
+        }
+    }
+
+private:
+    std::vector<std::string> labels;
+    std::vector<double> times;
+};
+
+// Diffuse maps an OBJ references through its mtllib, for the texture baker.
+inline std::vector<std::string> objTexturePaths(const std::string &obj) {
+    std::vector<std::string> paths;
+    std::string directory = obj.substr(0, obj.find_last_of('/'));
+    std::ifstream objFile(obj.c_str());
+    std::string line;
+    while (std::getline(objFile, line)) {
+        std::istringstream objLine(line);
+        std::string key, mtl;
+        if (!(objLine >> key >> mtl) || key != "mtllib")
+            continue;
+        std::ifstream mtlFile((directory + '/' + mtl).c_str());
+        std::string mtlLine;
+        while (std::getline(mtlFile, mtlLine)) {
+            std::istringstream in(mtlLine);
+            std::string mapKey, map;
+            if (in >> mapKey >> map && mapKey == "map_Kd" &&
+                std::find(paths.begin(), paths.end(), directory + '/' + map) == paths.end())
+                paths.push_back(directory + '/' + map);
+        }
+    }
+    return paths;
+}
+
+// --mesh-report: load each model without a window and print its mesh
+// optimization results, vertex count and ACMR before and after, and the
+// triangles in each level of detail.
+inline bool runMeshReport(int argc, char** argv, const std::vector<std::string> &models) {
+    bool asked = false;
+    for (int i = 1; i < argc; ++i)
+        asked = asked || std::string(argv[i]) == "--mesh-report";
+    if (!asked)
+        return false;
+    for (unsigned int m = 0; m < models.size(); ++m) {
+        Model model;
+        double t0 = startupMillis();
+        model.loadModel(models[m]);
+        double t1 = startupMillis();
+        MeshOptStats total;
+        float before = 0.0f, welded = 0.0f, after = 0.0f;
+        for (unsigned int s = 0; s < model.optStats.size(); ++s) {
+            const MeshOptStats &stats = model.optStats[s];
+            total.triangles += stats.triangles;
+            total.verticesBefore += stats.verticesBefore;
+            total.verticesAfter += stats.verticesAfter;
+            before += stats.acmrBefore * stats.triangles;
+            welded += stats.acmrWelded * stats.triangles;
+            after += stats.acmrAfter * stats.triangles;
+        }
+        if (total.triangles == 0)
+            continue;
+        std::cout << models[m] << ": " << model.meshes.size() << " meshes, " << total.triangles << " triangles"
+                  << "  vertices " << total.verticesBefore << " -> " << total.verticesAfter
+                  << "  ACMR " << before / total.triangles << " (welded " << welded / total.triangles
+                  << ") -> " << after / total.triangles
+                  << "  load " << t1 - t0 << " ms" << std::endl;
+        std::cout << "  LODs:";
+        for (unsigned int l = 0; l < model.lodLevels(); ++l)
+            std::cout << " " << model.lodTriangles(l);
+        std::cout << " triangles, radius " << model.boundsRadius << std::endl;
+    }
+    return true;
+}
+
+class AssetLoader {
+public:
+    AssetLoader(bool parallel) : parallel(parallel) {}
+
+    void addModel(Model* model, const std::string &path) {
+        Job job;
+        job.kind = MODEL;
+        job.model = model;
+        job.paths.push_back(path);
+        jobs.push_back(job);
+    }
+
+    // Same result as loadTexture(). Nothing is decoded if the texture cache
+    // already has it.
+    void addTexture(unsigned int* id, const std::string &path) {
+        Job job;
+        job.kind = TEXTURE;
+        job.id = id;
+        job.paths.push_back(path);
+        job.entry = textureCache().request(TextureCache::key2D(path, GL_NEAREST, GL_NEAREST), path, job.decode);
+        jobs.push_back(job);
+    }
+
+    // Same result as loadCubemap(); faces in cubemap order.
+    void addCubemap(unsigned int* id, const std::vector<std::string> &faces) {
+        Job job;
+        job.kind = CUBEMAP;
+        job.id = id;
+        job.paths = faces;
+        job.entry = textureCache().request(TextureCache::keyCubemap(faces), faces[0], job.decode);
+        jobs.push_back(job);
+    }
+
+    // Decode everything, then upload. Returns once all assets are on the GPU.
+    void run(StartupTrace* trace = NULL) {
+        // One task per model and per image, so the 12 skybox faces spread too.
+        std::vector<std::pair<int, int> > tasks;
+        for (unsigned int j = 0; j < jobs.size(); ++j) {
+            if (jobs[j].kind == MODEL)
+                tasks.push_back(std::make_pair(j, 0));
+            else if (jobs[j].decode) {
+                jobs[j].entry->images.resize(jobs[j].paths.size());
+                for (unsigned int f = 0; f < jobs[j].paths.size(); ++f)
+                    tasks.push_back(std::make_pair(j, f));
+            }
+        }
+
+        std::vector<double> taskMs(tasks.size());
+        std::function<void(int)> decode = [&](int t) {
+            double t0 = startupMillis();
+            Job &job = jobs[tasks[t].first];
+            if (job.kind == MODEL)
+                job.model->loadModel(job.paths[0]);
+            else
+                job.entry->images[tasks[t].second] = decodeImage(job.paths[tasks[t].second]);
+            taskMs[t] = startupMillis() - t0;
+        };
+        if (parallel)
+            threadPool().parallelFor((int)tasks.size(), decode);
+        else
+            for (int t = 0; t < tasks.size(); ++t)
+                decode(t);
+
+        double decodeTotal = 0.0;
+        for (unsigned int t = 0; t < tasks.size(); ++t)
+            decodeTotal += taskMs[t];
+        if (trace)
+            trace->mark("decoded " + std::to_string(tasks.size()) + " assets (" +
+                        std::to_string((int)decodeTotal) + " ms of decode work, " +
+                        (parallel ? "parallel" : "serial") + ")");
+
+        for (unsigned int j = 0; j < jobs.size(); ++j) {
+            Job &job = jobs[j];
+            if (job.kind == MODEL)
+                job.model->upload();
+            else if (job.kind == TEXTURE)
+                *job.id = uploadCached(job.entry, GL_NEAREST, GL_NEAREST);
+            else
+                *job.id = uploadCachedCubemap(job.entry);
+        }
+        jobs.clear();
+        if (trace)
+            trace->mark("uploaded assets");
+    }
+
+private:
+    enum Kind { MODEL, TEXTURE, CUBEMAP };
+    struct Job {
+        Kind kind;
+        Model* model = NULL;
+        unsigned int* id = NULL;
+        std::vector<std::string> paths;
+        CachedTexture* entry = NULL;
+        bool decode = false;
+    };
+
+    bool parallel;
+    std::vector<Job> jobs;
+};
+
+#endif
@@ -0,0 +1,299 @@
+// Level of detail for models.
+//
+// simplifyMesh() collapses edges in order of quadric error (Garland and
+// Heckbert, "Surface Simplification Using Quadric Error Metrics", 1997).
+// A collapse always moves a vertex onto one of its neighbours, so every LOD
+// indexes the same vertex buffer and only needs its own run of indices:
+// buildLods() appends them after LOD 0 in the mesh's index buffer.
+//
+// Vertices split by a UV or normal seam are never moved (only collapsed
+// onto), so seams don't tear. Border edges get extra planes so outlines,
+// like the edges of leaf cards, are kept until last.
+//
+// selectLod() picks a level per instance from its projected size, with a
+// band around each threshold so instances near one don't flicker.
+
+#ifndef lod_h
+#define lod_h
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "mesh.h"
+#include "meshopt.h"
+
+#define MAX_LODS 4
+
+// Fraction of the LOD 0 triangles each level aims for.
+const float lodTargets[MAX_LODS] = { 1.0f, 0.5f, 0.25f, 0.1f };
+// Projected bounding radius (fraction of half the screen height) below which
+// an instance switches to the next level.
+// The last one, band included, sits above the impostor band (impostor.h),
+// so the coarsest level is what crossfades into the impostor.
+constexpr float lodScreenSizes[MAX_LODS - 1] = { 0.5f, 0.3f, 0.22f };
+// Hysteresis around each threshold, as a fraction of it.
+constexpr float lodBand = 0.15f;
+
+// Set to false (key O, --no-lod) to draw every instance at LOD 0.
+bool bLodEnabled = true;
+
+// What selectLod() needs from the camera: where it is and
+// 1/tan(fovy/2), so radius * projScale / distance is the projected size.
+struct LodView {
+    glm::vec3 eye = glm::vec3(0.0f);
+    float projScale = 1.0f;
+};
+
+// Model triangles submitted this frame, and how many LOD 0 would have been.
+struct LodStats {
+    unsigned long drawn = 0;
+    unsigned long full = 0;
+};
+LodStats lodStats;
+
+// Sum of squared distances to a set of planes, with the total plane weight.
+struct Quadric {
+    double a2 = 0, ab = 0, ac = 0, ad = 0, b2 = 0, bc = 0, bd = 0, c2 = 0, cd = 0, d2 = 0, w = 0;
+
+    void addPlane(glm::vec3 n, float d, float weight) {
+        a2 += weight*n.x*n.x; ab += weight*n.x*n.y; ac += weight*n.x*n.z; ad += weight*n.x*d;
+        b2 += weight*n.y*n.y; bc += weight*n.y*n.z; bd += weight*n.y*d;
+        c2 += weight*n.z*n.z; cd += weight*n.z*d;
+        d2 += weight*d*d;
+        w += weight;
+    }
+
+    void add(const Quadric &q) {
+        a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad; b2 += q.b2; bc += q.bc; bd += q.bd;
+        c2 += q.c2; cd += q.cd; d2 += q.d2; w += q.w;
+    }
+
+    double eval(glm::vec3 p) const {
+        double x = p.x, y = p.y, z = p.z;
+        return a2*x*x + 2*ab*x*y + 2*ac*x*z + 2*ad*x + b2*y*y + 2*bc*y*z + 2*bd*y
+             + c2*z*z + 2*cd*z + d2;
+    }
+};
+
+// Mean squared distance of p to the planes of both quadrics.
+inline double collapseCost(const Quadric &a, const Quadric &b, glm::vec3 p) {
+    double w = a.w + b.w;
+    return w > 0 ? std::max(a.eval(p) + b.eval(p), 0.0) / w : 0.0;
+}
+
+// Indices for a coarser version of the mesh, at most targetIndices long if
+// collapses up to maxError (a distance) allow it.
+inline std::vector<unsigned int> simplifyMesh(const std::vector<Vertex> &vertices,
+                                              const std::vector<unsigned int> &source,
+                                              size_t targetIndices, float maxError) {
+    unsigned int n = vertices.size();
+    std::vector<unsigned int> indices = source;
+
+    // Vertices at the same position share a quadric ("pos"); wedges counts
+    // how many vertices sit at a position.
+    std::vector<unsigned int> pos(n);
+    std::vector<int> wedges(n, 0);
+    {
+        std::unordered_map<uint64_t, std::vector<unsigned int> > buckets;
+        for (unsigned int v = 0; v < n; ++v) {
+            const glm::vec3 &p = vertices[v].Position;
+            uint32_t h[3];
+            memcpy(h, &p, sizeof(h));
+            uint64_t key = ((uint64_t)h[0] * 73856093u) ^ ((uint64_t)h[1] * 19349663u) ^ ((uint64_t)h[2] * 83492791u);
+            std::vector<unsigned int> &bucket = buckets[key];
+            pos[v] = v;
+            for (unsigned int b = 0; b < bucket.size(); ++b)
+                if (vertices[bucket[b]].Position == p) {
+                    pos[v] = bucket[b];
+                    break;
+                }
+            if (pos[v] == v)
+                bucket.push_back(v);
+            ++wedges[pos[v]];
+        }
+    }
+
+    std::vector<Quadric> quadrics(n);
+    std::unordered_map<uint64_t, int> edgeUse;
+    for (unsigned int i = 0; i < indices.size(); i += 3)
+        for (int k = 0; k < 3; ++k) {
+            unsigned int a = pos[indices[i + k]], b = pos[indices[i + (k + 1) % 3]];
+            ++edgeUse[(uint64_t)std::min(a, b) << 32 | std::max(a, b)];
+        }
+    for (unsigned int i = 0; i < indices.size(); i += 3) {
+        glm::vec3 p[3];
+        for (int k = 0; k < 3; ++k)
+            p[k] = vertices[indices[i + k]].Position;
+        glm::vec3 normal = glm::cross(p[1] - p[0], p[2] - p[0]);
+        float area = glm::length(normal);
+        if (area <= 0.0f)
+            continue;
+        normal /= area;
+        for (int k = 0; k < 3; ++k)
+            quadrics[pos[indices[i + k]]].addPlane(normal, -glm::dot(normal, p[0]), area);
+        // a plane through each border edge, perpendicular to the face
+        for (int k = 0; k < 3; ++k) {
+            unsigned int a = pos[indices[i + k]], b = pos[indices[i + (k + 1) % 3]];
+            if (edgeUse[(uint64_t)std::min(a, b) << 32 | std::max(a, b)] != 1)
+                continue;
+            glm::vec3 edge = p[(k + 1) % 3] - p[k];
+            glm::vec3 side = glm::cross(edge, normal);
+            float len = glm::length(side);
+            if (len <= 0.0f)
+                continue;
+            side /= len;
+            float weight = 10.0f * glm::dot(edge, edge);
+            quadrics[a].addPlane(side, -glm::dot(side, p[k]), weight);
+            quadrics[b].addPlane(side, -glm::dot(side, p[k]), weight);
+        }
+    }
+
+    float maxCost = maxError * maxError;
+    struct Collapse {
+        double cost;
+        unsigned int from, to;
+        bool operator<(const Collapse &o) const { return cost < o.cost; }
+    };
+    std::vector<Collapse> collapses;
+    std::vector<unsigned int> remap(n);
+    std::vector<bool> touched(n);
+    std::vector<unsigned int> start, adjacency;
+
+    while (indices.size() > targetIndices) {
+        unsigned int triangles = indices.size() / 3;
+        // vertex -> triangles, CSR
+        start.assign(n + 1, 0);
+        for (unsigned int i = 0; i < indices.size(); ++i)
+            ++start[indices[i] + 1];
+        for (unsigned int v = 0; v < n; ++v)
+            start[v + 1] += start[v];
+        adjacency.resize(indices.size());
+        std::vector<unsigned int> fill(start.begin(), start.end() - 1);
+        for (unsigned int i = 0; i < indices.size(); ++i)
+            adjacency[fill[indices[i]]++] = i / 3;
+
+        collapses.clear();
+        for (unsigned int i = 0; i < indices.size(); i += 3)
+            for (int k = 0; k < 3; ++k) {
+                unsigned int a = indices[i + k], b = indices[i + (k + 1) % 3];
+                for (int dir = 0; dir < 2; ++dir) {
+                    unsigned int from = dir ? b : a, to = dir ? a : b;
+                    if (wedges[pos[from]] != 1)
+                        continue;
+                    Collapse c;
+                    c.cost = collapseCost(quadrics[pos[from]], quadrics[pos[to]], vertices[to].Position);
+                    c.from = from;
+                    c.to = to;
+                    if (c.cost <= maxCost)
+                        collapses.push_back(c);
+                }
+            }
+        if (collapses.empty())
+            break;
+        std::sort(collapses.begin(), collapses.end());
+
+        for (unsigned int v = 0; v < n; ++v)
+            remap[v] = v;
+        std::fill(touched.begin(), touched.end(), false);
+        // each collapse removes about two triangles
+        int needed = (int)(triangles - targetIndices / 3 + 1) / 2 + 1;
+        int done = 0;
+        for (unsigned int c = 0; c < collapses.size() && done < needed; ++c) {
+            unsigned int from = collapses[c].from, to = collapses[c].to;
+            if (touched[from] || touched[to])
+                continue;
+            // reject if a triangle around `from` would flip
+            glm::vec3 target = vertices[to].Position;
+            bool flips = false;
+            for (unsigned int a = start[from]; a < start[from + 1] && !flips; ++a) {
+                unsigned int t = adjacency[a];
+                unsigned int v0 = indices[3*t], v1 = indices[3*t + 1], v2 = indices[3*t + 2];
+                if (v0 == to || v1 == to || v2 == to)
+                    continue;
+                glm::vec3 p0 = vertices[v0].Position, p1 = vertices[v1].Position, p2 = vertices[v2].Position;
+                glm::vec3 before = glm::cross(p1 - p0, p2 - p0);
+                if (v0 == from) p0 = target;
+                if (v1 == from) p1 = target;
+                if (v2 == from) p2 = target;
+                glm::vec3 after = glm::cross(p1 - p0, p2 - p0);
+                flips = glm::dot(before, after) < 0.25f * glm::length(before) * glm::length(after);
+            }
+            if (flips)
+                continue;
+            remap[from] = to;
+            quadrics[pos[to]].add(quadrics[pos[from]]);
+            // lock the one ring so later checks in this pass see current positions
+            for (unsigned int a = start[from]; a < start[from + 1]; ++a)
+                for (int k = 0; k < 3; ++k)
+                    touched[indices[3*adjacency[a] + k]] = true;
+            ++done;
+        }
+        if (done == 0)
+            break;
+
+        unsigned int out = 0;
+        for (unsigned int i = 0; i < indices.size(); i += 3) {
+            unsigned int v0 = remap[indices[i]], v1 = remap[indices[i + 1]], v2 = remap[indices[i + 2]];
+            if (pos[v0] == pos[v1] || pos[v1] == pos[v2] || pos[v0] == pos[v2])
+                continue;
+            indices[out++] = v0;
+            indices[out++] = v1;
+            indices[out++] = v2;
+        }
+        indices.resize(out);
+    }
+    return indices;
+}
+
+// Simplify a mesh into up to MAX_LODS levels, appended after LOD 0 in
+// indices. lodStart/lodCount get each level's range. A level that barely
+// improves on the previous one ends the chain.
+inline void buildLods(const std::vector<Vertex> &vertices, std::vector<unsigned int> &indices,
+                      std::vector<unsigned int> &lodStart, std::vector<unsigned int> &lodCount) {
+    lodStart.assign(1, 0);
+    lodCount.assign(1, indices.size());
+    glm::vec3 lo(1e30f), hi(-1e30f);
+    for (unsigned int v = 0; v < vertices.size(); ++v) {
+        lo = glm::min(lo, vertices[v].Position);
+        hi = glm::max(hi, vertices[v].Position);
+    }
+    float extent = glm::length(hi - lo);
+    std::vector<unsigned int> previous(indices);
+    for (int l = 1; l < MAX_LODS; ++l) {
+        size_t target = (size_t)(lodTargets[l] * lodCount[0]) / 3 * 3;
+        std::vector<unsigned int> lod = simplifyMesh(vertices, previous, target, 0.05f * l * extent);
+        if (lod.empty() || lod.size() > 0.9f * previous.size())
+            break;
+        lod = tipsify(lod, vertices.size());
+        lodStart.push_back(indices.size());
+        lodCount.push_back(lod.size());
+        indices.insert(indices.end(), lod.begin(), lod.end());
+        previous.swap(lod);
+    }
+}
+
+// Projected size of a bounding sphere, as a fraction of half the screen height.
+inline float screenSize(const LodView &view, glm::vec3 centre, float radius) {
+    float distance = std::max(glm::length(centre - view.eye), 0.001f);
+    return radius * view.projScale / distance;
+}
+
+// Level for an instance whose bounding sphere covers screenSize of half the
+// screen height, given the level it used last frame.
+inline int selectLod(float screenSize, int current, int levels) {
+    if (!bLodEnabled || levels <= 1)
+        return 0;
+    current = std::min(current, levels - 1);
+    // finer while above a threshold by the band, coarser while below it by the band
+    while (current > 0 && screenSize > lodScreenSizes[current - 1] * (1.0f + lodBand))
+        --current;
+    while (current < levels - 1 && screenSize < lodScreenSizes[current] * (1.0f - lodBand))
+        ++current;
+    return current;
+}
+
+#endif
@@ -0,0 +1,340 @@
+// Leveled, asynchronous logging.
+//
+//     LOG_DEBUG("Generating chunk ({},{})", x, y);
+//     LOG_WARN("no slot for chunk {}", name);
+//
+// Each {} in the format (a string literal) takes the next argument:
+// integers, floating point, bools, and strings, which are copied (LOG_TEXT
+// bytes per message, for all of them). A message is a fixed size record
+// written into a ring owned by the calling thread, like the profiler's
+// zones: no lock, no allocation, no formatting. A background thread picks
+// the records up every LOG_FLUSH_MS milliseconds, formats them in time
+// order and writes them to std::cout (or setOutput's stream). When a ring
+// is full the message is dropped and counted, rather than waiting for the
+// writer.
+//
+// Levels below LOG_MIN_LEVEL are compiled out, arguments included; build
+// with -DLOG_MIN_LEVEL=LOG_LEVEL_INFO to drop the chunk chatter. The rest
+// can also be raised at run time with logger().setLevel().
+
+#ifndef log_h
+#define log_h
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "profiler.h"
+
+#define LOG_LEVEL_TRACE 0
+#define LOG_LEVEL_DEBUG 1
+#define LOG_LEVEL_INFO 2
+#define LOG_LEVEL_WARN 3
+#define LOG_LEVEL_ERROR 4
+
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+#define LOG_RING 1024       // messages per thread, a power of two
+#define LOG_MAX_ARGS 6
+#define LOG_TEXT 64         // bytes of string arguments per message
+#define LOG_FLUSH_MS 10
+
+enum LogArgType {
+    LOG_ARG_INT,
+    LOG_ARG_UINT,
+    LOG_ARG_DOUBLE,
+    LOG_ARG_BOOL,
+    LOG_ARG_TEXT
+};
+
+union LogArg {
+    int64_t i;
+    uint64_t u;
+    double d;
+    unsigned int text;      // offset into the record's text
+};
+
+struct LogRecord {
+    uint64_t time;          // profilerNanos()
+    const char* format;
+    uint8_t level;
+    uint8_t count;
+    uint8_t types[LOG_MAX_ARGS];
+    LogArg args[LOG_MAX_ARGS];
+    unsigned int textUsed;
+    char text[LOG_TEXT];
+};
+
+// One thread's messages. Written by its thread, read by the writer.
+struct LogRing {
+    LogRecord records[LOG_RING];
+    std::atomic<uint64_t> head;
+    std::atomic<uint64_t> tail;
+    std::atomic<uint64_t> dropped;
+
+    LogRing() : head(0), tail(0), dropped(0) {}
+};
+
+// Capturing the arguments, one overload per kind.
+inline void logCapture(LogRecord &r, LogArgType type, LogArg arg) {
+    if (r.count == LOG_MAX_ARGS)
+        return;
+    r.types[r.count] = type;
+    r.args[r.count++] = arg;
+}
+
+inline void logCaptureText(LogRecord &r, const char* s, size_t length) {
+    LogArg arg;
+    // out of room, the argument is the last (empty) string
+    if (r.textUsed >= LOG_TEXT) {
+        arg.text = LOG_TEXT - 1;
+    }
+    else {
+        length = std::min(length, (size_t)(LOG_TEXT - 1 - r.textUsed));
+        arg.text = r.textUsed;
+        std::memcpy(r.text + r.textUsed, s, length);
+        r.text[r.textUsed + length] = '\0';
+        r.textUsed += length + 1;
+    }
+    logCapture(r, LOG_ARG_TEXT, arg);
+}
+
+inline void logArg(LogRecord &r, const char* s) {
+    logCaptureText(r, s ? s : "(null)", s ? std::strlen(s) : 6);
+}
+
+inline void logArg(LogRecord &r, const std::string &s) {
+    logCaptureText(r, s.c_str(), s.size());
+}
+
+inline void logArg(LogRecord &r, bool b) {
+    LogArg arg;
+    arg.u = b;
+    logCapture(r, LOG_ARG_BOOL, arg);
+}
+
+template <typename T>
+typename std::enable_if<std::is_floating_point<T>::value>::type logArg(LogRecord &r, T value) {
+    LogArg arg;
+    arg.d = value;
+    logCapture(r, LOG_ARG_DOUBLE, arg);
+}
+
+template <typename T>
+typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type logArg(LogRecord &r, T value) {
+    LogArg arg;
+    arg.i = value;
+    logCapture(r, LOG_ARG_INT, arg);
+}
+
+template <typename T>
+typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value>::type logArg(LogRecord &r,
+                                                                                              T value) {
+    LogArg arg;
+    arg.u = value;
+    logCapture(r, LOG_ARG_UINT, arg);
+}
+
+inline void logArgs(LogRecord &) {
+}
+
+template <typename T, typename... Rest>
+void logArgs(LogRecord &r, const T &first, const Rest&... rest) {
+    logArg(r, first);
+    logArgs(r, rest...);
+}
+
+class Logger {
+public:
+    Logger() : minimum(LOG_MIN_LEVEL), running(true), output(&std::cout) {
+        writer = std::thread([this]() {
+            profiler().nameThread("log");
+            while (running.load(std::memory_order_acquire)) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(LOG_FLUSH_MS));
+                flush();
+            }
+        });
+    }
+
+    ~Logger() {
+        running.store(false, std::memory_order_release);
+        writer.join();
+        flush();
+    }
+
+    // Where the messages go from the next flush on. Waits for a flush in
+    // progress, so the old stream is no longer used once this returns.
+    void setOutput(std::ostream* stream) {
+        std::unique_lock<std::mutex> lock(flushing);
+        output = stream;
+    }
+
+    // Messages below level are skipped from now on (above LOG_MIN_LEVEL).
+    void setLevel(int level) {
+        minimum.store(level, std::memory_order_relaxed);
+    }
+
+    bool enabled(int level) const {
+        return level >= minimum.load(std::memory_order_relaxed);
+    }
+
+    template <typename... Args>
+    void write(int level, const char* format, const Args&... args) {
+        if (!enabled(level))
+            return;
+        LogRing &r = ring();
+        uint64_t h = r.head.load(std::memory_order_relaxed);
+        if (h - r.tail.load(std::memory_order_acquire) >= LOG_RING) {
+            r.dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        LogRecord &record = r.records[h & (LOG_RING - 1)];
+        record.time = profilerNanos();
+        record.format = format;
+        record.level = level;
+        record.count = 0;
+        record.textUsed = 0;
+        logArgs(record, args...);
+        r.head.store(h + 1, std::memory_order_release);
+    }
+
+    // Write out everything logged so far. The writer thread calls this; so
+    // can anyone who wants the messages out now (never the frame).
+    void flush() {
+        std::unique_lock<std::mutex> lock(flushing);
+        std::vector<LogRing*> current;
+        {
+            std::unique_lock<std::mutex> registry(mutex);
+            for (unsigned int r = 0; r < rings.size(); ++r)
+                current.push_back(rings[r].get());
+        }
+        pending.clear();
+        std::vector<uint64_t> heads(current.size());
+        uint64_t dropped = 0;
+        for (unsigned int r = 0; r < current.size(); ++r) {
+            LogRing &ring = *current[r];
+            heads[r] = ring.head.load(std::memory_order_acquire);
+            for (uint64_t i = ring.tail.load(std::memory_order_relaxed); i < heads[r]; ++i)
+                pending.push_back(Pending{ ring.records[i & (LOG_RING - 1)].time, &ring, i });
+            dropped += ring.dropped.exchange(0, std::memory_order_relaxed);
+        }
+        if (pending.empty() && !dropped)
+            return;
+        std::stable_sort(pending.begin(), pending.end(), [](const Pending &a, const Pending &b) {
+            return a.time < b.time;
+        });
+        std::string out;
+        for (unsigned int p = 0; p < pending.size(); ++p)
+            format(pending[p].ring->records[pending[p].index & (LOG_RING - 1)], out);
+        // the slots are free once formatted
+        for (unsigned int r = 0; r < current.size(); ++r)
+            current[r]->tail.store(heads[r], std::memory_order_release);
+        if (dropped)
+            out += "log: " + std::to_string(dropped) + " messages dropped\n";
+        *output << out << std::flush;
+    }
+
+private:
+    struct Pending {
+        uint64_t time;
+        LogRing* ring;
+        uint64_t index;
+    };
+
+    std::atomic<int> minimum;
+    std::atomic<bool> running;
+    std::thread writer;
+    std::ostream* output;       // guarded by flushing
+    std::mutex mutex;           // rings
+    std::mutex flushing;        // one flush at a time
+    std::vector<std::unique_ptr<LogRing> > rings;
+    std::vector<Pending> pending;
+
+    // The calling thread's ring, made on its first message.
+    LogRing& ring() {
+        static thread_local LogRing* mine = NULL;
+        if (!mine) {
+            std::unique_lock<std::mutex> lock(mutex);
+            rings.push_back(std::unique_ptr<LogRing>(new LogRing()));
+            mine = rings.back().get();
+        }
+        return *mine;
+    }
+
+    static void format(const LogRecord &r, std::string &out) {
+        static const char* prefixes[] = { "trace: ", "", "", "warning: ", "error: " };
+        out += prefixes[std::min<int>(r.level, LOG_LEVEL_ERROR)];
+        unsigned int next = 0;
+        for (const char* c = r.format; *c; ++c) {
+            if (c[0] != '{' || c[1] != '}' || next == r.count) {
+                out += *c;
+                continue;
+            }
+            char number[32];
+            const LogArg &arg = r.args[next];
+            switch (r.types[next++]) {
+            case LOG_ARG_INT:
+                std::snprintf(number, sizeof(number), "%lld", (long long)arg.i);
+                out += number;
+                break;
+            case LOG_ARG_UINT:
+                std::snprintf(number, sizeof(number), "%llu", (unsigned long long)arg.u);
+                out += number;
+                break;
+            case LOG_ARG_DOUBLE:
+                std::snprintf(number, sizeof(number), "%g", arg.d);
+                out += number;
+                break;
+            case LOG_ARG_BOOL:
+                out += arg.u ? "true" : "false";
+                break;
+            case LOG_ARG_TEXT:
+                out += r.text + arg.text;
+                break;
+            }
+            ++c;
+        }
+        out += '\n';
+    }
+};
+
+inline Logger& logger() {
+    static Logger instance;
+    return instance;
+}
+
+#if LOG_MIN_LEVEL <= LOG_LEVEL_TRACE
+#define LOG_TRACE(...) logger().write(LOG_LEVEL_TRACE, __VA_ARGS__)
+#else
+#define LOG_TRACE(...) ((void)0)
+#endif
+#if LOG_MIN_LEVEL <= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) logger().write(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) ((void)0)
+#endif
+#if LOG_MIN_LEVEL <= LOG_LEVEL_INFO
+#define LOG_INFO(...) logger().write(LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define LOG_INFO(...) ((void)0)
+#endif
+#if LOG_MIN_LEVEL <= LOG_LEVEL_WARN
+#define LOG_WARN(...) logger().write(LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define LOG_WARN(...) ((void)0)
+#endif
+#define LOG_ERROR(...) logger().write(LOG_LEVEL_ERROR, __VA_ARGS__)
+
+#endif
@@ -13,13 +13,27 @@
 #include "world.h"
 #include "Model.h"
 #include "skybox.h"
+#include "bench.h"
+#include "chunkbench.h"
+#include "loader.h"
+#include "impostor.h"
+#include "camerapath.h"
+#include "profiler.h"
+#include "gputimer.h"
+#include "hud.h"
+#include "flythrough.h"
+#include "inputlog.h"
 
 // This determine the size of chunks (width and height)
 // as well as the view distance in any direction (in chunks)
 #define CHUNKSIZE 64
 #define VIEWDISTANCE 2
 
+// Seconds a skybox can go unseen before its cubemap is released
+#define SKYBOX_IDLE_SECONDS 60
+
 // For i/o and generating the seed.
+#include <cstdio>
 #include <iostream>
 #include <chrono>
 
@@ -30,6 +44,7 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
 void processInput(GLFWwindow *window);
+void replayInput(GLFWwindow* window);
 
 // screen/window width and height
 unsigned int sWIDTH = 1280;
@@ -50,9 +65,41 @@ bool firstMouse = true;
 float dT = 0.0f;
 float T0 = 0.0f;
 
+// Seconds since startup. Not glfwGetTime: a flythrough never initializes
+// GLFW, which would then always answer 0.
+double appTime() {
+    static const double start = benchNow();
+    return benchNow() - start;
+}
+
+// --record-input and --replay-input, see inputlog.h.
+InputLog inputLog;
+
 // Points to the current skybox to use.
 Skybox* currentSkybox;
 
+// The texture used for the floor
+const char* floorTexturePath = "assets/textures/surfaces/dirt.png";
+
+// Every image loaded at startup, what --bake-textures bakes by default.
+std::vector<std::string> textureBakeList() {
+    std::vector<std::string> paths;
+    std::vector<std::string> models = world::largeAssetPaths();
+    std::vector<std::string> small = world::smallAssetPaths();
+    models.insert(models.end(), small.begin(), small.end());
+    for (unsigned int i = 0; i < models.size(); ++i) {
+        std::vector<std::string> maps = objTexturePaths(models[i]);
+        paths.insert(paths.end(), maps.begin(), maps.end());
+    }
+    std::vector<std::string> day = Skybox::dayFaces();
+    std::vector<std::string> night = Skybox::nightFaces();
+    paths.insert(paths.end(), day.begin(), day.end());
+    paths.insert(paths.end(), night.begin(), night.end());
+    paths.push_back(world::groundTexturePath());
+    paths.push_back(floorTexturePath);
+    return paths;
+}
+
 // Initial values for flags. These should be toggleable via keyboard shortcuts.
 bool bFlashlight = true;
 bool bNoclip = false;
@@ -60,12 +107,114 @@ bool bShadow = true;
 bool bMaterial = true;
 bool bDaytime = true;
 bool bCursorVisible = true;
+bool bCompactTerrain = true;
+
+// Where K (and --profile, on exit) writes the profiler's zones.
+const char* profilePath = "trace.json";
+bool profileOnExit = false;
 
 // Suffering
-int main() {
-    // This simply gets a seed (unix time in ms).
+int main(int argc, char** argv) {
+    profiler().nameThread("main");
+    appTime();
+    // Headless benchmarks, see bench.h.
+    int benchStatus = 0;
+    if (runBenchmarks(argc, argv, benchStatus))
+        return benchStatus;
+    // Chunk generation throughput, against a baseline if given, see chunkbench.h.
+    if (runChunkBench(argc, argv, benchStatus))
+        return benchStatus;
+    // Offline texture baking, see ctex.h.
+    if (runBakeTool(argc, argv, textureBakeList(), benchStatus))
+        return benchStatus;
+    // Offline impostor atlases for the trees, see impostor.h. No window needed.
+    if (runImpostorBake(argc, argv, world::largeAssetPaths(), benchStatus))
+        return benchStatus;
+    // Compare the GPU culler with its CPU reference, see gpucull.h.
+    if (runGpuCullCheck(argc, argv, world::largeAssetPaths(), world::smallAssetPaths(), benchStatus))
+        return benchStatus;
+    // Software occlusion along a camera path, see occlusion.h.
+    if (runOcclusionBench(argc, argv, world::largeAssetPaths(), world::smallAssetPaths(), benchStatus))
+        return benchStatus;
+    // The world drawn on the null render device, see renderdevice.h.
+    if (runNullRenderBench(argc, argv, world::largeAssetPaths(), world::smallAssetPaths(), benchStatus))
+        return benchStatus;
+    
+    // --no-meshopt keeps Assimp's vertex and triangle order, see meshopt.h.
+    // --no-lod draws every model at full detail, see lod.h.
+    // --no-batch draws trees and rocks model by model, see batch.h.
+    // --no-gpu-cull culls and picks their LODs on the CPU, see gpucull.h.
+    // --no-occlusion draws what the hills hide, see occlusion.h.
+    // --no-occlusion-queries skips the per chunk GPU queries, see occlusionquery.h.
+    // --record-path <file> saves the walk as a camera path, see camerapath.h.
+    // --profile <file> writes the profiler's zones there on exit (and on K),
+    // see profiler.h.
+    // --no-gpu-timers stops timing the passes on the GPU, see gputimer.h.
+    // --render-stats <file> logs the draw calls of every frame as CSV, see
+    // renderstats.h.
+    const char* recordPath = NULL;
+    for (int i = 1; i < argc; ++i) {
+        if (std::string(argv[i]) == "--no-meshopt")
+            bOptimizeMeshes = false;
+        if (std::string(argv[i]) == "--no-lod")
+            bLodEnabled = false;
+        if (std::string(argv[i]) == "--no-impostors")
+            bImpostors = false;
+        if (std::string(argv[i]) == "--no-batch")
+            bBatchVegetation = false;
+        if (std::string(argv[i]) == "--no-gpu-cull")
+            bGpuCull = false;
+        if (std::string(argv[i]) == "--no-occlusion")
+            bOcclusion = false;
+        if (std::string(argv[i]) == "--no-occlusion-queries")
+            bOcclusionQueries = false;
+        if (std::string(argv[i]) == "--record-path" && i + 1 < argc)
+            recordPath = argv[++i];
+        if (std::string(argv[i]) == "--profile" && i + 1 < argc) {
+            profilePath = argv[++i];
+            profileOnExit = true;
+        }
+        if (std::string(argv[i]) == "--no-gpu-timers")
+            bGpuTimers = false;
+        if (std::string(argv[i]) == "--render-stats" && i + 1 < argc)
+            renderStats().openLog(argv[++i]);
+    }
+    std::vector<std::string> modelPaths = world::largeAssetPaths();
+    std::vector<std::string> smallModelPaths = world::smallAssetPaths();
+    modelPaths.insert(modelPaths.end(), smallModelPaths.begin(), smallModelPaths.end());
+    if (runMeshReport(argc, argv, modelPaths))
+        return 0;
+    
+    // --serial-startup decodes assets one after the other, as a baseline for
+    // the startup trace. --no-baked ignores baked .ctex textures.
+    bool serialStartup = false;
+    for (int i = 1; i < argc; ++i) {
+        if (std::string(argv[i]) == "--serial-startup")
+            serialStartup = true;
+        if (std::string(argv[i]) == "--no-baked")
+            bUseBakedTextures = false;
+    }
+    // --flythrough [path] flies a camera path offscreen and reports the frame
+    // times instead of opening a window, see flythrough.h.
+    Flythrough flight;
+    flight.parse(argc, argv);
+    // --record-input <file> saves the keyboard and mouse, --replay-input
+    // <file> plays them back with a fixed step, see inputlog.h.
+    inputLog.parse(argc, argv);
+    if (inputLog.replaying()) {
+        if (!inputLog.load())
+            return -1;
+        sWIDTH = inputLog.width();
+        sHEIGHT = inputLog.height();
+    }
+    
+    StartupTrace trace;
+    trace.mark("main");
+    
+    // This simply gets a seed (unix time in ms), fixed for a flythrough.
     using namespace std::chrono;
-    const uint64_t EPOCH = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+    const uint64_t EPOCH = flight.active() ? flight.seed() : inputLog.replaying() ? inputLog.seed() :
+                           duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
     std::cout << "SEED: ";
     std::cout << EPOCH << std::endl;
 
@@ -73,37 +222,48 @@ int main() {
     OpenSimplexNoise::Noise heightNoise = OpenSimplexNoise::Noise(EPOCH);
     OpenSimplexNoise::Noise forestNoise = OpenSimplexNoise::Noise(3*EPOCH);
     
-    // Opengl version
-    glfwInit();
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    // A flythrough draws offscreen, without a window (or input).
+    GLFWwindow* window = NULL;
+    HeadlessContext headless;
+    if (flight.active()) {
+        if (!headless.create(3, 2) || !flight.start(sWIDTH, sHEIGHT))
+            return -1;
+    } else {
+        // Opengl version
+        glfwInit();
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
 #ifdef __APPLE__
-    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+        glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
 #endif
     
-    // Create the window
-    GLFWwindow* window = glfwCreateWindow(sWIDTH, sHEIGHT, "COMP371: Team#7 - Project", NULL, NULL);
-    if (window == NULL) {
-        std::cout << "Failed to create GLFW window" << std::endl;
-        glfwTerminate();
-        return -1;
-    }
+        // Create the window
+        window = glfwCreateWindow(sWIDTH, sHEIGHT, "COMP371: Team#7 - Project", NULL, NULL);
+        if (window == NULL) {
+            std::cout << "Failed to create GLFW window" << std::endl;
+            glfwTerminate();
+            return -1;
+        }
     
-    // Attach callbacks to windows.
-    glfwMakeContextCurrent(window);
-    glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
-    glfwSetKeyCallback(window, key_callback);
-    glfwSetCursorPosCallback(window, mouse_callback);
-    glfwSetScrollCallback(window, scroll_callback);
-
-    // Initialize GLEW. This is needed to init the functions.
-    glewExperimental = true;
-    if (glewInit() != GLEW_OK) {
-        std::cerr << "Failed to create GLEW" << std::endl;
-        glfwTerminate();
-        return -1;
+        // Attach callbacks to windows.
+        glfwMakeContextCurrent(window);
+        glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+        // a replay takes its input from the log only
+        if (!inputLog.replaying()) {
+            glfwSetKeyCallback(window, key_callback);
+            glfwSetCursorPosCallback(window, mouse_callback);
+            glfwSetScrollCallback(window, scroll_callback);
+        }
+
+        // Initialize GLEW. This is needed to init the functions.
+        glewExperimental = true;
+        if (glewInit() != GLEW_OK) {
+            std::cerr << "Failed to create GLEW" << std::endl;
+            glfwTerminate();
+            return -1;
+        }
     }
     
     // Enable depth test
@@ -113,29 +273,49 @@ int main() {
     Shader shader("assets/shaders/main.vs", "assets/shaders/main.fs");
     Shader depthShader("assets/shaders/shadowdepth.vs", "assets/shaders/shadowdepth.fs");
     Shader skyShader("assets/shaders/skybox.vs", "assets/shaders/skybox.fs");
+    Shader impostorShader("assets/shaders/impostor.vs", "assets/shaders/impostor.fs");
     
     // Set up shader parameters.
     shader.setInt("diffuseTexture", 0);
     shader.setInt("shadowMap", 1);
+    depthShader.use();
+    depthShader.setInt("terrainHeights", 2);
+    impostorShader.use();
+    impostorShader.setInt("colorAtlas", 0);
+    impostorShader.setInt("shadowMap", 1);
+    impostorShader.setInt("normalAtlas", 2);
+    
+    trace.mark("window and shaders");
+    
+    // Queue every asset, then decode them all at once (in parallel unless
+    // --serial-startup) and upload on this thread.
+    AssetLoader loader(!serialStartup);
+    
+    // The trees and small objects scattered on the chunks.
+    std::vector<std::string> largePaths = world::largeAssetPaths();
+    std::vector<std::string> smallPaths = world::smallAssetPaths();
+    std::vector<Model> largeAssets(largePaths.size());
+    std::vector<Model> smallAssets(smallPaths.size());
+    for (unsigned int i = 0; i < largePaths.size(); ++i)
+        loader.addModel(&largeAssets[i], largePaths[i]);
+    for (unsigned int i = 0; i < smallPaths.size(); ++i)
+        loader.addModel(&smallAssets[i], smallPaths[i]);
+    unsigned int groundTexture;
+    loader.addTexture(&groundTexture, world::groundTexturePath());
+    
+    // The skyboxes for day and night time. Only the one shown first is
+    // loaded before the first frame; it decodes alongside the loader.
+    Skybox daybox(Skybox::dayFaces());
+    Skybox nightbox(Skybox::nightFaces());
+    currentSkybox = bDaytime ? &daybox : &nightbox;
+    currentSkybox->prefetch();
+    
+    // The texture used for the ground
+    unsigned int floorTexture;
+    loader.addTexture(&floorTexture, floorTexturePath);
     
-    // Create the skybox to be used for day time
-    Skybox daybox = Skybox("assets/textures/skyboxes/d_left.bmp",
-                           "assets/textures/skyboxes/d_right.bmp",
-                           "assets/textures/skyboxes/d_back.bmp",
-                           "assets/textures/skyboxes/d_front.bmp",
-                           "assets/textures/skyboxes/d_top.bmp",
-                           "assets/textures/skyboxes/d_bottom.bmp");
-    
-    // Create the skybox to be used for night time
-    Skybox nightbox = Skybox("assets/textures/skyboxes/space/space_left.png",
-                             "assets/textures/skyboxes/space/space_right.png",
-                             "assets/textures/skyboxes/space/space_back.png",
-                             "assets/textures/skyboxes/space/space_front.png",
-                             "assets/textures/skyboxes/space/space_top.png",
-                             "assets/textures/skyboxes/space/space_bottom.png");
-    
-    // Create the texture used for the ground
-    unsigned int floorTexture = loadTexture("assets/textures/surfaces/dirt.png");
+    loader.run(&trace);
+    currentSkybox->load(true);
 
     // Prepare shadow map. High res for nice results
     const unsigned int SHADOW_WIDTH = 8192, SHADOW_HEIGHT = 8192;
@@ -161,19 +341,39 @@ int main() {
     shader.use();
     shader.setInt("diffuseTexture", 0);
     shader.setInt("shadowMap", 1);
+    shader.setInt("terrainHeights", 2);
+    // must differ from diffuseTexture's unit even when nothing is batched
+    shader.setInt("diffuseArray", BATCH_ARRAY_UNIT);
 
     // Initial light position for shadows
     glm::vec3 lightPos(-2.0f, 50.0f, -1.0f);
     
     // Make the world, make it current.
-    world theWorld = world(0, 0, CHUNKSIZE, CHUNKSIZE, VIEWDISTANCE, &heightNoise);
+    world theWorld(0, 0, CHUNKSIZE, CHUNKSIZE, VIEWDISTANCE, &heightNoise, EPOCH,
+                   largeAssets, smallAssets, groundTexture);
     currentWorld = &theWorld;
+    theWorld.loadImpostors();
+    if (bBatchVegetation)
+        theWorld.buildVegetationBatch();
+    trace.mark("world generated");
+    bool firstFrame = true;
+    bool prefetchedSkybox = false;
+    CameraPath recording;
+    if (inputLog.recording())
+        inputLog.start(EPOCH, sWIDTH, sHEIGHT, appTime());
 
     // Enter the main loop
-    while (!glfwWindowShouldClose(window))
+    while (flight.active() ? !flight.done() : !glfwWindowShouldClose(window) && !inputLog.done())
     {
+        PROFILE_ZONE("frame");
+        gpuTimers().beginFrame();
+        double frameStart = appTime();
         // Camera should always lie on top of the ground. Not under, not in the air
-        if (!bNoclip)
+        if (flight.active()) {
+            flight.beginFrame();
+            flight.place(camera, theWorld);
+        }
+        else if (!bNoclip)
             camera.setHeight(theWorld.interpolateHeight(camera.Position.x, camera.Position.z));
         shader.use();
         
@@ -194,18 +394,30 @@ int main() {
         else
             shader.setBool("matToggle", false);
         
-        if (bDaytime) {
+        if (bDaytime)
             shader.setBool("dayToggle", true);
-            currentSkybox = & daybox;
-        }
-        else {
+        else
             shader.setBool("dayToggle", false);
-            currentSkybox = & nightbox;
+        
+        // Switch skyboxes once the wanted one is loaded; until then the old
+        // one stays up. The other one is decoded in the background after the
+        // first frame, and released when it hasn't been shown for a while.
+        Skybox* wantedSkybox = bDaytime ? &daybox : &nightbox;
+        Skybox* otherSkybox = bDaytime ? &nightbox : &daybox;
+        if (wantedSkybox->load())
+            currentSkybox = wantedSkybox;
+        if (!firstFrame && !prefetchedSkybox) {
+            otherSkybox->prefetch();
+            prefetchedSkybox = true;
         }
+        if (otherSkybox != currentSkybox && otherSkybox->loaded() && otherSkybox->idleSeconds() > SKYBOX_IDLE_SECONDS)
+            otherSkybox->release();
         
-        if (bCursorVisible)
+        theWorld.setCompactTerrain(bCompactTerrain);
+        
+        if (window && bCursorVisible)
             glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_NORMAL);
-        else
+        else if (window)
             glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
         
         // Flashlight
@@ -239,12 +451,17 @@ int main() {
         }
         
         //mUpdate time values
-        float T1 = static_cast<float>(glfwGetTime());
+        float T1 = static_cast<float>(appTime());
         dT = T1 - T0;
         T0 = T1;
+        if (inputLog.replaying()) {
+            dT = inputLog.frameStep();
+            replayInput(window);
+        }
         
         // Process inputs
-        processInput(window);
+        if (window)
+            processInput(window);
 
         // Directional light positioning (angle)
         lightPos.x = camera.Position.x;
@@ -262,79 +479,180 @@ int main() {
         lightProjection = glm::ortho(-400.0f, 400.0f, -400.0f, 400.0f, near_plane, far_plane);
         lightView = glm::lookAt(lightPos, glm::vec3(0.0f), glm::vec3(0.0, 1.0, 0.0));
         lightSpaceMatrix = lightProjection * lightView;
+        glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)sWIDTH / (float)sHEIGHT, 0.1f, 1000.0f);
+        glm::mat4 view = camera.GetViewMatrix();
         depthShader.use();
         depthShader.setMat4("lightSpaceMatrix", lightSpaceMatrix);
 
-        glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-        glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
-        glClear(GL_DEPTH_BUFFER_BIT);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, floorTexture);
-        // ~~~~~~~~~~~~~~~~~~~~~~~
-        // Render the shadows to the buffer (depth map)
-        depthShader.use();
-        depthShader.setMat4("model", glm::mat4(1.0f));
-        theWorld.renderChunks(depthShader, 0);
-        // ~~~~~~~~~~~~~~~~~~~~~~~
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-        // viewport is window size
-        glViewport(0, 0, sWIDTH, sHEIGHT);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        lodStats = LodStats();
+        theWorld.setView(camera.Position, glm::radians(camera.Zoom), projection * view, lightSpaceMatrix);
+        {
+            PROFILE_ZONE("shadow pass");
+            GPU_ZONE("shadow pass");
+            RENDER_PASS("shadow pass");
+            glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
+            glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
+            glClear(GL_DEPTH_BUFFER_BIT);
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, floorTexture);
+            // ~~~~~~~~~~~~~~~~~~~~~~~
+            // Render the shadows to the buffer (depth map)
+            depthShader.use();
+            depthShader.setMat4("model", glm::mat4(1.0f));
+            theWorld.renderChunks(depthShader, 0);
+            // ~~~~~~~~~~~~~~~~~~~~~~~
+            glBindFramebuffer(GL_FRAMEBUFFER, flight.target());
+        }
 
-        // Need to display ALL
-        shader.use();
-        glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)sWIDTH / (float)sHEIGHT, 0.1f, 1000.0f);
-        glm::mat4 view = camera.GetViewMatrix();
-        shader.setMat4("projection", projection);
-        shader.setMat4("view", view);
-        shader.setVec3("viewPos", camera.Position);
-        shader.setVec3("lightPos", lightPos);
-        shader.setMat4("lightSpaceMatrix", lightSpaceMatrix);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, floorTexture);
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, depthMap);
-        // ----------------------------------------
-        // Draw the world and the shadows
-        shader.use();
-        shader.setMat4("model", glm::mat4(1.0f));
-        theWorld.renderChunks(shader, 1);
+        {
+            PROFILE_ZONE("color pass");
+            GPU_ZONE("color pass");
+            RENDER_PASS("color pass");
+            // viewport is window size
+            glViewport(0, 0, sWIDTH, sHEIGHT);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+            // Need to display ALL
+            shader.use();
+            shader.setMat4("projection", projection);
+            shader.setMat4("view", view);
+            shader.setVec3("viewPos", camera.Position);
+            shader.setVec3("lightPos", lightPos);
+            shader.setMat4("lightSpaceMatrix", lightSpaceMatrix);
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, floorTexture);
+            glActiveTexture(GL_TEXTURE1);
+            glBindTexture(GL_TEXTURE_2D, depthMap);
+            // ----------------------------------------
+            // Draw the world and the shadows
+            shader.use();
+            shader.setMat4("model", glm::mat4(1.0f));
+            theWorld.renderChunks(shader, 1);
+            // Distant trees, queued by renderChunks
+            impostorShader.use();
+            impostorShader.setMat4("projection", projection);
+            impostorShader.setMat4("view", view);
+            impostorShader.setVec3("viewPos", camera.Position);
+            impostorShader.setVec3("lightPos", lightPos);
+            impostorShader.setMat4("lightSpaceMatrix", lightSpaceMatrix);
+            impostorShader.setBool("sToggle", bShadow);
+            impostorShader.setBool("dayToggle", bDaytime);
+            impostorShader.setBool("matToggle", bMaterial);
+            theWorld.renderImpostors(impostorShader);
+        }
         // ----------------------------------------
         currentSkybox->render(&camera, &skyShader, sWIDTH, sHEIGHT);
         
         renderCube();
         
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+        if (bHud) {
+            char line[96];
+            snprintf(line, sizeof(line), "cpu %6.2f ms (without swap)", (appTime() - frameStart) * 1000.0);
+            hud().print(line);
+            if (!gpuTimers().enabled())
+                hud().print("gpu timers off");
+            std::vector<GpuPassStats> passes = gpuTimers().stats();
+            for (unsigned int p = 0; p < passes.size(); ++p) {
+                snprintf(line, sizeof(line), "%-12s avg %6.2f  p99 %6.2f  last %6.2f ms", passes[p].name,
+                         passes[p].average, passes[p].p99, passes[p].last);
+                hud().print(line);
+            }
+            const std::vector<PassCounters> &counters = renderStats().last();
+            for (unsigned int p = 0; p < counters.size(); ++p) {
+                const RenderCounters &c = counters[p].counters;
+                snprintf(line, sizeof(line), "%-12s draws %5llu  tris %8llu  inst %6llu  unif %5llu", counters[p].name,
+                         (unsigned long long)c.drawCalls, (unsigned long long)c.triangles,
+                         (unsigned long long)c.instances, (unsigned long long)c.uniforms);
+                hud().print(line);
+                snprintf(line, sizeof(line), "%-12s tex %5llu  vao %5llu  prog %3llu  upload %7.1f KB", "",
+                         (unsigned long long)c.textureBinds, (unsigned long long)c.vaoBinds,
+                         (unsigned long long)c.programSwitches, c.bufferBytes / 1024.0);
+                hud().print(line);
+            }
+            hud().draw(sWIDTH, sHEIGHT);
+        }
+        renderStats().endFrame();
+        
+        if (flight.active())
+            flight.endFrame();
+        else {
+            PROFILE_ZONE("swap");
+            glfwSwapBuffers(window);
+            glfwPollEvents();
+        }
+        if (inputLog.replaying())
+            inputLog.frameTime(appTime() - frameStart);
+        
+        // a key every quarter second is plenty for the spline
+        if (recordPath && (recording.empty() || appTime() - recording.duration() >= 0.25)) {
+            CameraKey key;
+            key.time = (float)appTime();
+            key.position = camera.Position + glm::vec3(theWorld.origin().x, 0.0f, theWorld.origin().y);
+            key.position.y = camera.Position.y - theWorld.interpolateHeight(camera.Position.x, camera.Position.z);
+            key.yaw = camera.Yaw;
+            key.pitch = camera.Pitch;
+            recording.add(key);
+        }
+        
+        if (firstFrame) {
+            trace.mark("first frame");
+            trace.print();
+            textureCache().report();
+            firstFrame = false;
+        }
     }
 
-    glfwTerminate();
+    if (recordPath)
+        recording.save(recordPath);
+    if (inputLog.recording())
+        inputLog.save();
+    if (inputLog.replaying()) {
+        char state[160];
+        snprintf(state, sizeof(state), "x %.4f y %.4f z %.4f yaw %.4f pitch %.4f, toggles %d%d%d%d%d",
+                 camera.Position.x + theWorld.origin().x, camera.Position.y, camera.Position.z + theWorld.origin().y,
+                 camera.Yaw, camera.Pitch, bShadow, bDaytime, bFlashlight, bMaterial, bNoclip);
+        inputLog.report(state);
+    }
+    if (profileOnExit)
+        profiler().writeChromeTrace(profilePath);
+    renderStats().closeLog();
+    if (flight.active())
+        flight.report();
+    else
+        glfwTerminate();
     return 0;
 }
 
+// Held keys come from the log when replaying.
+bool keyHeld(GLFWwindow* window, int key) {
+    if (inputLog.replaying())
+        return inputLog.keyHeld(key);
+    return glfwGetKey(window, key) == GLFW_PRESS;
+}
+
 void processInput(GLFWwindow *window) {
+    PROFILE_ZONE("input");
     // Quit if user presses exit buttons
-    if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS || glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS)
+    if (keyHeld(window, GLFW_KEY_ESCAPE) || keyHeld(window, GLFW_KEY_Q))
         glfwSetWindowShouldClose(window, true);
     
     // Movement. Only move is the predicted position is valid. Else, do nothing.
-    if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
+    if (keyHeld(window, GLFW_KEY_W))
         if (bNoclip)
             camera.ProcessKeyboard(FORWARD, dT);
         else if (currentWorld->isValid(camera.nextStep(FORWARD, dT)))
             camera.ProcessKeyboard(FORWARD, dT);
-    if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
+    if (keyHeld(window, GLFW_KEY_S))
         if (bNoclip)
             camera.ProcessKeyboard(BACKWARD, dT);
         else if (currentWorld->isValid(camera.nextStep(BACKWARD, dT)))
         camera.ProcessKeyboard(BACKWARD, dT);
-    if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
+    if (keyHeld(window, GLFW_KEY_A))
         if (bNoclip)
             camera.ProcessKeyboard(LEFT, dT);
         else if (currentWorld->isValid(camera.nextStep(LEFT, dT)))
         camera.ProcessKeyboard(LEFT, dT);
-    if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
+    if (keyHeld(window, GLFW_KEY_D))
         if (bNoclip)
             camera.ProcessKeyboard(RIGHT, dT);
         else if (currentWorld->isValid(camera.nextStep(RIGHT, dT)))
@@ -343,6 +661,7 @@ void processInput(GLFWwindow *window) {
 
 // Update window size. Match viewport size to it.
 void framebuffer_size_callback(GLFWwindow* window, int width, int height) {
+    inputLog.record(INPUT_RESIZE, 0, 0, width, height, appTime());
     sWIDTH = width; sHEIGHT = height;
     glViewport(0, 0, width, height);
 }
@@ -350,6 +669,7 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height) {
 // Not much to say here. Mouse handling.
 void mouse_callback(GLFWwindow* window, double xposIn, double yposIn)
 {
+    inputLog.record(INPUT_CURSOR, 0, 0, xposIn, yposIn, appTime());
     float xpos = static_cast<float>(xposIn);
     float ypos = static_cast<float>(yposIn);
     if (firstMouse)
@@ -371,12 +691,14 @@ void mouse_callback(GLFWwindow* window, double xposIn, double yposIn)
 // Mouse scroll. Used for zooming in and out (fov changes)
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
 {
+    inputLog.record(INPUT_SCROLL, 0, 0, xoffset, yoffset, appTime());
     camera.ProcessMouseScroll(static_cast<float>(yoffset));
 }
 
 // Key buttons. On keypress mostly, not hold.
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
 {
+    inputLog.record(INPUT_KEY, key, action, 0.0f, 0.0f, appTime());
     if (key == GLFW_KEY_SPACE && action == GLFW_PRESS) {
         bCursorVisible = bCursorVisible ? false : true;
     }
@@ -404,4 +726,62 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
     
     if (key == GLFW_KEY_N && action == GLFW_PRESS)
         bNoclip = bNoclip ? false : true;
+    
+    if (key == GLFW_KEY_C && action == GLFW_PRESS)
+        bCompactTerrain = bCompactTerrain ? false : true;
+    
+    if (key == GLFW_KEY_O && action == GLFW_PRESS)
+        bLodEnabled = bLodEnabled ? false : true;
+    
+    if (key == GLFW_KEY_I && action == GLFW_PRESS)
+        bImpostors = bImpostors ? false : true;
+    
+    if (key == GLFW_KEY_G && action == GLFW_PRESS)
+        bGpuCull = bGpuCull ? false : true;
+    
+    if (key == GLFW_KEY_H && action == GLFW_PRESS)
+        bOcclusion = bOcclusion ? false : true;
+    
+    if (key == GLFW_KEY_J && action == GLFW_PRESS)
+        bOcclusionQueries = bOcclusionQueries ? false : true;
+    
+    if (key == GLFW_KEY_U && action == GLFW_PRESS)
+        bHud = bHud ? false : true;
+    
+    // Dump the profiler's zones so far.
+    if (key == GLFW_KEY_K && action == GLFW_PRESS)
+        profiler().writeChromeTrace(profilePath);
+    
+    // Print the resident textures and the model triangles of the last frame.
+    if (key == GLFW_KEY_R && action == GLFW_PRESS) {
+        textureCache().report();
+        std::cout << "Model triangles: " << lodStats.drawn << " of " << lodStats.full
+                  << " at full detail" << (bLodEnabled ? "" : " (LOD off)")
+                  << (currentWorld && currentWorld->gpuCulling() ? " (culled on the GPU, not counted)" : "") << std::endl;
+        std::cout << "Occlusion: " << occlusionStats.triangles << " occluder triangles in "
+                  << occlusionStats.rasterMillis << " ms, " << occlusionStats.chunksCulled << " of "
+                  << occlusionStats.chunksTested << " chunks and " << occlusionStats.objectsCulled << " of "
+                  << occlusionStats.objectsTested << " objects hidden" << (bOcclusion ? "" : " (off)") << std::endl;
+        std::cout << "Occlusion queries: " << queryStats.queried << " chunks queried, objects of "
+                  << queryStats.hidden << " hidden, " << queryStats.visible << " visible, "
+                  << queryStats.pending << " waiting on the GPU" << (bOcclusionQueries ? "" : " (off)") << std::endl;
+    }
+}
+
+// Hand the events of a replayed frame to the callbacks, like
+// glfwPollEvents would.
+void replayInput(GLFWwindow* window)
+{
+    std::vector<InputEvent> events = inputLog.nextFrame();
+    for (unsigned int e = 0; e < events.size(); ++e) {
+        const InputEvent &event = events[e];
+        if (event.type == INPUT_KEY)
+            key_callback(window, event.code, 0, event.action, 0);
+        else if (event.type == INPUT_CURSOR)
+            mouse_callback(window, event.x, event.y);
+        else if (event.type == INPUT_SCROLL)
+            scroll_callback(window, event.x, event.y);
+        else if (event.type == INPUT_RESIZE)
+            framebuffer_size_callback(window, (int)event.x, (int)event.y);
+    }
 }
@@ -10,6 +10,7 @@
 #include "stb_image.h"
 #include "shader.h"
 
+#include <algorithm>
 #include <string>
 #include <vector>
 using namespace std;
@@ -46,20 +47,33 @@ public:
     vector<unsigned int> indices;
     vector<Texture>      textures;
     unsigned int VAO;
-
-    // constructor
-    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures)
+    // level of detail ranges in indices, LOD 0 first (see lod.h). Empty means
+    // the whole index buffer is one level.
+    vector<unsigned int> lodStart;
+    vector<unsigned int> lodCount;
+
+    // constructor. With upload == false only the CPU side is filled in, so
+    // meshes can be built on a worker thread; call setupMesh() later on the
+    // thread that owns the GL context.
+    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures, bool upload = true)
     {
         this->vertices = vertices;
         this->indices = indices;
         this->textures = textures;
 
         // now that we have all the required data, set the vertex buffers and its attribute pointers.
-        setupMesh();
+        if (upload)
+            setupMesh();
+    }
+
+    // number of detail levels, at least 1
+    unsigned int lodLevels() const
+    {
+        return lodCount.empty() ? 1 : lodCount.size();
     }
 
-    // render the mesh
-    void Draw(Shader &shader)
+    // render the mesh, at the given level of detail (clamped to the coarsest)
+    void Draw(Shader &shader, unsigned int lod = 0)
     {
         // bind appropriate textures
         unsigned int diffuseNr  = 1;
@@ -68,7 +82,7 @@ public:
         unsigned int heightNr   = 1;
         for(unsigned int i = 0; i < textures.size(); i++)
         {
-            glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
+            renderDevice().activeTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
             // retrieve texture number (the N in diffuse_textureN)
             string number;
             string name = textures[i].type;
@@ -82,67 +96,66 @@ public:
                 number = std::to_string(heightNr++); // transfer unsigned int to string
 
             // now set the sampler to the correct texture unit
-            glUniform1i(glGetUniformLocation(shader.ID, (name + number).c_str()), i);
+            shader.setInt(name + number, i);
             // and finally bind the texture
-            glBindTexture(GL_TEXTURE_2D, textures[i].id);
+            counted::bindTexture(GL_TEXTURE_2D, textures[i].id);
         }
         
         // draw mesh
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, static_cast<unsigned int>(indices.size()), GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
+        counted::bindVertexArray(VAO);
+        if (lodCount.empty())
+            counted::drawElements(GL_TRIANGLES, static_cast<unsigned int>(indices.size()), GL_UNSIGNED_INT, 0);
+        else
+        {
+            lod = std::min(lod, (unsigned int)lodCount.size() - 1);
+            counted::drawElements(GL_TRIANGLES, lodCount[lod], GL_UNSIGNED_INT, (void*)(lodStart[lod] * sizeof(unsigned int)));
+        }
+        renderDevice().bindVertexArray(0);
 
         // always good practice to set everything back to defaults once configured.
-        glActiveTexture(GL_TEXTURE0);
+        renderDevice().activeTexture(GL_TEXTURE0);
     }
 
-private:
-    // render data
-    unsigned int VBO, EBO;
-
     // initializes all the buffer objects/arrays
     void setupMesh()
     {
         // create buffers/arrays
-        glGenVertexArrays(1, &VAO);
-        glGenBuffers(1, &VBO);
-        glGenBuffers(1, &EBO);
+        VAO = renderDevice().createVertexArray();
+        VBO = renderDevice().createBuffer();
+        EBO = renderDevice().createBuffer();
 
-        glBindVertexArray(VAO);
+        renderDevice().bindVertexArray(VAO);
         // load data into vertex buffers
-        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        renderDevice().bindBuffer(GL_ARRAY_BUFFER, VBO);
         // A great thing about structs is that their memory layout is sequential for all its items.
         // The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
         // again translates to 3/2 floats which translates to a byte array.
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
+        renderDevice().bufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
 
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+        renderDevice().bindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        renderDevice().bufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
 
         // set the vertex attribute pointers
         // vertex Positions
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+        renderDevice().vertexAttrib(0, 3, GL_FLOAT, sizeof(Vertex), 0);
         // vertex normals
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
+        renderDevice().vertexAttrib(1, 3, GL_FLOAT, sizeof(Vertex), offsetof(Vertex, Normal));
         // vertex texture coords
-        glEnableVertexAttribArray(2);
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
+        renderDevice().vertexAttrib(2, 2, GL_FLOAT, sizeof(Vertex), offsetof(Vertex, TexCoords));
         // vertex tangent
-        glEnableVertexAttribArray(3);
-        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
+        renderDevice().vertexAttrib(3, 3, GL_FLOAT, sizeof(Vertex), offsetof(Vertex, Tangent));
         // vertex bitangent
-        glEnableVertexAttribArray(4);
-        glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
+        renderDevice().vertexAttrib(4, 3, GL_FLOAT, sizeof(Vertex), offsetof(Vertex, Bitangent));
         // ids
-        glEnableVertexAttribArray(5);
-        glVertexAttribIPointer(5, 4, GL_INT, sizeof(Vertex), (void*)offsetof(Vertex, m_BoneIDs));
+        renderDevice().vertexAttribInt(5, 4, GL_INT, sizeof(Vertex), offsetof(Vertex, m_BoneIDs));
 
         // weights
-        glEnableVertexAttribArray(6);
-        glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, m_Weights));
-        glBindVertexArray(0);
+        renderDevice().vertexAttrib(6, 4, GL_FLOAT, sizeof(Vertex), offsetof(Vertex, m_Weights));
+        renderDevice().bindVertexArray(0);
     }
+
+private:
+    // render data
+    unsigned int VBO, EBO;
 };
 #endif
@@ -0,0 +1,96 @@
+// Terrain normals from a heightmap, by central differences.
+//
+// The heightmap carries a one cell apron on every side, so a chunk's border
+// vertices get the same normal as the matching vertices of its neighbours.
+// With a grid spacing of 1 the normal is normalize(hL - hR, 2, hD - hU), the
+// same formula the compact terrain path uses in main.vs.
+//
+// heights: (w+2) x (h+2) floats, row stride w+2, apron included.
+// nx/ny/nz: three planes of w x h floats, row stride w.
+// Only rows [row0, row1) are written, so rows can be split across threads.
+
+#ifndef normals_h
+#define normals_h
+
+#include <cmath>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define NORMALS_SSE 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define NORMALS_NEON 1
+#endif
+
+// Plain C++ reference version.
+inline void computeNormalsScalar(const float* heights, int w, int /*h*/,
+                                 float* nx, float* ny, float* nz, int row0, int row1) {
+    int stride = w + 2;
+    for (int z = row0; z < row1; ++z) {
+        const float* c = heights + (z + 1) * stride + 1;
+        for (int x = 0; x < w; ++x) {
+            float dx = c[x - 1] - c[x + 1];
+            float dz = c[x - stride] - c[x + stride];
+            float inv = 1.0f / std::sqrt(dx*dx + 4.0f + dz*dz);
+            nx[z*w + x] = dx * inv;
+            ny[z*w + x] = 2.0f * inv;
+            nz[z*w + x] = dz * inv;
+        }
+    }
+}
+
+// Four normals per iteration, scalar tail.
+inline void computeNormals(const float* heights, int w, int /*h*/,
+                           float* nx, float* ny, float* nz, int row0, int row1) {
+#if defined(NORMALS_SSE) || defined(NORMALS_NEON)
+    int stride = w + 2;
+    for (int z = row0; z < row1; ++z) {
+        const float* c = heights + (z + 1) * stride + 1;
+        float* ox = nx + z*w;
+        float* oy = ny + z*w;
+        float* oz = nz + z*w;
+        int x = 0;
+#if defined(NORMALS_SSE)
+        const __m128 four = _mm_set1_ps(4.0f);
+        const __m128 two = _mm_set1_ps(2.0f);
+        const __m128 one = _mm_set1_ps(1.0f);
+        for (; x + 4 <= w; x += 4) {
+            __m128 dx = _mm_sub_ps(_mm_loadu_ps(c + x - 1), _mm_loadu_ps(c + x + 1));
+            __m128 dz = _mm_sub_ps(_mm_loadu_ps(c + x - stride), _mm_loadu_ps(c + x + stride));
+            __m128 len2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dz, dz)), four);
+            __m128 inv = _mm_div_ps(one, _mm_sqrt_ps(len2));
+            _mm_storeu_ps(ox + x, _mm_mul_ps(dx, inv));
+            _mm_storeu_ps(oy + x, _mm_mul_ps(two, inv));
+            _mm_storeu_ps(oz + x, _mm_mul_ps(dz, inv));
+        }
+#else
+        const float32x4_t four = vdupq_n_f32(4.0f);
+        const float32x4_t two = vdupq_n_f32(2.0f);
+        for (; x + 4 <= w; x += 4) {
+            float32x4_t dx = vsubq_f32(vld1q_f32(c + x - 1), vld1q_f32(c + x + 1));
+            float32x4_t dz = vsubq_f32(vld1q_f32(c + x - stride), vld1q_f32(c + x + stride));
+            float32x4_t len2 = vaddq_f32(vaddq_f32(vmulq_f32(dx, dx), vmulq_f32(dz, dz)), four);
+            // Estimate plus two Newton steps is as good as 1/sqrt here.
+            float32x4_t inv = vrsqrteq_f32(len2);
+            inv = vmulq_f32(inv, vrsqrtsq_f32(vmulq_f32(len2, inv), inv));
+            inv = vmulq_f32(inv, vrsqrtsq_f32(vmulq_f32(len2, inv), inv));
+            vst1q_f32(ox + x, vmulq_f32(dx, inv));
+            vst1q_f32(oy + x, vmulq_f32(two, inv));
+            vst1q_f32(oz + x, vmulq_f32(dz, inv));
+        }
+#endif
+        for (; x < w; ++x) {
+            float dx = c[x - 1] - c[x + 1];
+            float dz = c[x - stride] - c[x + stride];
+            float inv = 1.0f / std::sqrt(dx*dx + 4.0f + dz*dz);
+            ox[x] = dx * inv;
+            oy[x] = 2.0f * inv;
+            oz[x] = dz * inv;
+        }
+    }
+#else
+    computeNormalsScalar(heights, w, h, nx, ny, nz, row0, row1);
+#endif
+}
+
+#endif
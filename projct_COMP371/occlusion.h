@@ -0,0 +1,298 @@
+// Software occlusion culling against the terrain.
+//
+// Every frame the displayed chunks' terrain, at 1/8 of its resolution, is
+// rasterized on the CPU into a small depth buffer seen from the camera. The
+// coarse mesh sits under the real terrain everywhere (each coarse vertex
+// takes the lowest height of the cells around it), so it never hides
+// anything the real terrain doesn't. Chunks and then objects whose bounding
+// box is behind it at every pixel it covers are not submitted at all.
+//
+// The buffer holds 1/w (0 is empty, larger is nearer), which interpolates
+// linearly in screen space. Rows are split into bands rasterized in
+// parallel, four pixels at a time with SSE or NEON; every band also keeps
+// the minimum of each 8x8 tile for testing large boxes quickly.
+
+#ifndef occlusion_h
+#define occlusion_h
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "threadpool.h"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define OCCLUSION_SSE 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define OCCLUSION_NEON 1
+#endif
+
+#define OCCLUSION_WIDTH 256
+#define OCCLUSION_HEIGHT 128
+#define OCCLUSION_TILE 8
+#define OCCLUSION_BAND 16         // rows per task, a multiple of the tile
+#define OCCLUSION_NEAR_W 0.1f     // the camera's near plane
+#define OCCLUSION_STEP 8          // terrain vertices per occluder vertex
+
+// Set to false (key H, --no-occlusion) to draw what is behind the hills.
+bool bOcclusion = true;
+
+// Last frame's work, for the report.
+struct OcclusionStats {
+    unsigned int triangles = 0;
+    double rasterMillis = 0.0;
+    unsigned int chunksTested = 0;
+    unsigned int chunksCulled = 0;
+    unsigned int objectsTested = 0;
+    unsigned int objectsCulled = 0;
+};
+OcclusionStats occlusionStats;
+
+class OcclusionBuffer {
+public:
+    OcclusionBuffer() : depth(OCCLUSION_WIDTH * OCCLUSION_HEIGHT, 0.0f),
+                        tiles((OCCLUSION_WIDTH / OCCLUSION_TILE) * (OCCLUSION_HEIGHT / OCCLUSION_TILE), 0.0f) {
+    }
+
+    // Clear and rasterize the world space triangles seen through viewProj.
+    // threads as for ThreadPool::parallelFor; simd false for the reference.
+    void render(const glm::mat4 &viewProj, const std::vector<glm::vec3> &vertices,
+                const std::vector<unsigned int> &indices, bool simd = true, unsigned int threads = 0) {
+        matrix = viewProj;
+        setup(vertices, indices);
+        threadPool().parallelFor(OCCLUSION_HEIGHT / OCCLUSION_BAND, [&](int band) {
+            rasterBand(band * OCCLUSION_BAND, (band + 1) * OCCLUSION_BAND, simd);
+        }, threads);
+    }
+
+    // True if the box is hidden at every pixel it may cover. Boxes crossing
+    // the near plane or leaving the screen count as visible.
+    bool occluded(glm::vec3 lo, glm::vec3 hi) const {
+        float minX = 1e30f, minY = 1e30f, maxX = -1e30f, maxY = -1e30f, nearest = 0.0f;
+        for (int c = 0; c < 8; ++c) {
+            glm::vec4 p = matrix * glm::vec4(c & 1 ? hi.x : lo.x, c & 2 ? hi.y : lo.y, c & 4 ? hi.z : lo.z, 1.0f);
+            if (p.w <= OCCLUSION_NEAR_W)
+                return false;
+            float inv = 1.0f / p.w;
+            float x = (p.x * inv * 0.5f + 0.5f) * OCCLUSION_WIDTH;
+            float y = (p.y * inv * 0.5f + 0.5f) * OCCLUSION_HEIGHT;
+            minX = std::min(minX, x);
+            maxX = std::max(maxX, x);
+            minY = std::min(minY, y);
+            maxY = std::max(maxY, y);
+            nearest = std::max(nearest, inv);
+        }
+        if (minX < 0.0f || minY < 0.0f || maxX >= OCCLUSION_WIDTH || maxY >= OCCLUSION_HEIGHT)
+            return false;
+        // every pixel whose centre may be inside
+        int x0 = (int)std::floor(minX), x1 = (int)std::floor(maxX);
+        int y0 = (int)std::floor(minY), y1 = (int)std::floor(maxY);
+        if ((x1 - x0 + 1) * (y1 - y0 + 1) <= 4 * OCCLUSION_TILE * OCCLUSION_TILE) {
+            for (int y = y0; y <= y1; ++y)
+                for (int x = x0; x <= x1; ++x)
+                    if (depth[y * OCCLUSION_WIDTH + x] <= nearest)
+                        return false;
+            return true;
+        }
+        int tilesX = OCCLUSION_WIDTH / OCCLUSION_TILE;
+        for (int ty = y0 / OCCLUSION_TILE; ty <= y1 / OCCLUSION_TILE; ++ty)
+            for (int tx = x0 / OCCLUSION_TILE; tx <= x1 / OCCLUSION_TILE; ++tx)
+                if (tiles[ty * tilesX + tx] <= nearest)
+                    return false;
+        return true;
+    }
+
+    // 1/w per pixel, bottom row first.
+    const std::vector<float>& buffer() const {
+        return depth;
+    }
+
+    unsigned int triangleCount() const {
+        return triangles.size();
+    }
+
+private:
+    // A screen space triangle: three edge functions and the 1/w plane,
+    // a*x + b*y + c at pixel centres, and its pixel bounds.
+    struct Triangle {
+        float ea[3], eb[3], ec[3];
+        float za, zb, zc;
+        int minX, maxX, minY, maxY;
+    };
+
+    glm::mat4 matrix;
+    std::vector<float> depth;
+    std::vector<float> tiles;
+    std::vector<Triangle> triangles;
+    std::vector<glm::vec4> clip;
+
+    void setup(const std::vector<glm::vec3> &vertices, const std::vector<unsigned int> &indices) {
+        clip.resize(vertices.size());
+        for (unsigned int v = 0; v < vertices.size(); ++v)
+            clip[v] = matrix * glm::vec4(vertices[v], 1.0f);
+        triangles.clear();
+        for (unsigned int t = 0; t + 2 < indices.size(); t += 3) {
+            glm::vec4 in[3] = { clip[indices[t]], clip[indices[t + 1]], clip[indices[t + 2]] };
+            // all outside one side plane
+            bool out = false;
+            for (int axis = 0; axis < 2 && !out; ++axis)
+                out = (in[0][axis] > in[0].w && in[1][axis] > in[1].w && in[2][axis] > in[2].w) ||
+                      (in[0][axis] < -in[0].w && in[1][axis] < -in[1].w && in[2][axis] < -in[2].w);
+            if (out)
+                continue;
+            // clip against the near plane, which leaves up to a quad
+            glm::vec4 poly[4];
+            int n = 0;
+            for (int k = 0; k < 3; ++k) {
+                const glm::vec4 &a = in[k], &b = in[(k + 1) % 3];
+                bool aIn = a.w >= OCCLUSION_NEAR_W, bIn = b.w >= OCCLUSION_NEAR_W;
+                if (aIn)
+                    poly[n++] = a;
+                if (aIn != bIn) {
+                    float s = (OCCLUSION_NEAR_W - a.w) / (b.w - a.w);
+                    poly[n++] = a + (b - a) * s;
+                }
+            }
+            for (int k = 1; k + 1 < n; ++k)
+                addTriangle(poly[0], poly[k], poly[k + 1]);
+        }
+    }
+
+    void addTriangle(const glm::vec4 &a, const glm::vec4 &b, const glm::vec4 &c) {
+        glm::vec3 p[3];
+        const glm::vec4* v[3] = { &a, &b, &c };
+        for (int k = 0; k < 3; ++k) {
+            float inv = 1.0f / v[k]->w;
+            p[k] = glm::vec3((v[k]->x * inv * 0.5f + 0.5f) * OCCLUSION_WIDTH,
+                             (v[k]->y * inv * 0.5f + 0.5f) * OCCLUSION_HEIGHT, inv);
+        }
+        float area = (p[1].x - p[0].x) * (p[2].y - p[0].y) - (p[2].x - p[0].x) * (p[1].y - p[0].y);
+        if (std::fabs(area) < 1e-6f)
+            return;
+        if (area < 0.0f) {
+            std::swap(p[1], p[2]);
+            area = -area;
+        }
+        Triangle tri;
+        float minX = std::min(p[0].x, std::min(p[1].x, p[2].x)), maxX = std::max(p[0].x, std::max(p[1].x, p[2].x));
+        float minY = std::min(p[0].y, std::min(p[1].y, p[2].y)), maxY = std::max(p[0].y, std::max(p[1].y, p[2].y));
+        tri.minX = std::max((int)std::floor(minX), 0);
+        tri.maxX = std::min((int)std::ceil(maxX), OCCLUSION_WIDTH - 1);
+        tri.minY = std::max((int)std::floor(minY), 0);
+        tri.maxY = std::min((int)std::ceil(maxY), OCCLUSION_HEIGHT - 1);
+        if (tri.minX > tri.maxX || tri.minY > tri.maxY)
+            return;
+        // edge k is opposite vertex k, positive inside
+        for (int k = 0; k < 3; ++k) {
+            const glm::vec3 &s = p[(k + 1) % 3], &e = p[(k + 2) % 3];
+            tri.ea[k] = s.y - e.y;
+            tri.eb[k] = e.x - s.x;
+            tri.ec[k] = s.x * e.y - s.y * e.x;
+        }
+        // 1/w from barycentrics: sum of edge_k / area * z_k
+        tri.za = (tri.ea[0] * p[0].z + tri.ea[1] * p[1].z + tri.ea[2] * p[2].z) / area;
+        tri.zb = (tri.eb[0] * p[0].z + tri.eb[1] * p[1].z + tri.eb[2] * p[2].z) / area;
+        tri.zc = (tri.ec[0] * p[0].z + tri.ec[1] * p[1].z + tri.ec[2] * p[2].z) / area;
+        triangles.push_back(tri);
+    }
+
+    // Clear rows [y0, y1), draw every triangle into them, then their tiles.
+    void rasterBand(int y0, int y1, bool simd) {
+        std::fill(depth.begin() + y0 * OCCLUSION_WIDTH, depth.begin() + y1 * OCCLUSION_WIDTH, 0.0f);
+        for (unsigned int t = 0; t < triangles.size(); ++t) {
+            const Triangle &tri = triangles[t];
+            if (tri.maxY < y0 || tri.minY >= y1)
+                continue;
+            int rowEnd = std::min(tri.maxY + 1, y1);
+            for (int y = std::max(tri.minY, y0); y < rowEnd; ++y) {
+                if (simd)
+                    rasterRow(tri, y);
+                else
+                    rasterRowScalar(tri, y);
+            }
+        }
+        int tilesX = OCCLUSION_WIDTH / OCCLUSION_TILE;
+        for (int ty = y0 / OCCLUSION_TILE; ty < y1 / OCCLUSION_TILE; ++ty)
+            for (int tx = 0; tx < tilesX; ++tx) {
+                float least = 1e30f;
+                for (int y = ty * OCCLUSION_TILE; y < (ty + 1) * OCCLUSION_TILE; ++y)
+                    for (int x = tx * OCCLUSION_TILE; x < (tx + 1) * OCCLUSION_TILE; ++x)
+                        least = std::min(least, depth[y * OCCLUSION_WIDTH + x]);
+                tiles[ty * tilesX + tx] = least;
+            }
+    }
+
+    // Same arithmetic, in the same order, as the SIMD rows.
+    void rasterRowScalar(const Triangle &tri, int y) {
+        float py = y + 0.5f;
+        float* row = &depth[y * OCCLUSION_WIDTH];
+        float eb[3] = { tri.eb[0] * py + tri.ec[0], tri.eb[1] * py + tri.ec[1], tri.eb[2] * py + tri.ec[2] };
+        float zb = tri.zb * py + tri.zc;
+        for (int x = tri.minX; x <= tri.maxX; ++x) {
+            float px = x + 0.5f;
+            if (tri.ea[0] * px + eb[0] >= 0.0f && tri.ea[1] * px + eb[1] >= 0.0f && tri.ea[2] * px + eb[2] >= 0.0f)
+                row[x] = std::max(row[x], tri.za * px + zb);
+        }
+    }
+
+    // Four pixels at a time from an aligned start; the width is a multiple
+    // of four, so the last group never runs past the row.
+    void rasterRow(const Triangle &tri, int y) {
+#if defined(OCCLUSION_SSE)
+        float py = y + 0.5f;
+        float* row = &depth[y * OCCLUSION_WIDTH];
+        int x = tri.minX & ~3;
+        __m128 px = _mm_add_ps(_mm_set1_ps(x + 0.5f), _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f));
+        const __m128 step = _mm_set1_ps(4.0f);
+        const __m128 zero = _mm_setzero_ps();
+        __m128 ea[3], eb[3];
+        for (int k = 0; k < 3; ++k) {
+            ea[k] = _mm_set1_ps(tri.ea[k]);
+            eb[k] = _mm_set1_ps(tri.eb[k] * py + tri.ec[k]);
+        }
+        __m128 za = _mm_set1_ps(tri.za), zb = _mm_set1_ps(tri.zb * py + tri.zc);
+        for (; x <= tri.maxX; x += 4) {
+            __m128 inside = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(ea[0], px), eb[0]), zero);
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(ea[1], px), eb[1]), zero));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(ea[2], px), eb[2]), zero));
+            if (_mm_movemask_ps(inside)) {
+                __m128 old = _mm_loadu_ps(row + x);
+                __m128 z = _mm_max_ps(old, _mm_add_ps(_mm_mul_ps(za, px), zb));
+                _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, z), _mm_andnot_ps(inside, old)));
+            }
+            px = _mm_add_ps(px, step);
+        }
+#elif defined(OCCLUSION_NEON)
+        float py = y + 0.5f;
+        float* row = &depth[y * OCCLUSION_WIDTH];
+        int x = tri.minX & ~3;
+        const float lanes[4] = { 0.0f, 1.0f, 2.0f, 3.0f };
+        float32x4_t px = vaddq_f32(vdupq_n_f32(x + 0.5f), vld1q_f32(lanes));
+        const float32x4_t step = vdupq_n_f32(4.0f);
+        const float32x4_t zero = vdupq_n_f32(0.0f);
+        float32x4_t ea[3], eb[3];
+        for (int k = 0; k < 3; ++k) {
+            ea[k] = vdupq_n_f32(tri.ea[k]);
+            eb[k] = vdupq_n_f32(tri.eb[k] * py + tri.ec[k]);
+        }
+        float32x4_t za = vdupq_n_f32(tri.za), zb = vdupq_n_f32(tri.zb * py + tri.zc);
+        for (; x <= tri.maxX; x += 4) {
+            uint32x4_t inside = vcgeq_f32(vmlaq_f32(eb[0], ea[0], px), zero);
+            inside = vandq_u32(inside, vcgeq_f32(vmlaq_f32(eb[1], ea[1], px), zero));
+            inside = vandq_u32(inside, vcgeq_f32(vmlaq_f32(eb[2], ea[2], px), zero));
+            float32x4_t old = vld1q_f32(row + x);
+            float32x4_t z = vmaxq_f32(old, vmlaq_f32(zb, za, px));
+            vst1q_f32(row + x, vbslq_f32(inside, z, old));
+            px = vaddq_f32(px, step);
+        }
+#else
+        rasterRowScalar(tri, y);
+#endif
+    }
+};
+
+#endif
@@ -0,0 +1,179 @@
+// Hardware occlusion queries for whole chunks, the GPU's take on occlusion.h.
+//
+// Once the camera pass has drawn, every chunk's box is drawn again with
+// colour and depth writes off inside an occlusion query. Results are read
+// the next frame, and only if the GPU already has them, so the CPU never
+// waits:
+//
+//  - no samples last frame: the chunk's trees and rocks are not submitted.
+//  - result not in yet: they are drawn under glBeginConditionalRender on
+//    last frame's query with GL_QUERY_NO_WAIT, so the GPU still skips them
+//    if the answer arrives in time (only when drawing model by model).
+//
+// The terrain is always drawn. It is the occluder, and a chunk coming out
+// from behind a hill would otherwise leave a hole for a frame; its objects
+// are just one frame late instead.
+
+#ifndef occlusionquery_h
+#define occlusionquery_h
+
+#include <vector>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "shader.h"
+
+// Set to false (key J, --no-occlusion-queries) to draw every chunk's objects.
+bool bOcclusionQueries = true;
+
+// Chunks of the last camera pass: boxes queried, and how their objects
+// were drawn (skipped, drawn, drawn on a pending query).
+struct QueryStats {
+    unsigned int queried = 0;
+    unsigned int hidden = 0;
+    unsigned int visible = 0;
+    unsigned int pending = 0;
+};
+QueryStats queryStats;
+
+class ChunkQueries {
+public:
+    // The displayed chunks changed; nothing known about the new ones.
+    void reset(unsigned int chunks) {
+        release();
+        slots.assign(chunks, Slot());
+    }
+
+    // Take in whatever results of last frame's queries have arrived. Call
+    // at the start of the camera pass.
+    void collect() {
+        queryStats = QueryStats();
+        for (unsigned int i = 0; i < slots.size(); ++i) {
+            Slot &slot = slots[i];
+            slot.pending = false;
+            if (!slot.issued)
+                continue;
+            GLuint available = 0;
+            glGetQueryObjectuiv(slot.queries[slot.last], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available) {
+                slot.pending = true;
+                continue;
+            }
+            GLuint samples = 0;
+            glGetQueryObjectuiv(slot.queries[slot.last], GL_QUERY_RESULT, &samples);
+            slot.hidden = samples == 0;
+            slot.issued = false;
+        }
+    }
+
+    // Whether chunk i's objects can be skipped, counted for the stats.
+    bool hidden(unsigned int i) const {
+        if (i >= slots.size())
+            return false;
+        const Slot &slot = slots[i];
+        if (slot.pending)
+            queryStats.pending++;
+        else if (slot.hidden)
+            queryStats.hidden++;
+        else
+            queryStats.visible++;
+        return !slot.pending && slot.hidden;
+    }
+
+    // Query to draw chunk i's objects on, 0 if the answer is known.
+    GLuint condition(unsigned int i) const {
+        return i < slots.size() && slots[i].pending ? slots[i].queries[slots[i].last] : 0;
+    }
+
+    // Query the box of chunk i against what is in the depth buffer, with
+    // shader (position only, model matrix). A camera inside the box, or
+    // near enough to clip it, would get no samples, so such a chunk is
+    // just taken as visible.
+    void issue(Shader &shader, unsigned int i, glm::vec3 lo, glm::vec3 hi, glm::vec3 eye) {
+        if (i >= slots.size())
+            return;
+        Slot &slot = slots[i];
+        float margin = 1.0f;
+        if (eye.x >= lo.x - margin && eye.y >= lo.y - margin && eye.z >= lo.z - margin &&
+            eye.x <= hi.x + margin && eye.y <= hi.y + margin && eye.z <= hi.z + margin) {
+            slot.hidden = false;
+            slot.issued = false;
+            return;
+        }
+        if (!slot.queries[0])
+            glGenQueries(2, slot.queries);
+        if (!VAO)
+            makeBox();
+        // the other query may still be waited on by the conditional draws
+        int next = slot.issued || slot.pending ? 1 - slot.last : slot.last;
+        shader.setMat4("model", glm::scale(glm::translate(glm::mat4(1.0f), lo), hi - lo));
+        glBeginQuery(target(), slot.queries[next]);
+        counted::bindVertexArray(VAO);
+        counted::drawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
+        glEndQuery(target());
+        slot.last = next;
+        slot.issued = true;
+        queryStats.queried++;
+    }
+
+    // State for a run of issue() calls: boxes touch neither colour nor depth.
+    static void begin() {
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        glDepthMask(GL_FALSE);
+    }
+
+    static void end() {
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        glDepthMask(GL_TRUE);
+        glBindVertexArray(0);
+    }
+
+private:
+    struct Slot {
+        GLuint queries[2] = { 0, 0 };
+        int last = 0;          // the one issued most recently
+        bool issued = false;   // and its result was not read yet
+        bool pending = false;  // and it was not in at collect()
+        bool hidden = false;   // last result read
+    };
+    std::vector<Slot> slots;
+    GLuint VAO = 0, VBO = 0, EBO = 0;
+
+    // Any sample at all is enough where the GL has it.
+    static GLenum target() {
+        return GLEW_VERSION_3_3 || GLEW_ARB_occlusion_query2 ? GL_ANY_SAMPLES_PASSED : GL_SAMPLES_PASSED;
+    }
+
+    // Unit cube, scaled onto each box.
+    void makeBox() {
+        float corners[24];
+        for (int c = 0; c < 8; ++c) {
+            corners[3*c] = c & 1 ? 1.0f : 0.0f;
+            corners[3*c + 1] = c & 2 ? 1.0f : 0.0f;
+            corners[3*c + 2] = c & 4 ? 1.0f : 0.0f;
+        }
+        unsigned int faces[36] = { 0, 2, 1, 1, 2, 3,  4, 5, 6, 5, 7, 6,  0, 1, 4, 1, 5, 4,
+                                   2, 6, 3, 3, 6, 7,  0, 4, 2, 2, 4, 6,  1, 3, 5, 3, 7, 5 };
+        glGenVertexArrays(1, &VAO);
+        glGenBuffers(1, &VBO);
+        glGenBuffers(1, &EBO);
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(faces), faces, GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+        glBindVertexArray(0);
+    }
+
+    void release() {
+        for (unsigned int i = 0; i < slots.size(); ++i)
+            if (slots[i].queries[0])
+                glDeleteQueries(2, slots[i].queries);
+        slots.clear();
+    }
+};
+
+#endif
@@ -0,0 +1,520 @@
+// Where the renderer's GL calls go.
+//
+//     renderDevice().bindBuffer(GL_ARRAY_BUFFER, VBO);
+//
+// The terrain, meshes, skybox, shaders, stream arenas and the counted::
+// calls (renderstats.h) go through the current device. GLDevice is GL.
+// NullDevice needs no context at all: it hands out ids, keeps mapped
+// buffers in CPU memory and records the draws and state changes. Under it
+// the world generates, culls and builds its draws like it does on screen,
+// so that part can be timed and checked on a machine without a display or
+// GPU (see --bench-null in bench.h).
+//
+// Texture uploads, queries, timers, the batch, the impostors and the GPU
+// culler still call GL directly: keep them off under NullDevice.
+
+#ifndef renderdevice_h
+#define renderdevice_h
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+
+enum UniformType {
+    UNIFORM_INT,
+    UNIFORM_UINT,
+    UNIFORM_FLOAT,
+    UNIFORM_VEC2,
+    UNIFORM_VEC3,
+    UNIFORM_VEC4,
+    UNIFORM_MAT2,
+    UNIFORM_MAT3,
+    UNIFORM_MAT4
+};
+
+class RenderDevice {
+public:
+    virtual ~RenderDevice() {}
+
+    virtual const char* name() const = 0;
+
+    // Buffers
+    virtual GLuint createBuffer() = 0;
+    virtual void bindBuffer(GLenum target, GLuint buffer) = 0;
+    virtual void bufferData(GLenum target, GLsizeiptr size, const void* data, GLenum usage) = 0;
+    virtual void bufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void* data) = 0;
+    // Immutable storage for the bound buffer, mapped for writing for good.
+    // NULL where that isn't supported; use bufferData then.
+    virtual void* mapPersistent(GLenum target, GLsizeiptr size) = 0;
+    virtual GLsync fence() = 0;
+    // Blocks until the GPU is past the fence.
+    virtual void waitFence(GLsync fence) = 0;
+    virtual void deleteFence(GLsync fence) = 0;
+
+    // Vertex arrays. Attributes read from the bound GL_ARRAY_BUFFER.
+    virtual GLuint createVertexArray() = 0;
+    virtual void bindVertexArray(GLuint array) = 0;
+    virtual void vertexAttrib(GLuint index, GLint size, GLenum type, GLsizei stride, size_t offset) = 0;
+    virtual void vertexAttribInt(GLuint index, GLint size, GLenum type, GLsizei stride, size_t offset) = 0;
+
+    // Textures. textureBuffer backs the bound GL_TEXTURE_BUFFER with buffer,
+    // of at most maxTextureBufferTexels texels.
+    virtual GLuint createTexture() = 0;
+    virtual void activeTexture(GLenum unit) = 0;
+    virtual void bindTexture(GLenum target, GLuint texture) = 0;
+    virtual void textureBuffer(GLenum format, GLuint buffer) = 0;
+    virtual GLint maxTextureBufferTexels() = 0;
+
+    // Programs. label names the stage in compile errors.
+    virtual GLuint compileShader(GLenum type, const char* source, const char* label) = 0;
+    virtual GLuint linkProgram(const GLuint* shaders, int count) = 0;
+    virtual void useProgram(GLuint program) = 0;
+    virtual void uniform(GLuint program, const char* name, UniformType type, GLsizei count, const void* values) = 0;
+
+    // Draws
+    virtual void drawArrays(GLenum mode, GLint first, GLsizei count) = 0;
+    virtual void drawArraysInstanced(GLenum mode, GLint first, GLsizei count, GLsizei instances) = 0;
+    virtual void drawElements(GLenum mode, GLsizei count, GLenum type, const void* indices) = 0;
+    virtual void multiDrawElements(GLenum mode, const GLsizei* counts, GLenum type, const void* const* indices,
+                                   GLsizei draws) = 0;
+    virtual void multiDrawElementsBaseVertex(GLenum mode, const GLsizei* counts, GLenum type,
+                                             const void* const* indices, GLsizei draws, const GLint* baseVertex) = 0;
+    virtual void multiDrawElementsIndirect(GLenum mode, GLenum type, const void* indirect, GLsizei draws) = 0;
+    virtual void drawArraysIndirect(GLenum mode, const void* indirect) = 0;
+
+    // State
+    virtual void beginConditionalRender(GLuint query) = 0;
+    virtual void endConditionalRender() = 0;
+    virtual void depthFunc(GLenum func) = 0;
+};
+
+class GLDevice : public RenderDevice {
+public:
+    const char* name() const {
+        return "gl";
+    }
+
+    GLuint createBuffer() {
+        GLuint buffer = 0;
+        glGenBuffers(1, &buffer);
+        return buffer;
+    }
+
+    void bindBuffer(GLenum target, GLuint buffer) {
+        glBindBuffer(target, buffer);
+    }
+
+    void bufferData(GLenum target, GLsizeiptr size, const void* data, GLenum usage) {
+        glBufferData(target, size, data, usage);
+    }
+
+    void bufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void* data) {
+        glBufferSubData(target, offset, size, data);
+    }
+
+    // GL 4.4 or ARB_buffer_storage. macOS tops out at 4.1.
+    void* mapPersistent(GLenum target, GLsizeiptr size) {
+        if (!GLEW_ARB_buffer_storage)
+            return NULL;
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(target, size, NULL, flags);
+        return glMapBufferRange(target, 0, size, flags);
+    }
+
+    GLsync fence() {
+        return glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+    void waitFence(GLsync fence) {
+        GLenum res = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+        while (res != GL_ALREADY_SIGNALED && res != GL_CONDITION_SATISFIED && res != GL_WAIT_FAILED)
+            res = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+    }
+
+    void deleteFence(GLsync fence) {
+        glDeleteSync(fence);
+    }
+
+    GLuint createVertexArray() {
+        GLuint array = 0;
+        glGenVertexArrays(1, &array);
+        return array;
+    }
+
+    void bindVertexArray(GLuint array) {
+        glBindVertexArray(array);
+    }
+
+    void vertexAttrib(GLuint index, GLint size, GLenum type, GLsizei stride, size_t offset) {
+        glEnableVertexAttribArray(index);
+        glVertexAttribPointer(index, size, type, GL_FALSE, stride, (void*)offset);
+    }
+
+    void vertexAttribInt(GLuint index, GLint size, GLenum type, GLsizei stride, size_t offset) {
+        glEnableVertexAttribArray(index);
+        glVertexAttribIPointer(index, size, type, stride, (void*)offset);
+    }
+
+    GLuint createTexture() {
+        GLuint texture = 0;
+        glGenTextures(1, &texture);
+        return texture;
+    }
+
+    void activeTexture(GLenum unit) {
+        glActiveTexture(unit);
+    }
+
+    void bindTexture(GLenum target, GLuint texture) {
+        glBindTexture(target, texture);
+    }
+
+    void textureBuffer(GLenum format, GLuint buffer) {
+        glTexBuffer(GL_TEXTURE_BUFFER, format, buffer);
+    }
+
+    GLint maxTextureBufferTexels() {
+        GLint texels = 0;
+        glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &texels);
+        return texels;
+    }
+
+    GLuint compileShader(GLenum type, const char* source, const char* label) {
+        GLuint shader = glCreateShader(type);
+        glShaderSource(shader, 1, &source, NULL);
+        glCompileShader(shader);
+        GLint success;
+        GLchar infoLog[1024];
+        glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+        if (!success) {
+            glGetShaderInfoLog(shader, 1024, NULL, infoLog);
+            std::cout << "ERROR::SHADER_COMPILATION_ERROR of type: " << label << "\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
+        }
+        return shader;
+    }
+
+    // The shaders are deleted once linked.
+    GLuint linkProgram(const GLuint* shaders, int count) {
+        GLuint program = glCreateProgram();
+        for (int s = 0; s < count; ++s)
+            glAttachShader(program, shaders[s]);
+        glLinkProgram(program);
+        GLint success;
+        GLchar infoLog[1024];
+        glGetProgramiv(program, GL_LINK_STATUS, &success);
+        if (!success) {
+            glGetProgramInfoLog(program, 1024, NULL, infoLog);
+            std::cout << "ERROR::PROGRAM_LINKING_ERROR of type: PROGRAM\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
+        }
+        for (int s = 0; s < count; ++s)
+            glDeleteShader(shaders[s]);
+        return program;
+    }
+
+    void useProgram(GLuint program) {
+        glUseProgram(program);
+    }
+
+    void uniform(GLuint program, const char* name, UniformType type, GLsizei count, const void* values) {
+        GLint location = glGetUniformLocation(program, name);
+        switch (type) {
+            case UNIFORM_INT:
+                glUniform1iv(location, count, (const GLint*)values);
+                break;
+            case UNIFORM_UINT:
+                glUniform1uiv(location, count, (const GLuint*)values);
+                break;
+            case UNIFORM_FLOAT:
+                glUniform1fv(location, count, (const GLfloat*)values);
+                break;
+            case UNIFORM_VEC2:
+                glUniform2fv(location, count, (const GLfloat*)values);
+                break;
+            case UNIFORM_VEC3:
+                glUniform3fv(location, count, (const GLfloat*)values);
+                break;
+            case UNIFORM_VEC4:
+                glUniform4fv(location, count, (const GLfloat*)values);
+                break;
+            case UNIFORM_MAT2:
+                glUniformMatrix2fv(location, count, GL_FALSE, (const GLfloat*)values);
+                break;
+            case UNIFORM_MAT3:
+                glUniformMatrix3fv(location, count, GL_FALSE, (const GLfloat*)values);
+                break;
+            case UNIFORM_MAT4:
+                glUniformMatrix4fv(location, count, GL_FALSE, (const GLfloat*)values);
+                break;
+        }
+    }
+
+    void drawArrays(GLenum mode, GLint first, GLsizei count) {
+        glDrawArrays(mode, first, count);
+    }
+
+    void drawArraysInstanced(GLenum mode, GLint first, GLsizei count, GLsizei instances) {
+        glDrawArraysInstanced(mode, first, count, instances);
+    }
+
+    void drawElements(GLenum mode, GLsizei count, GLenum type, const void* indices) {
+        glDrawElements(mode, count, type, indices);
+    }
+
+    void multiDrawElements(GLenum mode, const GLsizei* counts, GLenum type, const void* const* indices, GLsizei draws) {
+        glMultiDrawElements(mode, counts, type, indices, draws);
+    }
+
+    void multiDrawElementsBaseVertex(GLenum mode, const GLsizei* counts, GLenum type, const void* const* indices,
+                                     GLsizei draws, const GLint* baseVertex) {
+        glMultiDrawElementsBaseVertex(mode, counts, type, indices, draws, baseVertex);
+    }
+
+    void multiDrawElementsIndirect(GLenum mode, GLenum type, const void* indirect, GLsizei draws) {
+        glMultiDrawElementsIndirect(mode, type, indirect, draws, 0);
+    }
+
+    void drawArraysIndirect(GLenum mode, const void* indirect) {
+        glDrawArraysIndirect(mode, indirect);
+    }
+
+    void beginConditionalRender(GLuint query) {
+        glBeginConditionalRender(query, GL_QUERY_NO_WAIT);
+    }
+
+    void endConditionalRender() {
+        glEndConditionalRender();
+    }
+
+    void depthFunc(GLenum func) {
+        glDepthFunc(func);
+    }
+};
+
+// What NullDevice records.
+enum RenderOp {
+    OP_BIND_BUFFER,
+    OP_BUFFER_DATA,
+    OP_BIND_VERTEX_ARRAY,
+    OP_ACTIVE_TEXTURE,
+    OP_BIND_TEXTURE,
+    OP_USE_PROGRAM,
+    OP_UNIFORM,
+    OP_DRAW,
+    OP_DRAW_INSTANCED,
+    OP_MULTI_DRAW,
+    OP_DRAW_INDIRECT,
+    OP_CONDITIONAL_RENDER,
+    OP_DEPTH_FUNC,
+    OP_COUNT
+};
+
+// target is the GL target, mode or unit the op is about, object the buffer,
+// array, texture or program, and count the bytes, indices or draws.
+struct RenderCommand {
+    RenderOp op;
+    GLenum target;
+    GLuint object;
+    GLsizei count;
+    GLsizei instances;
+};
+
+class NullDevice : public RenderDevice {
+public:
+    ~NullDevice() {
+        for (std::map<GLuint, char*>::iterator it = storage.begin(); it != storage.end(); ++it)
+            delete[] it->second;
+    }
+
+    const char* name() const {
+        return "null";
+    }
+
+    // Everything since the last clear().
+    const std::vector<RenderCommand>& commands() const {
+        return recorded;
+    }
+
+    unsigned int count(RenderOp op) const {
+        return perOp[op];
+    }
+
+    // FNV-1a over the commands, to compare runs with.
+    uint64_t checksum() const {
+        uint64_t hash = 14695981039346656037ull;
+        for (unsigned int c = 0; c < recorded.size(); ++c) {
+            const unsigned char* bytes = (const unsigned char*)&recorded[c];
+            for (unsigned int b = 0; b < sizeof(RenderCommand); ++b)
+                hash = (hash ^ bytes[b]) * 1099511628211ull;
+        }
+        return hash;
+    }
+
+    void clear() {
+        recorded.clear();
+        for (int op = 0; op < OP_COUNT; ++op)
+            perOp[op] = 0;
+    }
+
+    GLuint createBuffer() {
+        return ++nextId;
+    }
+
+    void bindBuffer(GLenum target, GLuint buffer) {
+        bound[target] = buffer;
+        record(OP_BIND_BUFFER, target, buffer, 0);
+    }
+
+    void bufferData(GLenum target, GLsizeiptr size, const void* /*data*/, GLenum /*usage*/) {
+        record(OP_BUFFER_DATA, target, bound[target], (GLsizei)size);
+    }
+
+    void bufferSubData(GLenum target, GLintptr /*offset*/, GLsizeiptr size, const void* /*data*/) {
+        record(OP_BUFFER_DATA, target, bound[target], (GLsizei)size);
+    }
+
+    void* mapPersistent(GLenum target, GLsizeiptr size) {
+        char*& memory = storage[bound[target]];
+        delete[] memory;
+        memory = new char[size]();
+        return memory;
+    }
+
+    // Nothing to wait for.
+    GLsync fence() {
+        return (GLsync)(uintptr_t)++nextId;
+    }
+
+    void waitFence(GLsync /*fence*/) {}
+
+    void deleteFence(GLsync /*fence*/) {}
+
+    GLuint createVertexArray() {
+        return ++nextId;
+    }
+
+    void bindVertexArray(GLuint array) {
+        record(OP_BIND_VERTEX_ARRAY, 0, array, 0);
+    }
+
+    void vertexAttrib(GLuint /*index*/, GLint /*size*/, GLenum /*type*/, GLsizei /*stride*/, size_t /*offset*/) {}
+
+    void vertexAttribInt(GLuint /*index*/, GLint /*size*/, GLenum /*type*/, GLsizei /*stride*/, size_t /*offset*/) {}
+
+    GLuint createTexture() {
+        return ++nextId;
+    }
+
+    void activeTexture(GLenum unit) {
+        record(OP_ACTIVE_TEXTURE, unit, 0, 0);
+    }
+
+    void bindTexture(GLenum target, GLuint texture) {
+        record(OP_BIND_TEXTURE, target, texture, 0);
+    }
+
+    void textureBuffer(GLenum /*format*/, GLuint /*buffer*/) {}
+
+    // what current desktop GPUs offer, well past the GL 3.2 minimum of 65536
+    GLint maxTextureBufferTexels() {
+        return 1 << 27;
+    }
+
+    GLuint compileShader(GLenum /*type*/, const char* /*source*/, const char* /*label*/) {
+        return ++nextId;
+    }
+
+    GLuint linkProgram(const GLuint* /*shaders*/, int /*count*/) {
+        return ++nextId;
+    }
+
+    void useProgram(GLuint program) {
+        record(OP_USE_PROGRAM, 0, program, 0);
+    }
+
+    void uniform(GLuint program, const char* /*name*/, UniformType type, GLsizei count, const void* /*values*/) {
+        record(OP_UNIFORM, type, program, count);
+    }
+
+    void drawArrays(GLenum mode, GLint /*first*/, GLsizei count) {
+        record(OP_DRAW, mode, 0, count);
+    }
+
+    void drawArraysInstanced(GLenum mode, GLint /*first*/, GLsizei count, GLsizei instances) {
+        record(OP_DRAW_INSTANCED, mode, 0, count, instances);
+    }
+
+    void drawElements(GLenum mode, GLsizei count, GLenum /*type*/, const void* /*indices*/) {
+        record(OP_DRAW, mode, 0, count);
+    }
+
+    void multiDrawElements(GLenum mode, const GLsizei* /*counts*/, GLenum /*type*/, const void* const* /*indices*/,
+                           GLsizei draws) {
+        record(OP_MULTI_DRAW, mode, 0, draws);
+    }
+
+    void multiDrawElementsBaseVertex(GLenum mode, const GLsizei* /*counts*/, GLenum /*type*/,
+                                     const void* const* /*indices*/, GLsizei draws, const GLint* /*baseVertex*/) {
+        record(OP_MULTI_DRAW, mode, 0, draws);
+    }
+
+    void multiDrawElementsIndirect(GLenum mode, GLenum /*type*/, const void* /*indirect*/, GLsizei draws) {
+        record(OP_DRAW_INDIRECT, mode, bound[GL_DRAW_INDIRECT_BUFFER], draws);
+    }
+
+    void drawArraysIndirect(GLenum mode, const void* /*indirect*/) {
+        record(OP_DRAW_INDIRECT, mode, bound[GL_DRAW_INDIRECT_BUFFER], 1);
+    }
+
+    void beginConditionalRender(GLuint query) {
+        record(OP_CONDITIONAL_RENDER, 0, query, 0);
+    }
+
+    void endConditionalRender() {
+        record(OP_CONDITIONAL_RENDER, 0, 0, 0);
+    }
+
+    void depthFunc(GLenum func) {
+        record(OP_DEPTH_FUNC, func, 0, 0);
+    }
+
+private:
+    GLuint nextId = 0;
+    std::map<GLenum, GLuint> bound;
+    std::map<GLuint, char*> storage;
+    std::vector<RenderCommand> recorded;
+    unsigned int perOp[OP_COUNT] = {};
+
+    void record(RenderOp op, GLenum target, GLuint object, GLsizei count, GLsizei instances = 1) {
+        RenderCommand command = { op, target, object, count, instances };
+        recorded.push_back(command);
+        perOp[op]++;
+    }
+};
+
+inline GLDevice& glDevice() {
+    static GLDevice device;
+    return device;
+}
+
+inline RenderDevice*& currentRenderDevice() {
+    static RenderDevice* device = &glDevice();
+    return device;
+}
+
+// The device the GL thread draws with, GLDevice unless changed.
+inline RenderDevice& renderDevice() {
+    return *currentRenderDevice();
+}
+
+// Returns the device it replaces.
+inline RenderDevice* setRenderDevice(RenderDevice* device) {
+    RenderDevice* previous = currentRenderDevice();
+    currentRenderDevice() = device;
+    return previous;
+}
+
+#endif
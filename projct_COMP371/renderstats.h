@@ -0,0 +1,278 @@
+// Draw calls and state changes, per frame and per pass.
+//
+//     {
+//         RENDER_PASS("shadow pass");
+//         ...
+//         counted::drawElements(GL_TRIANGLES, count, GL_UNSIGNED_INT, 0);
+//
+// The counted:: wrappers make the call on the current render device (see
+// renderdevice.h) and add it to the pass the GL thread is in (the "other"
+// pass outside of any). Shader counts its own
+// glUniform and glUseProgram calls. A program switch is a glUseProgram of a
+// program other than the current one.
+//
+// Triangles and instances are what the CPU asked for: draws whose commands
+// the GPU writes (see gpucull.h) count as calls only. endFrame() keeps the
+// frame for the HUD and, with --render-stats <file>, appends it to a CSV
+// file, one row per pass.
+
+#ifndef renderstats_h
+#define renderstats_h
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+
+#include "profiler.h"
+#include "renderdevice.h"
+
+#ifndef RENDER_STATS_ENABLED
+#define RENDER_STATS_ENABLED 1
+#endif
+
+struct RenderCounters {
+    uint64_t drawCalls = 0;
+    uint64_t triangles = 0;
+    uint64_t instances = 0;
+    uint64_t uniforms = 0;
+    uint64_t textureBinds = 0;
+    uint64_t vaoBinds = 0;
+    uint64_t programSwitches = 0;
+    uint64_t bufferBytes = 0;
+
+    void add(const RenderCounters &other) {
+        drawCalls += other.drawCalls;
+        triangles += other.triangles;
+        instances += other.instances;
+        uniforms += other.uniforms;
+        textureBinds += other.textureBinds;
+        vaoBinds += other.vaoBinds;
+        programSwitches += other.programSwitches;
+        bufferBytes += other.bufferBytes;
+    }
+};
+
+struct PassCounters {
+    const char* name;
+    RenderCounters counters;
+};
+
+class RenderStats {
+public:
+    RenderStats() {
+        PassCounters other = { "other", RenderCounters() };
+        passes.push_back(other);
+    }
+
+    // Counters of the pass being drawn.
+    RenderCounters& counters() {
+        return passes[pass].counters;
+    }
+
+    // Make name the current pass; returns the one it replaces.
+    int enter(const char* name) {
+        int previous = pass;
+        pass = find(name);
+        return previous;
+    }
+
+    void leave(int previous) {
+        pass = previous;
+    }
+
+    // glUseProgram(program) was called.
+    void useProgram(unsigned int program) {
+        if (program != currentProgram)
+            counters().programSwitches++;
+        currentProgram = program;
+    }
+
+    // Close the frame: it becomes last(), goes to the log, and the counters
+    // start over.
+    void endFrame() {
+        if (log)
+            writeRows();
+        finished = passes;
+        for (unsigned int p = 0; p < passes.size(); ++p)
+            passes[p].counters = RenderCounters();
+        ++frame;
+    }
+
+    // The passes of the last finished frame, "other" first.
+    const std::vector<PassCounters>& last() const {
+        return finished;
+    }
+
+    RenderCounters lastTotal() const {
+        RenderCounters total;
+        for (unsigned int p = 0; p < finished.size(); ++p)
+            total.add(finished[p].counters);
+        return total;
+    }
+
+    bool openLog(const std::string &path) {
+        log = std::fopen(path.c_str(), "w");
+        if (!log) {
+            std::cout << "render stats: failed to write " << path << std::endl;
+            return false;
+        }
+        std::fprintf(log, "frame,pass,draw_calls,triangles,instances,uniforms,texture_binds,vao_binds,program_switches,buffer_bytes\n");
+        return true;
+    }
+
+    void closeLog() {
+        if (log)
+            std::fclose(log);
+        log = NULL;
+    }
+
+private:
+    std::vector<PassCounters> passes;
+    std::vector<PassCounters> finished;
+    int pass = 0;
+    unsigned int currentProgram = 0;
+    unsigned long long frame = 0;
+    FILE* log = NULL;
+
+    int find(const char* name) {
+        for (unsigned int p = 0; p < passes.size(); ++p)
+            if (passes[p].name == name || std::strcmp(passes[p].name, name) == 0)
+                return p;
+        PassCounters added = { name, RenderCounters() };
+        passes.push_back(added);
+        return passes.size() - 1;
+    }
+
+    // One row per pass and one for the whole frame.
+    void writeRows() {
+        RenderCounters total;
+        for (unsigned int p = 0; p <= passes.size(); ++p) {
+            const char* name = p < passes.size() ? passes[p].name : "frame";
+            const RenderCounters &c = p < passes.size() ? passes[p].counters : total;
+            if (p < passes.size())
+                total.add(c);
+            std::fprintf(log, "%llu,%s,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu\n", frame, name,
+                         (unsigned long long)c.drawCalls, (unsigned long long)c.triangles,
+                         (unsigned long long)c.instances, (unsigned long long)c.uniforms,
+                         (unsigned long long)c.textureBinds, (unsigned long long)c.vaoBinds,
+                         (unsigned long long)c.programSwitches, (unsigned long long)c.bufferBytes);
+        }
+    }
+};
+
+inline RenderStats& renderStats() {
+    static RenderStats stats;
+    return stats;
+}
+
+// Counts into name from construction to destruction.
+class RenderPass {
+public:
+    explicit RenderPass(const char* name) : previous(renderStats().enter(name)) {}
+
+    ~RenderPass() {
+        renderStats().leave(previous);
+    }
+
+private:
+    int previous;
+};
+
+#if RENDER_STATS_ENABLED
+#define RENDER_PASS(name) RenderPass PROFILE_CONCAT(renderPass, __LINE__)(name)
+#define RENDER_COUNT(counter, n) (renderStats().counters().counter += (n))
+#else
+#define RENDER_PASS(name)
+#define RENDER_COUNT(counter, n)
+#endif
+
+// The calls the render loop makes, counted.
+namespace counted {
+
+inline uint64_t trianglesOf(GLenum mode, GLsizei count) {
+    if (mode == GL_TRIANGLES)
+        return count / 3;
+    if ((mode == GL_TRIANGLE_STRIP || mode == GL_TRIANGLE_FAN) && count > 2)
+        return count - 2;
+    return 0;
+}
+
+inline void drawArrays(GLenum mode, GLint first, GLsizei count) {
+    renderDevice().drawArrays(mode, first, count);
+    RENDER_COUNT(drawCalls, 1);
+    RENDER_COUNT(triangles, trianglesOf(mode, count));
+    RENDER_COUNT(instances, 1);
+}
+
+inline void drawArraysInstanced(GLenum mode, GLint first, GLsizei count, GLsizei instances) {
+    renderDevice().drawArraysInstanced(mode, first, count, instances);
+    RENDER_COUNT(drawCalls, 1);
+    RENDER_COUNT(triangles, trianglesOf(mode, count) * instances);
+    RENDER_COUNT(instances, instances);
+}
+
+inline void drawElements(GLenum mode, GLsizei count, GLenum type, const void* indices) {
+    renderDevice().drawElements(mode, count, type, indices);
+    RENDER_COUNT(drawCalls, 1);
+    RENDER_COUNT(triangles, trianglesOf(mode, count));
+    RENDER_COUNT(instances, 1);
+}
+
+inline void multiDrawElements(GLenum mode, const GLsizei* counts, GLenum type, const void* const* indices, GLsizei draws) {
+    renderDevice().multiDrawElements(mode, counts, type, indices, draws);
+    RENDER_COUNT(drawCalls, 1);
+    for (GLsizei d = 0; d < draws; ++d)
+        RENDER_COUNT(triangles, trianglesOf(mode, counts[d]));
+    RENDER_COUNT(instances, 1);
+}
+
+inline void multiDrawElementsBaseVertex(GLenum mode, const GLsizei* counts, GLenum type, const void* const* indices,
+                                        GLsizei draws, const GLint* baseVertex) {
+    renderDevice().multiDrawElementsBaseVertex(mode, counts, type, indices, draws, baseVertex);
+    RENDER_COUNT(drawCalls, 1);
+    for (GLsizei d = 0; d < draws; ++d)
+        RENDER_COUNT(triangles, trianglesOf(mode, counts[d]));
+    RENDER_COUNT(instances, 1);
+}
+
+// Commands in a buffer: the caller adds the triangles and instances if it
+// knows them.
+inline void multiDrawElementsIndirect(GLenum mode, GLenum type, const void* indirect, GLsizei draws) {
+    renderDevice().multiDrawElementsIndirect(mode, type, indirect, draws);
+    RENDER_COUNT(drawCalls, 1);
+}
+
+inline void drawArraysIndirect(GLenum mode, const void* indirect) {
+    renderDevice().drawArraysIndirect(mode, indirect);
+    RENDER_COUNT(drawCalls, 1);
+}
+
+inline void bindTexture(GLenum target, GLuint texture) {
+    renderDevice().bindTexture(target, texture);
+    RENDER_COUNT(textureBinds, 1);
+}
+
+inline void bindVertexArray(GLuint array) {
+    renderDevice().bindVertexArray(array);
+    if (array)
+        RENDER_COUNT(vaoBinds, 1);
+}
+
+inline void bufferData(GLenum target, GLsizeiptr size, const void* data, GLenum usage) {
+    renderDevice().bufferData(target, size, data, usage);
+    if (data)
+        RENDER_COUNT(bufferBytes, size);
+}
+
+inline void bufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void* data) {
+    renderDevice().bufferSubData(target, offset, size, data);
+    RENDER_COUNT(bufferBytes, size);
+}
+
+}
+
+#endif
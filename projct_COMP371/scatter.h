@@ -0,0 +1,135 @@
+// Deterministic object scattering.
+//
+// ChunkRNG is counter based: the n-th number of a chunk's stream is a hash of
+// (seed, cx, cy, n). No state is shared between chunks, so placement does not
+// depend on the order chunks are generated in, or on which thread does it.
+//
+// poissonDisk() is Bridson's algorithm ("Fast Poisson Disk Sampling in
+// Arbitrary Dimensions", 2007). The background grid has cells of r/sqrt(2),
+// so a cell holds at most one point and a candidate only has to be checked
+// against the 5x5 cells around it.
+
+#ifndef scatter_h
+#define scatter_h
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+// splitmix64 finalizer. Good avalanche, cheap.
+inline uint64_t mix64(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+class ChunkRNG {
+public:
+    ChunkRNG(uint64_t seed, int cx, int cy) {
+        key = mix64(mix64(mix64(seed) ^ (uint64_t)(uint32_t)cx) ^ ((uint64_t)(uint32_t)cy << 32));
+        counter = 0;
+    }
+
+    uint64_t next() {
+        return mix64(key + 0x9e3779b97f4a7c15ULL * ++counter);
+    }
+
+    // Uniform in [0, 1).
+    float uniform() {
+        return (next() >> 40) * (1.0f / 16777216.0f);
+    }
+
+private:
+    uint64_t key;
+    uint64_t counter;
+};
+
+// Grid of point indices with cells of r/sqrt(2), at most one point per cell.
+struct ScatterGrid {
+    float cellSize = 1.0f;
+    int gw = 0;
+    int gh = 0;
+    std::vector<int> cells;
+
+    void init(float w, float h, float r) {
+        cellSize = r / std::sqrt(2.0f);
+        gw = (int)std::ceil(w / cellSize);
+        gh = (int)std::ceil(h / cellSize);
+        cells.assign(gw * gh, -1);
+    }
+
+    int cellX(float x) const {
+        int c = (int)(x / cellSize);
+        return c < 0 ? 0 : (c >= gw ? gw - 1 : c);
+    }
+
+    int cellY(float y) const {
+        int c = (int)(y / cellSize);
+        return c < 0 ? 0 : (c >= gh ? gh - 1 : c);
+    }
+
+    void insert(glm::vec2 p, int index) {
+        cells[cellY(p.y) * gw + cellX(p.x)] = index;
+    }
+
+    // Index of a point closer than dist to p, -1 if there is none.
+    // dist must be at most 2*sqrt(2) cells, which covers r.
+    int findWithin(glm::vec2 p, float dist, const std::vector<glm::vec2>& points) const {
+        int cx = cellX(p.x), cy = cellY(p.y);
+        int reach = (int)std::ceil(dist / cellSize);
+        for (int y = std::max(cy - reach, 0); y <= std::min(cy + reach, gh - 1); ++y)
+            for (int x = std::max(cx - reach, 0); x <= std::min(cx + reach, gw - 1); ++x) {
+                int i = cells[y * gw + x];
+                if (i >= 0) {
+                    glm::vec2 d = points[i] - p;
+                    if (d.x*d.x + d.y*d.y < dist*dist)
+                        return i;
+                }
+            }
+        return -1;
+    }
+};
+
+// Points in [0,w) x [0,h), no two closer than r. k candidates are tried
+// around each active point before it is retired.
+inline std::vector<glm::vec2> poissonDisk(float w, float h, float r, ChunkRNG& rng, int k = 30) {
+    std::vector<glm::vec2> points;
+    std::vector<int> active;
+    ScatterGrid grid;
+    grid.init(w, h, r);
+
+    glm::vec2 first(rng.uniform() * w, rng.uniform() * h);
+    points.push_back(first);
+    active.push_back(0);
+    grid.insert(first, 0);
+
+    while (!active.empty()) {
+        int a = (int)(rng.uniform() * active.size());
+        glm::vec2 origin = points[active[a]];
+        bool found = false;
+        for (int i = 0; i < k; ++i) {
+            // Uniform in the annulus [r, 2r).
+            float angle = 6.28318530718f * rng.uniform();
+            float dist = r * std::sqrt(1.0f + 3.0f * rng.uniform());
+            glm::vec2 p(origin.x + dist * std::cos(angle), origin.y + dist * std::sin(angle));
+            if (p.x < 0.0f || p.x >= w || p.y < 0.0f || p.y >= h)
+                continue;
+            if (grid.findWithin(p, r, points) >= 0)
+                continue;
+            grid.insert(p, (int)points.size());
+            active.push_back((int)points.size());
+            points.push_back(p);
+            found = true;
+            break;
+        }
+        if (!found) {
+            active[a] = active.back();
+            active.pop_back();
+        }
+    }
+    return points;
+}
+
+#endif
@@ -13,6 +13,9 @@
 #include <sstream>
 #include <iostream>
 
+#include "renderdevice.h"
+#include "renderstats.h"
+
 class Shader
 {
 public:
@@ -58,131 +61,115 @@ public:
         {
             std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ: " << e.what() << std::endl;
         }
-        const char* vShaderCode = vertexCode.c_str();
-        const char * fShaderCode = fragmentCode.c_str();
-        
-        unsigned int vertex, fragment;
-        
-        vertex = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertex, 1, &vShaderCode, NULL);
-        glCompileShader(vertex);
-        checkCompileErrors(vertex, "VERTEX");
-        
-        fragment = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragment, 1, &fShaderCode, NULL);
-        glCompileShader(fragment);
-        checkCompileErrors(fragment, "FRAGMENT");
-        
-        unsigned int geometry;
+        // compiled and linked by the render device, see renderdevice.h
+        unsigned int shaders[3];
+        int count = 0;
+        shaders[count++] = renderDevice().compileShader(GL_VERTEX_SHADER, vertexCode.c_str(), "VERTEX");
+        shaders[count++] = renderDevice().compileShader(GL_FRAGMENT_SHADER, fragmentCode.c_str(), "FRAGMENT");
         if(geometryPath != nullptr)
+            shaders[count++] = renderDevice().compileShader(GL_GEOMETRY_SHADER, geometryCode.c_str(), "GEOMETRY");
+        ID = renderDevice().linkProgram(shaders, count);
+    }
+
+    // A compute program (GL 4.3).
+    explicit Shader(const char* computePath)
+    {
+        std::string computeCode;
+        std::ifstream cShaderFile;
+        cShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
+        try
         {
-            const char * gShaderCode = geometryCode.c_str();
-            geometry = glCreateShader(GL_GEOMETRY_SHADER);
-            glShaderSource(geometry, 1, &gShaderCode, NULL);
-            glCompileShader(geometry);
-            checkCompileErrors(geometry, "GEOMETRY");
+            cShaderFile.open(computePath);
+            std::stringstream cShaderStream;
+            cShaderStream << cShaderFile.rdbuf();
+            cShaderFile.close();
+            computeCode = cShaderStream.str();
         }
-        
-        ID = glCreateProgram();
-        glAttachShader(ID, vertex);
-        glAttachShader(ID, fragment);
-        if(geometryPath != nullptr)
-            glAttachShader(ID, geometry);
-        glLinkProgram(ID);
-        checkCompileErrors(ID, "PROGRAM");
-        
-        glDeleteShader(vertex);
-        glDeleteShader(fragment);
-        if(geometryPath != nullptr)
-            glDeleteShader(geometry);
-
+        catch (std::ifstream::failure& e)
+        {
+            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ: " << e.what() << std::endl;
+        }
+        unsigned int compute = renderDevice().compileShader(GL_COMPUTE_SHADER, computeCode.c_str(), "COMPUTE");
+        ID = renderDevice().linkProgram(&compute, 1);
     }
-    
+
     void use()
     {
-        glUseProgram(ID);
+        renderDevice().useProgram(ID);
+        renderStats().useProgram(ID);
     }
     
     void setBool(const std::string &name, bool value) const
     {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+        int i = value;
+        renderDevice().uniform(ID, name.c_str(), UNIFORM_INT, 1, &i);
+        RENDER_COUNT(uniforms, 1);
     }
     
     void setInt(const std::string &name, int value) const
     {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+        renderDevice().uniform(ID, name.c_str(), UNIFORM_INT, 1, &value);
+        RENDER_COUNT(uniforms, 1);
     }
     
     void setFloat(const std::string &name, float value) const
     {
-        glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+        renderDevice().uniform(ID, name.c_str(), UNIFORM_FLOAT, 1, &value);
+        RENDER_COUNT(uniforms, 1);
     }
     
     void setVec2(const std::string &name, const glm::vec2 &value) const
     {
-        glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+        renderDevice().uniform(ID, name.c_str(), UNIFORM_VEC2, 1, &value[0]);
+        RENDER_COUNT(uniforms, 1);
     }
     void setVec2(const std::string &name, float x, float y) const
     {
-        glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y);
+        float v[2] = { x, y };
+        renderDevice().uniform(ID, name.c_str(), UNIFORM_VEC2, 1, v);
+        RENDER_COUNT(uniforms, 1);
     }
     
     void setVec3(const std::string &name, const glm::vec3 &value) const
     {
-        glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+        renderDevice().uniform(ID, name.c_str(), UNIFORM_VEC3, 1, &value[0]);
+        RENDER_COUNT(uniforms, 1);
     }
     void setVec3(const std::string &name, float x, float y, float z) const
     {
-        glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
+        float v[3] = { x, y, z };
+        renderDevice().uniform(ID, name.c_str(), UNIFORM_VEC3, 1, v);
+        RENDER_COUNT(uniforms, 1);
     }
     
     void setVec4(const std::string &name, const glm::vec4 &value) const
     {
-        glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+        renderDevice().uniform(ID, name.c_str(), UNIFORM_VEC4, 1, &value[0]);
+        RENDER_COUNT(uniforms, 1);
     }
     void setVec4(const std::string &name, float x, float y, float z, float w)
     {
-        glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w);
+        float v[4] = { x, y, z, w };
+        renderDevice().uniform(ID, name.c_str(), UNIFORM_VEC4, 1, v);
+        RENDER_COUNT(uniforms, 1);
     }
     
     void setMat2(const std::string &name, const glm::mat2 &mat) const
     {
-        glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        renderDevice().uniform(ID, name.c_str(), UNIFORM_MAT2, 1, &mat[0][0]);
+        RENDER_COUNT(uniforms, 1);
     }
     
     void setMat3(const std::string &name, const glm::mat3 &mat) const
     {
-        glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        renderDevice().uniform(ID, name.c_str(), UNIFORM_MAT3, 1, &mat[0][0]);
+        RENDER_COUNT(uniforms, 1);
     }
     
     void setMat4(const std::string &name, const glm::mat4 &mat) const
     {
-        glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
-    }
-
-private:
-    void checkCompileErrors(GLuint shader, std::string type)
-    {
-        GLint success;
-        GLchar infoLog[1024];
-        if(type != "PROGRAM")
-        {
-            glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
-            if(!success)
-            {
-                glGetShaderInfoLog(shader, 1024, NULL, infoLog);
-                std::cout << "ERROR::SHADER_COMPILATION_ERROR of type: " << type << "\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
-            }
-        }
-        else
-        {
-            glGetProgramiv(shader, GL_LINK_STATUS, &success);
-            if(!success)
-            {
-                glGetProgramInfoLog(shader, 1024, NULL, infoLog);
-                std::cout << "ERROR::PROGRAM_LINKING_ERROR of type: " << type << "\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
-            }
-        }
+        renderDevice().uniform(ID, name.c_str(), UNIFORM_MAT4, 1, &mat[0][0]);
+        RENDER_COUNT(uniforms, 1);
     }
 };
 #endif
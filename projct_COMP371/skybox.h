@@ -3,8 +3,20 @@
 
 #include <GL/glew.h>
 
+#include <chrono>
+#include <future>
+
+#include "draw.h"
+#include "gputimer.h"
+#include "threadpool.h"
+
 // This is just a simple container for skybox vertices and data
 // Used to create and render skyboxes.
+//
+// A skybox made from a face list is deferred: prefetch() decodes the faces
+// on the thread pool, load() uploads them once they are decoded, release()
+// gives the cubemap back to the texture cache. The cubemap goes through the
+// texture cache, so a set that is still resident is not decoded again.
 
 const float skyboxVertices[] = {
         -1.0f,  1.0f, -1.0f,
@@ -60,26 +72,112 @@ public:
                    back_path, front_path,
                    top_path, bottom_path);
     }
-    void init_skybox(char const * left_path, char const * right_path,
-                     char const * back_path, char const * front_path,
-                     char const * top_path, char const * bottom_path){
-        glGenVertexArrays(1, &skyboxVAO);
-        glGenBuffers(1, &skyboxVBO);
-        glBindVertexArray(skyboxVAO);
-        glBindBuffer(GL_ARRAY_BUFFER, skyboxVBO);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(skyboxVertices), &skyboxVertices, GL_STATIC_DRAW);
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+    // From a cubemap that was already uploaded (see AssetLoader).
+    Skybox(unsigned int cubemap) {
+        init_vertices();
+        cubemapTexture = cubemap;
+    }
+    // Deferred, see prefetch() and load().
+    Skybox(const std::vector<std::string> &cubemapFaces) {
+        init_vertices();
+        faces = cubemapFaces;
+        cubemapTexture = 0;
+    }
+    // Start decoding the faces in the background, if not already loading.
+    void prefetch() {
+        if (entry)
+            return;
+        bool decode;
+        entry = textureCache().request(TextureCache::keyCubemap(faces), faces[0], decode);
+        if (!decode)
+            return;
+        CachedTexture* target = entry;
+        std::vector<std::string> paths = faces;
+        target->images.resize(paths.size());
+        decoding = threadPool().submit([target, paths]() {
+            threadPool().parallelFor((int)paths.size(), [&](int i) {
+                target->images[i] = decodeImage(paths[i]);
+            });
+        });
+    }
+    // True once the cubemap is on the GPU. Starts the decode if needed and
+    // uploads when it is done; with wait, blocks until then. GL thread only.
+    bool load(bool wait = false) {
+        if (cubemapTexture)
+            return true;
+        prefetch();
+        if (decoding.valid()) {
+            if (!wait && decoding.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+                return false;
+            decoding.get();
+        }
+        cubemapTexture = uploadCachedCubemap(entry);
+        lastShown = std::chrono::steady_clock::now();
+        return true;
+    }
+    bool loaded() const {
+        return cubemapTexture != 0;
+    }
+    // Seconds since the skybox was last rendered (or loaded).
+    double idleSeconds() const {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - lastShown).count();
+    }
+    // Drop the cubemap. load() brings it back.
+    void release() {
+        if (!cubemapTexture)
+            return;
+        textureCache().release(cubemapTexture);
+        cubemapTexture = 0;
+        entry = NULL;
+    }
+    // Faces in the order the constructor wants them, as cubemap order.
+    static std::vector<std::string> faceOrder(char const * left_path, char const * right_path,
+                                              char const * back_path, char const * front_path,
+                                              char const * top_path, char const * bottom_path) {
         std::vector<std::string> faces
         {
             right_path, left_path,
             top_path, bottom_path,
             front_path, back_path
         };
-        cubemapTexture = loadCubemap(faces);
+        return faces;
+    }
+    static std::vector<std::string> dayFaces() {
+        return faceOrder("assets/textures/skyboxes/d_left.bmp",
+                         "assets/textures/skyboxes/d_right.bmp",
+                         "assets/textures/skyboxes/d_back.bmp",
+                         "assets/textures/skyboxes/d_front.bmp",
+                         "assets/textures/skyboxes/d_top.bmp",
+                         "assets/textures/skyboxes/d_bottom.bmp");
+    }
+    static std::vector<std::string> nightFaces() {
+        return faceOrder("assets/textures/skyboxes/space/space_left.png",
+                         "assets/textures/skyboxes/space/space_right.png",
+                         "assets/textures/skyboxes/space/space_back.png",
+                         "assets/textures/skyboxes/space/space_front.png",
+                         "assets/textures/skyboxes/space/space_top.png",
+                         "assets/textures/skyboxes/space/space_bottom.png");
+    }
+    void init_skybox(char const * left_path, char const * right_path,
+                     char const * back_path, char const * front_path,
+                     char const * top_path, char const * bottom_path){
+        init_vertices();
+        cubemapTexture = loadCubemap(faceOrder(left_path, right_path, back_path, front_path, top_path, bottom_path));
+    }
+    void init_vertices() {
+        skyboxVAO = renderDevice().createVertexArray();
+        skyboxVBO = renderDevice().createBuffer();
+        renderDevice().bindVertexArray(skyboxVAO);
+        renderDevice().bindBuffer(GL_ARRAY_BUFFER, skyboxVBO);
+        renderDevice().bufferData(GL_ARRAY_BUFFER, sizeof(skyboxVertices), &skyboxVertices, GL_STATIC_DRAW);
+        renderDevice().vertexAttrib(0, 3, GL_FLOAT, 3 * sizeof(float), 0);
     }
     void render(Camera* c, Shader* s, int sWIDTH, int sHEIGHT) {
-        glDepthFunc(GL_LEQUAL);
+        PROFILE_ZONE("skybox");
+        GPU_ZONE("skybox");
+        RENDER_PASS("skybox");
+        lastShown = std::chrono::steady_clock::now();
+        renderDevice().depthFunc(GL_LEQUAL);
 
         s->use();
         glm::mat4 view = glm::mat4(glm::mat3(c->GetViewMatrix()));
@@ -88,45 +186,19 @@ public:
         s->setMat4("view", view);
         s->setMat4("projection", projection);
         // skybox cube
-        glBindVertexArray(skyboxVAO);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
-        glDrawArrays(GL_TRIANGLES, 0, 36);
-        glBindVertexArray(0);
-        glDepthFunc(GL_LESS);
+        counted::bindVertexArray(skyboxVAO);
+        renderDevice().activeTexture(GL_TEXTURE0);
+        counted::bindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
+        counted::drawArrays(GL_TRIANGLES, 0, 36);
+        renderDevice().bindVertexArray(0);
+        renderDevice().depthFunc(GL_LESS);
 
     }
 private:
     std::vector<std::string> faces;
     unsigned int cubemapTexture;
-    unsigned int loadCubemap(vector<std::string> faces)
-    {
-        unsigned int textureID;
-        glGenTextures(1, &textureID);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
-
-        int width, height, nrComponents;
-        for (unsigned int i = 0; i < faces.size(); i++)
-        {
-            unsigned char *data = stbi_load(faces[i].c_str(), &width, &height, &nrComponents, 0);
-            if (data)
-            {
-                glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-                stbi_image_free(data);
-            }
-            else
-            {
-                std::cout << "Cubemap texture failed to load at path: " << faces[i] << std::endl;
-                stbi_image_free(data);
-            }
-        }
-        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-
-        return textureID;
-    }
+    CachedTexture* entry = NULL;
+    std::future<void> decoding;
+    std::chrono::steady_clock::time_point lastShown = std::chrono::steady_clock::now();
 };
 #endif
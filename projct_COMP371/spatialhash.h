@@ -0,0 +1,75 @@
+// Uniform grid spatial hash over object footprints.
+//
+// Positions are bucketed by grid cell, cells are hashed into a power of two
+// table and the table is laid out CSR style (counting sort), so a query reads
+// a few short contiguous runs and never allocates. Built once per change of
+// the loaded neighbourhood; queries are O(1) for radii up to the cell size.
+
+#ifndef spatialhash_h
+#define spatialhash_h
+
+#include <cmath>
+#include <vector>
+#include <glm/glm.hpp>
+
+class SpatialHash {
+public:
+    void build(const std::vector<glm::vec2>& points, float cell) {
+        cellSize = cell;
+        invCell = 1.0f / cell;
+        unsigned int buckets = 16;
+        while (buckets < 2 * points.size())
+            buckets <<= 1;
+        mask = buckets - 1;
+
+        bucketStart.assign(buckets + 1, 0);
+        for (int i = 0; i < points.size(); ++i)
+            ++bucketStart[bucketOf(cellOf(points[i].x), cellOf(points[i].y)) + 1];
+        for (unsigned int b = 0; b < buckets; ++b)
+            bucketStart[b + 1] += bucketStart[b];
+
+        items.resize(points.size());
+        std::vector<unsigned int> fill(bucketStart.begin(), bucketStart.end() - 1);
+        for (int i = 0; i < points.size(); ++i)
+            items[fill[bucketOf(cellOf(points[i].x), cellOf(points[i].y))]++] = points[i];
+    }
+
+    // True if any point lies closer than r to p. r must not exceed the cell size.
+    bool anyWithin(glm::vec2 p, float r) const {
+        if (items.empty())
+            return false;
+        int cx = cellOf(p.x), cy = cellOf(p.y);
+        float r2 = r * r;
+        for (int y = cy - 1; y <= cy + 1; ++y)
+            for (int x = cx - 1; x <= cx + 1; ++x) {
+                unsigned int b = bucketOf(x, y);
+                for (unsigned int i = bucketStart[b]; i < bucketStart[b + 1]; ++i) {
+                    float dx = items[i].x - p.x, dy = items[i].y - p.y;
+                    if (dx*dx + dy*dy < r2)
+                        return true;
+                }
+            }
+        return false;
+    }
+
+    size_t size() const {
+        return items.size();
+    }
+
+private:
+    float cellSize = 1.0f;
+    float invCell = 1.0f;
+    unsigned int mask = 0;
+    std::vector<unsigned int> bucketStart;
+    std::vector<glm::vec2> items;
+
+    int cellOf(float v) const {
+        return (int)std::floor(v * invCell);
+    }
+
+    unsigned int bucketOf(int x, int y) const {
+        return ((unsigned int)x * 73856093u ^ (unsigned int)y * 19349663u) & mask;
+    }
+};
+
+#endif
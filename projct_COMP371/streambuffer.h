@@ -0,0 +1,114 @@
+// Persistently mapped GPU arena.
+//
+// One big buffer object is mapped once for the lifetime of the program and
+// carved into fixed size slots. Callers write straight into the mapped
+// memory, so there is no intermediate std::vector and no glBufferData copy.
+// A slot that is handed back gets a fence; it is only reused once the GPU is
+// done reading from it. Free slots are recycled in FIFO order, so the oldest
+// (most likely already signaled) fence is the one we wait on.
+
+#ifndef streambuffer_h
+#define streambuffer_h
+
+#include <GL/glew.h>
+
+#include <deque>
+#include <vector>
+#include <iostream>
+
+#include "renderdevice.h"
+#include "renderstats.h"
+
+class StreamArena {
+public:
+    unsigned int buffer = 0;
+    bool persistent = false;
+
+    StreamArena(GLenum target, size_t slotBytes, unsigned int slotCount) {
+        this->target = target;
+        this->slotBytes = slotBytes;
+        this->slotCount = slotCount;
+        fences.assign(slotCount, (GLsync)0);
+        for (unsigned int i = 0; i < slotCount; ++i)
+            freeSlots.push_back(i);
+
+        buffer = renderDevice().createBuffer();
+        renderDevice().bindBuffer(target, buffer);
+        GLsizeiptr size = (GLsizeiptr)(slotBytes * slotCount);
+        // GL 4.4 (or ARB_buffer_storage) gives us an immutable store that can
+        // stay mapped while we draw from it. Older contexts (macOS tops out at
+        // 4.1) fall back to a CPU staging copy uploaded with glBufferSubData.
+        mapped = (char*)renderDevice().mapPersistent(target, size);
+        persistent = mapped != NULL;
+        if (!persistent) {
+            renderDevice().bufferData(target, size, NULL, GL_DYNAMIC_DRAW);
+            staging.resize(slotBytes * slotCount);
+            mapped = &staging[0];
+        }
+        renderDevice().bindBuffer(target, 0);
+    }
+
+    // Grab a slot to write into. Blocks only if the GPU is still reading the
+    // slot from the last time it was used. Returns -1 if the arena is full.
+    int acquire() {
+        if (freeSlots.empty()) {
+            std::cout << "StreamArena: out of slots (" << slotCount << ")" << std::endl;
+            return -1;
+        }
+        int slot = freeSlots.front();
+        freeSlots.pop_front();
+        if (fences[slot]) {
+            renderDevice().waitFence(fences[slot]);
+            renderDevice().deleteFence(fences[slot]);
+            fences[slot] = 0;
+        }
+        return slot;
+    }
+
+    // Mapped memory of a slot. Write the data here, then commit().
+    void* slotPtr(int slot) {
+        return mapped + slotBytes * slot;
+    }
+
+    // Byte offset of a slot inside the buffer object.
+    size_t slotOffset(int slot) const {
+        return slotBytes * slot;
+    }
+
+    // Make the slot's contents visible to the GPU. The mapping is coherent, so
+    // this only does work on the fallback path.
+    void commit(int slot) {
+        RENDER_COUNT(bufferBytes, slotBytes);
+        if (persistent)
+            return;
+        renderDevice().bindBuffer(target, buffer);
+        renderDevice().bufferSubData(target, slotOffset(slot), slotBytes, slotPtr(slot));
+        renderDevice().bindBuffer(target, 0);
+    }
+
+    // Hand a slot back. Draws already issued may still read from it, so it is
+    // fenced and goes to the back of the queue.
+    void release(int slot) {
+        if (slot < 0)
+            return;
+        if (fences[slot])
+            renderDevice().deleteFence(fences[slot]);
+        fences[slot] = renderDevice().fence();
+        freeSlots.push_back(slot);
+    }
+
+    size_t getSlotBytes() const {
+        return slotBytes;
+    }
+
+private:
+    GLenum target;
+    size_t slotBytes;
+    unsigned int slotCount;
+    char* mapped = NULL;
+    std::vector<char> staging;
+    std::vector<GLsync> fences;
+    std::deque<int> freeSlots;
+};
+
+#endif
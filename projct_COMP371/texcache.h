@@ -0,0 +1,162 @@
+// Decoded images and the process wide texture cache.
+//
+// Every texture the program loads (model materials, loadTexture, cubemaps)
+// goes through textureCache(), keyed by canonical path and load parameters,
+// so the same image is decoded and uploaded once no matter how many models
+// or loaders ask for it. Entries are reference counted by GL id; the texture
+// is deleted when the last reference is released. Only skyboxes and
+// impostors release theirs: model materials and the world's ground texture
+// are kept for the whole run, so their counts never reach zero.
+//
+// Requesting an entry is thread safe and tells exactly one caller to decode
+// it, so parallel loaders (AssetLoader) don't decode duplicates either. The
+// upload still happens on the GL thread.
+
+#ifndef texcache_h
+#define texcache_h
+
+#include <GL/glew.h>
+
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "ctex.h"
+
+// A decoded image that is not on the GPU yet. Decoding is thread safe, the
+// upload has to happen on the GL thread. If a baked .ctex exists, pixels
+// points at its first level inside the mapping and baked holds the rest.
+struct ImageData {
+    std::string path;
+    unsigned char* pixels = NULL;
+    CtexImage* baked = NULL;
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+};
+ImageData decodeImage(const std::string &path);
+void freeImage(ImageData &image);
+
+// Absolute path with . and .. resolved, so two spellings of a file share an
+// entry. The path itself if the file doesn't exist.
+inline std::string canonicalPath(const std::string &path) {
+#ifdef _WIN32
+    char resolved[_MAX_PATH];
+    if (_fullpath(resolved, path.c_str(), _MAX_PATH))
+        return resolved;
+#else
+    char resolved[PATH_MAX];
+    if (realpath(path.c_str(), resolved))
+        return resolved;
+#endif
+    return path;
+}
+
+struct CachedTexture {
+    std::string key;
+    std::string label;
+    unsigned int id = 0;
+    int refs = 0;
+    size_t bytes = 0;
+    // decoded by whoever created the entry, freed once uploaded
+    std::vector<ImageData> images;
+};
+
+class TextureCache {
+public:
+    static std::string key2D(const std::string &path, GLint minFilter, GLint magFilter) {
+        return "2d " + std::to_string(minFilter) + " " + std::to_string(magFilter) + " " + canonicalPath(path);
+    }
+
+    static std::string keyCubemap(const std::vector<std::string> &faces) {
+        std::string key = "cube";
+        for (unsigned int i = 0; i < faces.size(); ++i)
+            key += " " + canonicalPath(faces[i]);
+        return key;
+    }
+
+    // The entry for key with one more reference, created if needed. decode is
+    // set for the one caller that created it, which has to fill in images.
+    CachedTexture* request(const std::string &key, const std::string &label, bool &decode) {
+        std::lock_guard<std::mutex> guard(mutex);
+        std::unordered_map<std::string, CachedTexture>::iterator it = byKey.find(key);
+        decode = it == byKey.end();
+        CachedTexture &entry = decode ? byKey[key] : it->second;
+        if (decode) {
+            entry.key = key;
+            entry.label = label;
+        }
+        ++entry.refs;
+        return &entry;
+    }
+
+    // Called on the GL thread once the entry's texture exists.
+    void resident(CachedTexture* entry, unsigned int id, size_t bytes) {
+        std::lock_guard<std::mutex> guard(mutex);
+        entry->id = id;
+        entry->bytes = bytes;
+        byId[id] = entry;
+    }
+
+    // One more reference to a texture that is already resident.
+    void retain(unsigned int id) {
+        std::lock_guard<std::mutex> guard(mutex);
+        std::unordered_map<unsigned int, CachedTexture*>::iterator it = byId.find(id);
+        if (it != byId.end())
+            ++it->second->refs;
+    }
+
+    // Drop a reference. The last one deletes the texture (GL thread only).
+    void release(unsigned int id) {
+        std::lock_guard<std::mutex> guard(mutex);
+        std::unordered_map<unsigned int, CachedTexture*>::iterator it = byId.find(id);
+        if (it == byId.end() || --it->second->refs > 0)
+            return;
+        glDeleteTextures(1, &id);
+        byKey.erase(it->second->key);
+        byId.erase(it);
+    }
+
+    size_t residentBytes() {
+        std::lock_guard<std::mutex> guard(mutex);
+        size_t total = 0;
+        for (std::unordered_map<unsigned int, CachedTexture*>::iterator it = byId.begin(); it != byId.end(); ++it)
+            total += it->second->bytes;
+        return total;
+    }
+
+    // Resident textures, largest first.
+    void report() {
+        std::lock_guard<std::mutex> guard(mutex);
+        std::vector<CachedTexture*> entries;
+        size_t total = 0;
+        for (std::unordered_map<unsigned int, CachedTexture*>::iterator it = byId.begin(); it != byId.end(); ++it) {
+            entries.push_back(it->second);
+            total += it->second->bytes;
+        }
+        std::sort(entries.begin(), entries.end(), [](const CachedTexture* a, const CachedTexture* b) {
+            return a->bytes > b->bytes;
+        });
+        std::cout << "Textures: " << entries.size() << " resident, " << total / 1024 << " KiB" << std::endl;
+        for (unsigned int i = 0; i < entries.size(); ++i)
+            std::cout << "  " << entries[i]->bytes / 1024 << " KiB  x" << entries[i]->refs
+                      << "  " << entries[i]->label << std::endl;
+    }
+
+private:
+    std::mutex mutex;
+    std::unordered_map<std::string, CachedTexture> byKey;
+    std::unordered_map<unsigned int, CachedTexture*> byId;
+};
+
+inline TextureCache& textureCache() {
+    static TextureCache cache;
+    return cache;
+}
+
+#endif
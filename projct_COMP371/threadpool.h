@@ -0,0 +1,139 @@
+// Small worker pool shared by the whole program.
+//
+// parallelFor() is the main entry point. The calling thread works on the
+// loop too, so it is safe to nest (a chunk generated on a worker can itself
+// split its rows across the pool): if every worker is busy the caller simply
+// does all the work.
+
+#ifndef threadpool_h
+#define threadpool_h
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "profiler.h"
+
+class ThreadPool {
+public:
+    ThreadPool(unsigned int n) {
+        for (unsigned int i = 0; i < n; ++i)
+            workers.push_back(std::thread([this] { workerLoop(); }));
+    }
+
+    ~ThreadPool() {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (unsigned int i = 0; i < workers.size(); ++i)
+            workers[i].join();
+    }
+
+    unsigned int size() const {
+        return (unsigned int)workers.size();
+    }
+
+    // Run a task in the background.
+    std::future<void> submit(std::function<void()> task) {
+        std::shared_ptr<std::packaged_task<void()> > job(new std::packaged_task<void()>(task));
+        std::future<void> result = job->get_future();
+        push([job] { (*job)(); });
+        return result;
+    }
+
+    // Call fn(i) for every i in [0, count), spread over the pool. At most
+    // maxThreads threads (caller included) take part, 0 means all of them.
+    void parallelFor(int count, std::function<void(int)> fn, unsigned int maxThreads = 0) {
+        if (count <= 0)
+            return;
+        unsigned int helpers = size();
+        if (maxThreads > 0 && maxThreads - 1 < helpers)
+            helpers = maxThreads - 1;
+        if (helpers > (unsigned int)count - 1)
+            helpers = count - 1;
+        if (helpers == 0) {
+            for (int i = 0; i < count; ++i)
+                fn(i);
+            return;
+        }
+
+        std::shared_ptr<Batch> batch(new Batch());
+        batch->count = count;
+        batch->fn = fn;
+        for (unsigned int i = 0; i < helpers; ++i)
+            push([batch] { batch->run(); });
+        batch->run();
+
+        std::unique_lock<std::mutex> lock(batch->mutex);
+        batch->finished.wait(lock, [&batch] { return batch->done.load() == batch->count; });
+    }
+
+private:
+    struct Batch {
+        std::atomic<int> next;
+        std::atomic<int> done;
+        int count;
+        std::function<void(int)> fn;
+        std::mutex mutex;
+        std::condition_variable finished;
+
+        Batch() : next(0), done(0), count(0) {}
+
+        void run() {
+            int i;
+            while ((i = next.fetch_add(1)) < count) {
+                fn(i);
+                if (done.fetch_add(1) + 1 == count) {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    finished.notify_all();
+                }
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()> > queue;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    void push(std::function<void()> task) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            queue.push_back(task);
+        }
+        wake.notify_one();
+    }
+
+    void workerLoop() {
+        profiler().nameThread("worker");
+        for (;;) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return stopping || !queue.empty(); });
+                if (stopping && queue.empty())
+                    return;
+                task = queue.front();
+                queue.pop_front();
+            }
+            task();
+        }
+    }
+};
+
+// The program wide pool. One thread is left for the caller.
+inline ThreadPool& threadPool() {
+    static ThreadPool pool(std::thread::hardware_concurrency() > 1 ? std::thread::hardware_concurrency() - 1 : 1);
+    return pool;
+}
+
+#endif
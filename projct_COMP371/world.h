@@ -2,6 +2,9 @@
 #define world_h
 
 #include "chunk.h"
+#include "log.h"
+#include "occlusionquery.h"
+#include "spatialhash.h"
 #include <vector>
 #include <glm/glm.hpp>
 
@@ -16,21 +19,58 @@ enum ORIENTATION {
 // A world
 class world {
 public:
-    // constructor.
-    world(int pos_x, int pos_y, int width, int height, int VD,  OpenSimplexNoise::Noise* n) {
+    // Model paths, in the order the assets are expected by the constructor.
+    static std::vector<std::string> largeAssetPaths() {
+        std::vector<std::string> paths = {
+            "assets/models/trees/oak/oak.obj",
+            "assets/models/trees/poplar/poplar.obj",
+            "assets/models/trees/pine/pine.obj",
+            "assets/models/trees/plum/plum.obj",
+            "assets/models/trees/maple/maple.obj",
+            "assets/models/trees/ash/ash.obj"
+        };
+        return paths;
+    }
+    static std::vector<std::string> smallAssetPaths() {
+        std::vector<std::string> paths = {
+            "assets/models/small/stump/stump.obj",
+            "assets/models/small/rock/rock.obj"
+        };
+        return paths;
+    }
+    static const char* groundTexturePath() {
+        return "assets/textures/surfaces/grass.jpg";
+    }
+    
+    // constructor. Assets are loaded beforehand (see AssetLoader) so that
+    // startup can decode them in parallel.
+    world(int pos_x, int pos_y, int width, int height, int VD,  OpenSimplexNoise::Noise* n, uint64_t s,
+          const vector<Model>& large, const vector<Model>& small, unsigned int groundTexture) {
+        largeAssets = large;
+        smallAssets = small;
+        // one more reference, never released: the ground is kept for the
+        // whole run (see texcache.h)
+        woodTexture = groundTexture;
+        textureCache().retain(woodTexture);
         noise = n;
+        seed = s;
         posX = pos_x;
         posY = pos_y;
         cellWidth = width;
         cellHeight = height;
         vd = VD;
         nose = n;
+        // Twice the visible set, so chunks scrolling out of view can stay
+        // fenced while the ones scrolling in are meshed.
+        terrain.init(width+1, height+1, 2*(2*vd+1)*(2*vd+1));
         loadChunks();
     }
     
-    // Returns true if position is valid for the currently selected chunk.
+    // Returns true if position is not inside any object. pos is relative to
+    // the current chunk; the hash covers every loaded chunk, so objects just
+    // across a chunk edge count too.
     bool isValid(glm::vec3 pos) {
-        return cChunk->isValid(pos);
+        return !objectHash.anyWithin(glm::vec2(pos.x, pos.z), 1.0f);
     }
     
     // Player moved to another chunk. Shift current chunk accordingly.
@@ -54,6 +94,37 @@ public:
         loadChunks();
     }
     
+    // Move the current chunk one chunk towards the one holding p (x and z
+    // from the corner of chunk (0, 0), like camera paths). False, without
+    // moving, once p is in the current chunk.
+    bool stepTowards(glm::vec2 p) {
+        glm::vec2 local = p - origin();
+        if (local.x < 0.0f)
+            updatePos(WEST);
+        else if (local.x >= cellWidth)
+            updatePos(EAST);
+        else if (local.y < 0.0f)
+            updatePos(SOUTH);
+        else if (local.y >= cellHeight)
+            updatePos(NORTH);
+        else
+            return false;
+        return true;
+    }
+    
+    // Select the terrain path: 16 bit heights pulled in the vertex shader, or
+    // full interleaved vertices. The compact one only where its texture
+    // buffer fits.
+    void setCompactTerrain(bool b) {
+        terrain.compact = b && terrain.compactFits;
+    }
+    
+    // Corner of the current chunk in the world, x and z. Positions relative
+    // to the current chunk plus this are stable across chunk changes.
+    glm::vec2 origin() const {
+        return glm::vec2((posX + vd)*cellWidth, (posY + vd)*cellHeight);
+    }
+    
     // Interpolate from current chunk
     double interpolateHeight(float x, float y) {
         return cChunk->interpolateHeight(x,y);
@@ -61,6 +132,8 @@ public:
     
     // Load chunks if they exist, generate them if thye dont.
     void loadChunks() {
+        PROFILE_ZONE("loadChunks");
+        uint64_t loadStart = profilerNanos();
         dXs.clear();
         dYs.clear();
         dWorlds.clear();
@@ -75,45 +148,223 @@ public:
             for (int j = 0; j < 2*vd + 1; ++j)
                 woah[i][j] = false;
         
+        // Indices into worlds of the displayed chunks. Pointers are only taken
+        // once generation is done, since worlds may reallocate.
+        std::vector<int> dIdx;
         for (int i = 0; i < Xs.size(); ++i) {
             if (Xs[i]-posX < 2*vd+1 && Xs[i]-posX >= 0 && Ys[i]-posY < 2*vd+1 && Ys[i]-posY >= 0) {
-                std::cout << "Loading chunk (" << Xs[i] <<","<<Ys[i]<<")"<<std::endl;
+                LOG_DEBUG("Loading chunk ({},{})", Xs[i], Ys[i]);
                 dXs.push_back(Xs[i]);
                 dYs.push_back(Ys[i]);
-                dWorlds.push_back(worlds[i]);
+                dIdx.push_back(i);
                 woah[Xs[i]-posX][Ys[i]-posY] = true;
             }
+            // Out of view: its terrain slot can go back to the arena.
+            else if (worlds[i].isMeshed())
+                worlds[i].releaseMesh(terrain);
         }
         
+        // Chunks only depend on the seed and their own coordinates, so the
+        // missing ones are generated in parallel.
+        std::vector<int> genX, genY;
         for (int i = 0; i < 2*vd + 1; ++i)
             for (int j = 0; j < 2*vd + 1; ++j)
                 if (!woah[i][j]) {
-                    std::cout << "Generating chunk (" << posX + i <<","<< posY + j <<")"<<std::endl;
-                    Chunk temp = Chunk(cellWidth, cellHeight, posX+i, posY+j, largeAssets, smallAssets, nose);
-                    Xs.push_back(i+posX);
-                    Ys.push_back(j+posY);
-                    worlds.push_back(temp);
-                    dXs.push_back(i+posX);
-                    dYs.push_back(j+posY);
-                    dWorlds.push_back(temp);
+                    LOG_DEBUG("Generating chunk ({},{})", posX + i, posY + j);
+                    genX.push_back(posX + i);
+                    genY.push_back(posY + j);
                 }
+        std::vector<Chunk*> generated(genX.size());
+        threadPool().parallelFor((int)genX.size(), [&](int k) {
+            generated[k] = new Chunk(cellWidth, cellHeight, genX[k], genY[k], &largeAssets, &smallAssets, nose, seed);
+        });
+        for (int k = 0; k < generated.size(); ++k) {
+            Xs.push_back(genX[k]);
+            Ys.push_back(genY[k]);
+            worlds.push_back(std::move(*generated[k]));
+            delete generated[k];
+            dXs.push_back(genX[k]);
+            dYs.push_back(genY[k]);
+            dIdx.push_back(worlds.size()-1);
+        }
+        
+        for (int i = 0; i < dIdx.size(); ++i)
+            dWorlds.push_back(&worlds[dIdx[i]]);
+        
+        // Collision footprints of the whole neighbourhood, relative to the
+        // current chunk (same offsets as renderChunks).
+        std::vector<glm::vec2> footprints;
+        for (int i = 0; i < dWorlds.size(); ++i) {
+            glm::vec2 origin(cellWidth*(dXs[i]-posX)-vd*cellWidth, cellHeight*(dYs[i]-posY)-vd*cellHeight);
+            const std::vector<glm::vec2>& objs = dWorlds[i]->objects();
+            for (int k = 0; k < objs.size(); ++k)
+                footprints.push_back(origin + objs[k]);
+        }
+        objectHash.build(footprints, 1.0f);
+        updateOccluders();
+        queries.reset(dWorlds.size());
+        updateCandidates();
         
         for (int i = 0; i < Xs.size(); ++i)
             if (Xs[i] - posX == vd && Ys[i] - posY == vd)
                 cChunk = &worlds[i];
         cChunk->print();
-        std::cout << "Total chunks:" << worlds.size() << " chunks." << std::endl;
-        std::cout << "Displayed chunks: " << dWorlds.size() << " chunks."<< std::endl;
+        lastLoadMillis = (profilerNanos() - loadStart) / 1e6;
+        lastGenerated = genX.size();
+        LOG_DEBUG("Total chunks:{} chunks.", worlds.size());
+        LOG_DEBUG("Displayed chunks: {} chunks.", dWorlds.size());
     }
     
-    // Render all loaded chunks.
+    // Camera for level of detail selection. Both passes use it, so the shadows
+    // match what is drawn. The GPU culler also tests against the frustum of
+    // the pass (camera or light). The terrain is rasterized into the
+    // occlusion buffer from the camera here, and the chunks tested against it.
+    void setView(glm::vec3 eye, float fovy, const glm::mat4& cameraViewProj, const glm::mat4& lightViewProj) {
+        lodView.eye = eye;
+        lodView.projScale = 1.0f / tan(fovy * 0.5f);
+        cameraFrustum = cameraViewProj;
+        lightFrustum = lightViewProj;
+        PROFILE_ZONE("occlusion raster");
+        occlusionStats = OcclusionStats();
+        chunkVisible.assign(dWorlds.size(), 1);
+        if (!bOcclusion)
+            return;
+        auto start = std::chrono::steady_clock::now();
+        occlusion.render(cameraViewProj, occluderVertices, occluderIndices);
+        occlusionStats.rasterMillis = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        occlusionStats.triangles = occlusion.triangleCount();
+        for (int i = 0; i < dWorlds.size(); ++i) {
+            chunkVisible[i] = !occlusion.occluded(chunkLo[i], chunkHi[i]);
+            occlusionStats.chunksTested++;
+            occlusionStats.chunksCulled += !chunkVisible[i];
+        }
+    }
+
+    // Trees and rocks are culled and batched on the GPU.
+    bool gpuCulling() const {
+        return culler.enabled() && batch.enabled();
+    }
+
+    // Render all loaded chunks. The camera pass (l == 1) skips what the
+    // hills hide, and the objects of chunks last frame's occlusion queries
+    // found hidden; the shadow pass keeps it all, it may still cast shadows.
     void renderChunks(Shader shader, int l) {
+        PROFILE_ZONE("renderChunks");
+        bool gpu = gpuCulling();
+        bool occlude = l == 1 && bOcclusion && chunkVisible.size() == dWorlds.size();
+        bool query = l == 1 && bOcclusionQueries;
+        if (query)
+            queries.collect();
+        // chunks whose objects may be seen, for the GPU culler
+        objectsVisible.assign(dWorlds.size(), 1);
         glm::mat4 model = glm::mat4(1.0f);
         for (int i = 0; i < dXs.size(); ++i) {
+            if (occlude && !chunkVisible[i]) {
+                objectsVisible[i] = 0;
+                continue;
+            }
+            if (query && queries.hidden(i))
+                objectsVisible[i] = 0;
+            // conditional rendering only helps draws of this chunk alone
+            GLuint condition = query && !gpu && !batch.enabled() ? queries.condition(i) : 0;
             model = glm::translate(glm::mat4(1.0f), glm::vec3(cellWidth*(dXs[i]-posX)-vd*cellWidth, 0.0f, cellHeight*(dYs[i]-posY)-vd*cellHeight));
-            dWorlds[i].render(shader, model, woodTexture, l);
+            dWorlds[i]->render(shader, model, woodTexture, l, terrain, lodView, &impostors,
+                               batch.enabled() ? &batch : NULL, !gpu && objectsVisible[i], occlude ? &occlusion : NULL,
+                               condition);
         }
+        if (gpu) {
+            // the shadow pass only has trees, like on the CPU
+            CullParams params;
+            params.viewProj = l == 1 ? cameraFrustum : lightFrustum;
+            params.view = lodView;
+            params.modelLimit = l == 1 ? largeAssets.size() + smallAssets.size() : largeAssets.size();
+            params.impostors = l == 1;
+            // objects are only occluded per chunk here
+            if (occlude || query)
+                params.visibleChunks = &objectsVisible;
+            culler.cull(params);
+            culler.draw(shader, batch);
+        } else if (batch.enabled())
+            batch.flush(shader);
+        if (!query)
+            return;
+        // boxes of the chunks drawn, against everything drawn so far
+        shader.use();
+        shader.setBool("instanced", false);
+        ChunkQueries::begin();
+        for (int i = 0; i < dWorlds.size(); ++i)
+            if (!occlude || chunkVisible[i])
+                queries.issue(shader, i, chunkLo[i], chunkHi[i], lodView.eye);
+        ChunkQueries::end();
+    }
+
+    // Pack trees and small objects into one buffer and texture array, so
+    // renderChunks draws them with one call per pass (see batch.h).
+    void buildVegetationBatch() {
+        std::vector<Model*> models;
+        for (unsigned int i = 0; i < largeAssets.size(); ++i)
+            models.push_back(&largeAssets[i]);
+        for (unsigned int i = 0; i < smallAssets.size(); ++i)
+            models.push_back(&smallAssets[i]);
+        if (!batch.build(models) || !bGpuCull)
+            return;
+        if (culler.init(batch, models, &impostors))
+            updateCandidates();
     }
+
+    // Hand the objects of the displayed chunks to the GPU culler, placed
+    // relative to the current chunk like renderChunks does.
+    void updateCandidates() {
+        if (!culler.ready())
+            return;
+        std::vector<CullCandidate> candidates;
+        for (int i = 0; i < dWorlds.size(); ++i) {
+            glm::mat4 model = glm::translate(glm::mat4(1.0f), glm::vec3(cellWidth*(dXs[i]-posX)-vd*cellWidth, 0.0f, cellHeight*(dYs[i]-posY)-vd*cellHeight));
+            dWorlds[i]->objectInstances(model, i, candidates);
+        }
+        culler.setCandidates(candidates);
+    }
+
+    // World space occluder mesh and boxes of the displayed chunks, placed
+    // like renderChunks does.
+    void updateOccluders() {
+        occluderVertices.clear();
+        occluderIndices.clear();
+        chunkLo.resize(dWorlds.size());
+        chunkHi.resize(dWorlds.size());
+        chunkVisible.assign(dWorlds.size(), 1);
+        for (int i = 0; i < dWorlds.size(); ++i) {
+            glm::mat4 model = glm::translate(glm::mat4(1.0f), glm::vec3(cellWidth*(dXs[i]-posX)-vd*cellWidth, 0.0f, cellHeight*(dYs[i]-posY)-vd*cellHeight));
+            dWorlds[i]->occluderMesh(model, occluderVertices, occluderIndices);
+            dWorlds[i]->bounds(model, chunkLo[i], chunkHi[i]);
+        }
+    }
+
+    // Impostor atlases for the trees, where baked (see impostor.h).
+    void loadImpostors() {
+        std::vector<std::string> paths = largeAssetPaths();
+        impostors.resize(largeAssets.size());
+        for (unsigned int i = 0; i < largeAssets.size() && i < paths.size(); ++i)
+            impostors[i].load(paths[i], largeAssets[i]);
+    }
+
+    // Draw the trees renderChunks queued as impostors. shader needs the same
+    // camera and light uniforms as the main pass.
+    void renderImpostors(Shader& shader) {
+        PROFILE_ZONE("renderImpostors");
+        if (gpuCulling()) {
+            culler.drawImpostors(shader);
+            return;
+        }
+        for (unsigned int i = 0; i < impostors.size(); ++i)
+            if (impostors[i].loaded())
+                impostors[i].flush(shader);
+    }
+    
+    // How long the last loadChunks() took, and how many chunks it had to
+    // generate rather than find in memory.
+    double lastLoadMillis = 0.0;
+    unsigned int lastGenerated = 0;
     
 private:
     int posX;
@@ -123,22 +374,29 @@ private:
     int vd;
     Chunk* cChunk;
     OpenSimplexNoise::Noise* nose;
-    vector <Model> largeAssets = {
-        Model("assets/models/trees/oak/oak.obj"),
-        Model("assets/models/trees/poplar/poplar.obj"),
-        Model("assets/models/trees/pine/pine.obj"),
-        Model("assets/models/trees/plum/plum.obj"),
-        Model("assets/models/trees/maple/maple.obj"),
-        Model("assets/models/trees/ash/ash.obj")
-    };
-    vector <Model> smallAssets = {
-        Model("assets/models/small/stump/stump.obj"),
-        Model("assets/models/small/rock/rock.obj")
-    };
-    unsigned int woodTexture = loadTexture("assets/textures/surfaces/grass.jpg");
+    uint64_t seed;
+    vector <Model> largeAssets;
+    vector <Model> smallAssets;
+    unsigned int woodTexture;
     OpenSimplexNoise::Noise* noise;
     std::vector<Chunk> worlds;
-    std::vector<Chunk> dWorlds;
+    std::vector<Chunk*> dWorlds;
+    TerrainBuffer terrain;
+    LodView lodView;
+    std::vector<Impostor> impostors;
+    VegetationBatch batch;
+    GpuCuller culler;
+    glm::mat4 cameraFrustum = glm::mat4(1.0f);
+    glm::mat4 lightFrustum = glm::mat4(1.0f);
+    OcclusionBuffer occlusion;
+    std::vector<glm::vec3> occluderVertices;
+    std::vector<unsigned int> occluderIndices;
+    std::vector<glm::vec3> chunkLo;
+    std::vector<glm::vec3> chunkHi;
+    std::vector<char> chunkVisible;
+    std::vector<char> objectsVisible;
+    ChunkQueries queries;
+    SpatialHash objectHash;
     std::vector<int> Xs;
     std::vector<int> dXs;
     std::vector<int> Ys;